@@ -3,130 +3,921 @@
 
 	Purpose: The first program is given a directory of images and
     feature set and it writes the feature vector for each image to a file.
-*/	
+*/
 
 #include <iostream>
 #include <vector>
 #include <string>
 #include <filesystem>
-#include "csv_util.h"
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <memory>
+#include "featureCsv.h"
 #include "featureMethods.h"
+#include "distanceFunctions.h"
+#include "imageIO.h"
+#include "threadPool.h"
+#include "manifest.h"
+#include "checkpoint.h"
+#include "featureStore.h"
+#include "featureDatabase.h"
+#include "quantize.h"
 
 // Define filesystem
 namespace fs = std::filesystem;
 
+// Status of a method whose row is carried over from the previous build
+#define STATUS_REUSED 1
+
+// Result of processing one image, one status and feature vector per requested method
+struct ImageResult {
+    bool found = false;     // file could be stat'ed and hashed
+    bool readable = false;  // file was decoded
+    ManifestEntry entry;
+    std::vector<int> status;
+    std::vector<std::vector<float>> features;
+    std::vector<float> drift;  // full resolution drift per method, -1 if not measured
+};
+
+// Previous build of one feature file, used by incremental builds
+struct PreviousStore {
+    bool valid = false;
+    int decodeScale = 1;
+    std::unordered_map<std::string, ManifestEntry> manifest;
+    std::unique_ptr<FeatureDatabase> database;
+    std::unordered_map<std::string, ImageId> rows;  // image path to row of database
+};
+
+// Settings shared by every image of a build
+struct BuildConfig {
+    std::vector<std::string> methods;
+    std::vector<int> decodeScales;        // decode scale per method
+    std::vector<PreviousStore> previous;  // previous build per method, empty for a full build
+};
+
 /*
-    Retrieve image files from directory
+    Parse a comma separated list of feature methods, "all" selects every method
 
     Parameters:
-        directory: path to directory of images
-        imageFiles: output vector of image file paths
-    
+        methodList: e.g. "chistogram" or "baseline,texture" or "all"
+        methods: output list of feature method names, without duplicates
+
     Returns:
-        number of images found
-        -1, on error
+        0 on success
+        -1 if a method is not valid
 */
+int parseFeatureMethods(const std::string &methodList, std::vector<std::string> &methods) {
+    methods.clear();
 
-int retrieveImageFiles(const std::string &directory, std::vector<std::string> &imageFiles) {
-    imageFiles.clear();
+    size_t start = 0;
+    while (start <= methodList.size()) {
+        size_t end = methodList.find(',', start);
+        if (end == std::string::npos) {
+            end = methodList.size();
+        }
+        std::string method = methodList.substr(start, end - start);
+        start = end + 1;
 
-    // Check if directory exists
-    if (!fs::exists(directory) || !fs::is_directory(directory)) {
-        printf("Error! Directory does not exist!\n");
-        return -1;
+        if (method == "all") {
+            for (const std::string &m : buildMethods()) {
+                if (std::find(methods.begin(), methods.end(), m) == methods.end()) {
+                    methods.push_back(m);
+                }
+            }
+            continue;
+        }
+
+        if (!validFeatureMethod(method)) {
+            printf("Error, feature method %s not valid!\n", method.c_str());
+            return -1;
+        }
+        if (std::find(methods.begin(), methods.end(), method) == methods.end()) {
+            methods.push_back(method);
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Extract a feature vector from an image with one feature method
+
+    Parameters:
+        image: decoded image
+        featureMethod: feature method name
+        features: output feature vector
+
+    Returns:
+        0 on success
+        -1 on extraction error
+        -2 if no face was detected (face method)
+*/
+int extractFeatures(const cv::Mat &image, const std::string &featureMethod, std::vector<float> &features) {
+    if (featureMethod == "baseline") {
+        return baseline7x7(image, features);
+    }
+    else if (featureMethod == "chistogram") {
+        return colorHistogram(image, features);
+    }
+    else if (featureMethod == "mhistogram") {
+        return multiHistogram(image, features);
+    }
+    else if (featureMethod == "texture") {
+        return textureAndColor(image, features, 16);
+    }
+    else if (featureMethod == "face") {
+        return faceDetectHistogram(image, features, 16);
+    }
+
+    return -1;
+}
+
+/*
+    Load the feature file and manifest written by a previous build
+
+    Parameters:
+        featureFile: path to the feature file
+        previous: output rows and manifest, valid is false if either file is missing
+*/
+void loadPreviousStore(const std::string &featureFile, PreviousStore &previous) {
+    previous.valid = false;
+
+    if (!fs::exists(featureFile) || readManifest(manifestPath(featureFile), previous.manifest, &previous.decodeScale) != 0) {
+        return;
+    }
+
+    previous.database = std::make_unique<FeatureDatabase>();
+    if (previous.database->load(featureFile) != 0) {
+        return;
+    }
+
+    for (ImageId id = 0; id < previous.database->size(); id++) {
+        previous.rows[previous.database->name(id)] = id;
+    }
+    previous.valid = true;
+}
+
+/*
+    Check if the previous build of a feature file is still valid for an image.
+    Unchanged size and mtime means unchanged; with a new mtime but the same size
+    the content hash decides.
+
+    Parameters:
+        previous: previous build of the feature file
+        result: image being processed, its hash is filled in when it had to be computed
+        haveHash: true once result.entry.hash is known
+
+    Returns:
+        true if the previous row (or absence of a row) can be reused
+*/
+bool previousStillValid(const PreviousStore &previous, ImageResult &result, bool &haveHash) {
+    if (!previous.valid) {
+        return false;
+    }
+
+    auto it = previous.manifest.find(result.entry.path);
+    if (it == previous.manifest.end() || it->second.size != result.entry.size) {
+        return false;
     }
 
-    for (const auto &entry : fs::directory_iterator(directory)) {
-        if (!entry.is_regular_file()) {
+    if (it->second.mtime == result.entry.mtime) {
+        if (!haveHash) {
+            result.entry.hash = it->second.hash;
+            haveHash = true;
+        }
+        return true;
+    }
+
+    if (!haveHash) {
+        if (hashFile(result.entry.path, result.entry.hash) != 0) {
+            return false;
+        }
+        haveHash = true;
+    }
+    return it->second.hash == result.entry.hash;
+}
+
+/*
+    Distance between the features of a full resolution decode and a reduced
+    resolution decode, using the distance matchImage uses for the method
+
+    Parameters:
+        featureMethod: feature method name
+        full: features from the full resolution image
+        reduced: features from the reduced resolution image
+
+    Returns:
+        drift distance, 0 = identical
+*/
+float featureDrift(const std::string &featureMethod, const std::vector<float> &full, const std::vector<float> &reduced) {
+    if (featureMethod == "mhistogram") {
+        return multiHistogramDistance(full, reduced, 0.5f);
+    }
+    else if (featureMethod == "texture") {
+        return textureColorDistance(full, reduced, 0.4f);
+    }
+
+    return histogramIntersection(full, reduced);
+}
+
+/*
+    Read one image and run every requested extractor on it. The file is read
+    once, for its manifest hash and every decode, and the image is decoded
+    once per distinct decode scale. In incremental builds only the methods whose
+    previous row is out of date are run, and the image is not decoded at all if
+    every method can be reused.
+
+    Parameters:
+        imgPath: path to the image
+        config: methods, decode scales and previous builds
+        checkDrift: also extract reduced scale methods at full resolution and record the drift
+        result: output statuses and feature vectors, one per method
+*/
+void processImage(const std::string &imgPath, const BuildConfig &config, bool checkDrift, ImageResult &result) {
+    const std::vector<std::string> &methods = config.methods;
+
+    result.status.assign(methods.size(), -1);
+    result.features.assign(methods.size(), std::vector<float>());
+    result.drift.assign(methods.size(), -1.0f);
+
+    if (statImageFile(imgPath, result.entry) != 0) {
+        return;
+    }
+
+    // Decide which methods need extracting
+    bool haveHash = false;
+    for (size_t m = 0; m < methods.size(); m++) {
+        if (!config.previous.empty() && previousStillValid(config.previous[m], result, haveHash)) {
+            result.status[m] = STATUS_REUSED;
+        }
+    }
+
+    bool extract = false;
+    for (size_t m = 0; m < methods.size(); m++) {
+        extract = extract || result.status[m] != STATUS_REUSED;
+    }
+
+    // An image that is extracted is read once, hashed for the manifest and decoded from memory
+    std::vector<unsigned char> bytes;
+    if (extract) {
+        if (readImageBytes(imgPath, bytes) != 0) {
+            return;
+        }
+        if (!haveHash) {
+            result.entry.hash = hashBytes(bytes.data(), bytes.size());
+        }
+    }
+    else if (!haveHash && hashFile(imgPath, result.entry.hash) != 0) {
+        return;
+    }
+    result.found = true;
+
+    // Decode once per scale in use, full resolution first so drift checks can reuse it
+    cv::Mat fullImage;
+    for (int scale : {1, 2, 4, 8}) {
+        bool needed = false;
+        for (size_t m = 0; m < methods.size(); m++) {
+            needed = needed || (result.status[m] != STATUS_REUSED && config.decodeScales[m] == scale);
+        }
+        if (!needed) {
             continue;
         }
 
-        fs::path filepath = entry.path();
-        std::string ext = filepath.extension().string();
+        // Read image
+        cv::Mat image;
+        if (decodeImage(bytes, image, scale) != 0) {
+            continue;
+        }
+        result.readable = true;
 
-        if (ext == ".jpg") {
-            imageFiles.push_back(filepath.string());
+        if (scale == 1) {
+            fullImage = image;
         }
+
+        for (size_t m = 0; m < methods.size(); m++) {
+            if (result.status[m] != STATUS_REUSED && config.decodeScales[m] == scale) {
+                result.status[m] = extractFeatures(image, methods[m], result.features[m]);
+            }
+        }
+    }
+
+    if (!checkDrift) {
+        return;
     }
 
-    // Return number of files
-    return static_cast<int>(imageFiles.size());
+    // Compare reduced scale features against a full resolution extraction
+    for (size_t m = 0; m < methods.size(); m++) {
+        if (config.decodeScales[m] == 1 || result.status[m] != 0) {
+            continue;
+        }
+
+        if (fullImage.empty() && decodeImage(bytes, fullImage, 1) != 0) {
+            return;
+        }
+
+        std::vector<float> fullFeatures;
+        if (extractFeatures(fullImage, methods[m], fullFeatures) == 0) {
+            result.drift[m] = featureDrift(methods[m], fullFeatures, result.features[m]);
+        }
+    }
+}
+
+/*
+    Apply one --decode-scale argument, either "N" for every method that supports
+    reduced decoding or "method=N" for one method
+
+    Parameters:
+        arg: option value
+        methods: feature methods being built
+        decodeScales: decode scale per method, updated
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int applyDecodeScale(const std::string &arg, const std::vector<std::string> &methods, std::vector<int> &decodeScales) {
+    size_t eq = arg.find('=');
+    std::string method = eq == std::string::npos ? "" : arg.substr(0, eq);
+    int scale = std::atoi(arg.c_str() + (eq == std::string::npos ? 0 : eq + 1));
+
+    if (!validDecodeScale(scale)) {
+        printf("Error, decode scale must be 1, 2, 4 or 8!\n");
+        return -1;
+    }
+
+    if (method.empty()) {
+        for (size_t m = 0; m < methods.size(); m++) {
+            if (methodSupportsDecodeScale(methods[m])) {
+                decodeScales[m] = scale;
+            }
+        }
+        return 0;
+    }
+
+    auto it = std::find(methods.begin(), methods.end(), method);
+    if (it == methods.end()) {
+        printf("Error, %s is not being built!\n", method.c_str());
+        return -1;
+    }
+
+    if (scale != 1 && !methodSupportsDecodeScale(method)) {
+        printf("Error, %s must be extracted at full resolution!\n", method.c_str());
+        return -1;
+    }
+
+    decodeScales[it - methods.begin()] = scale;
+    return 0;
 }
 
 // Generate features in csv for image matching
 int main(int argc, char* argv[]) {
     // Argument checks
-    if (argc != 4) {
-        printf("Usage: %s <image_directory> <feature_method> <output_csv>\n", argv[0]);
-        printf("Feature methods: baseline, chistogram\n");
+    if (argc < 4) {
+        printf("Usage: %s <image_directory> <feature_method> <output_csv> [--threads N] [--incremental]\n", argv[0]);
+        printf("       [--recursive] [--decode-scale [method=]N] [--drift-check K]\n");
+        printf("       [--checkpoint-every K] [--resume] [--shard i/N] [--quantize u8|u16]\n");
+        printf("       [--sparse]\n");
+        printf("<image_directory> may also be a file with one image path per line, or - for stdin\n");
+        printf("Feature methods: baseline, chistogram, mhistogram, texture, face\n");
+        printf("Several methods (e.g. baseline,texture or all) decode each image once and write\n");
+        printf("one file per method, named by inserting the method before the extension\n");
+        printf("An output ending in .fst is written as a binary feature store instead of a CSV,\n");
+        printf("--quantize stores its histogram methods as 8 or 16-bit bins, --sparse as nonzero bins\n");
         return -1;
     }
-    
+
     // Parse arguments
     std::string dbDirectory = argv[1];
-    std::string featureMethod = argv[2];
-    char* outputCSV = argv[3];
+    std::string outputCSV = argv[3];
+
+    BuildConfig config;
+    std::vector<std::string> &methods = config.methods;
+    if (parseFeatureMethods(argv[2], methods) != 0) {
+        return -1;
+    }
+    config.decodeScales.assign(methods.size(), 1);
+    bool multiMethod = methods.size() > 1;
+
+    // Parse options
+    int numThreads = 1;
+    bool incremental = false;
+    bool recursive = false;
+    bool resume = false;
+    int driftEvery = 0;
+    int checkpointEvery = 1000;
+    bool checkpointGiven = false;
+    int shardIndex = 0;
+    int shardCount = 1;
+    int quantization = FEATURE_STORE_FLOAT32;
+    bool sparse = false;
+    for (int i = 4; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--threads" && i + 1 < argc) {
+            numThreads = std::atoi(argv[++i]);
+        }
+        else if (option == "--incremental") {
+            incremental = true;
+        }
+        else if (option == "--recursive") {
+            recursive = true;
+        }
+        else if (option == "--decode-scale" && i + 1 < argc) {
+            if (applyDecodeScale(argv[++i], methods, config.decodeScales) != 0) {
+                return -1;
+            }
+        }
+        else if (option == "--drift-check" && i + 1 < argc) {
+            driftEvery = std::atoi(argv[++i]);
+        }
+        else if (option == "--checkpoint-every" && i + 1 < argc) {
+            checkpointEvery = std::atoi(argv[++i]);
+            checkpointGiven = true;
+        }
+        else if (option == "--resume") {
+            resume = true;
+        }
+        else if (option == "--shard" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d/%d", &shardIndex, &shardCount) != 2 || shardCount < 1 ||
+                shardIndex < 0 || shardIndex >= shardCount) {
+                printf("Error, shard must be i/N with 0 <= i < N!\n");
+                return -1;
+            }
+        }
+        else if (option == "--quantize" && i + 1 < argc) {
+            if (parseQuantization(argv[++i], quantization) != 0) {
+                return -1;
+            }
+        }
+        else if (option == "--sparse") {
+            sparse = true;
+        }
+        else {
+            printf("Error, unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (numThreads < 1) {
+        printf("Error, thread count must be at least 1!\n");
+        return -1;
+    }
+
+    // Incremental builds rewrite the whole store at the end, there is nothing to resume
+    if (incremental) {
+        if (resume) {
+            printf("Error, --resume cannot be combined with --incremental!\n");
+            return -1;
+        }
+        if (checkpointGiven && checkpointEvery > 0) {
+            printf("Error, --checkpoint-every cannot be combined with --incremental!\n");
+            return -1;
+        }
+        checkpointEvery = 0;
+    }
+
+    // A binary store only becomes valid when its name table is written at the end
+    bool binaryOutput = isBinaryStorePath(outputCSV);
+    if (binaryOutput) {
+        if (resume) {
+            printf("Error, --resume needs a CSV output, binary stores are written in one go!\n");
+            return -1;
+        }
+        if (checkpointGiven && checkpointEvery > 0) {
+            printf("Error, --checkpoint-every needs a CSV output, binary stores are written in one go!\n");
+            return -1;
+        }
+        checkpointEvery = 0;
+    }
+
+    if (quantization != FEATURE_STORE_FLOAT32 && !binaryOutput) {
+        printf("Error, --quantize needs a binary (.fst) output!\n");
+        return -1;
+    }
+    if (sparse && !binaryOutput) {
+        printf("Error, --sparse needs a binary (.fst) output!\n");
+        return -1;
+    }
 
-    std::vector<std::string> imageFiles;
-    int numImages = retrieveImageFiles(dbDirectory, imageFiles);
+    // One output store per method, incremental builds write to a temporary file
+    // and replace the store at the end since the old rows are copied over
+    std::vector<std::string> outputPaths;
+    std::vector<std::string> writePaths;
+    for (const auto &method : methods) {
+        outputPaths.push_back(storePath(outputCSV, method, multiMethod));
+        writePaths.push_back(incremental ? outputPaths.back() + ".tmp" : outputPaths.back());
+        if (multiMethod) {
+            printf("Writing %s features to %s\n", method.c_str(), outputPaths.back().c_str());
+        }
+    }
 
-    printf("Found %d images.\n", numImages);
+    // Previous builds for incremental mode
+    std::vector<PreviousStore> &previous = config.previous;
+    if (incremental) {
+        previous.resize(methods.size());
+        for (size_t m = 0; m < methods.size(); m++) {
+            loadPreviousStore(outputPaths[m], previous[m]);
+            if (!previous[m].valid) {
+                printf("No previous build of %s, extracting all images\n", outputPaths[m].c_str());
+            }
+            else if (previous[m].decodeScale != config.decodeScales[m]) {
+                printf("Decode scale of %s changed, extracting all images\n", outputPaths[m].c_str());
+                previous[m].valid = false;
+            }
+            else if (previous[m].database->dtype() !=
+                     (binaryOutput && isHistogramMethod(methods[m]) ? quantization : FEATURE_STORE_FLOAT32)) {
+                printf("Quantization of %s changed, extracting all images\n", outputPaths[m].c_str());
+                previous[m].valid = false;
+            }
+        }
+    }
 
-    // Control for wiping csv and appending
-    int reset = 1;
+    // Drift reports for methods decoded at reduced scale, one "path,drift" line per checked image
+    std::vector<FILE *> driftFiles(methods.size(), nullptr);
+    std::vector<double> driftSum(methods.size(), 0.0);
+    std::vector<float> driftMax(methods.size(), 0.0f);
+    std::vector<int> driftCount(methods.size(), 0);
 
     // Images with face counter
     int faceImagesCounter = 0;
 
-    // Extract feature vector from each image
-    for (const auto &imgPath: imageFiles) {
-        // Read image
-        cv::Mat image = cv::imread(imgPath);
-        if (image.empty()) {
-            continue;
+    // Manifest entries for every image processed, shared by all methods
+    std::vector<ManifestEntry> manifestEntries;
+    int unchangedImages = 0;
+
+    // Resume from the last checkpoint, dropping anything written after it
+    std::string checkpointFile = checkpointPath(outputCSV);
+    std::string journalFile = journalPath(outputCSV);
+    Checkpoint resumeFrom;
+    if (resume) {
+        if (readCheckpoint(checkpointFile, resumeFrom) != 0) {
+            printf("Error, no usable checkpoint %s to resume from!\n", checkpointFile.c_str());
+            return -1;
         }
-        
-        std::vector<float> features;
-        int status = -1;
-        // Run baseline feature method
-        if (featureMethod == "baseline") {
-            status = baseline7x7(image, features);
+
+        if (resumeFrom.methods != methods) {
+            printf("Error, the checkpoint was written for different feature methods!\n");
+            return -1;
         }
-        else if (featureMethod == "chistogram") {
-            status = colorHistogram(image, features);
+
+        for (size_t m = 0; m < methods.size(); m++) {
+            if (truncateToCheckpoint(writePaths[m], resumeFrom.storeSizes[m]) != 0) {
+                return -1;
+            }
+        }
+
+        if (truncateToCheckpoint(journalFile, resumeFrom.journalSize) != 0 ||
+            readManifestEntries(journalFile, manifestEntries) != 0) {
+            return -1;
         }
-        else if (featureMethod == "mhistogram") {
-            status = multiHistogram(image, features);
+
+        // A drift report the checkpoint does not know of is started over, the
+        // others continue with the statistics of the images before the checkpoint
+        for (size_t m = 0; m < methods.size() && driftEvery > 0; m++) {
+            if (config.decodeScales[m] > 1) {
+                auto it = std::find(resumeFrom.driftMethods.begin(), resumeFrom.driftMethods.end(), methods[m]);
+                uint64_t size = 0;
+                if (it != resumeFrom.driftMethods.end()) {
+                    size_t d = static_cast<size_t>(it - resumeFrom.driftMethods.begin());
+                    size = resumeFrom.driftSizes[d];
+                    driftCount[m] = resumeFrom.driftCounts[d];
+                    driftSum[m] = resumeFrom.driftSums[d];
+                    driftMax[m] = resumeFrom.driftMaxes[d];
+                }
+                if (truncateToCheckpoint(outputPaths[m] + ".drift", size) != 0) {
+                    return -1;
+                }
+            }
         }
-        else if (featureMethod == "texture") {
-            status = textureAndColor(image, features,16);
+
+        faceImagesCounter = resumeFrom.faceImages;
+    }
+
+    // Manifest lines are journaled as images are written so a resumed build has them all
+    FILE *journal = nullptr;
+    if (checkpointEvery > 0 || resume) {
+        journal = fopen(journalFile.c_str(), resume ? "a" : "w");
+        if (!journal) {
+            printf("Unable to open manifest journal %s\n", journalFile.c_str());
+            return -1;
         }
-        else if (featureMethod == "face") {
-            status = faceDetectHistogram(image, features, 16);
-            if (status == -2) {
-                printf("Skipping! No face detected in %s!\n", imgPath.c_str());
-                continue;
+    }
+
+    // Drift reports are held open like the stores, a resumed report continues after the checkpoint
+    for (size_t m = 0; m < methods.size() && driftEvery > 0; m++) {
+        if (config.decodeScales[m] > 1) {
+            std::string driftPath = outputPaths[m] + ".drift";
+            driftFiles[m] = fopen(driftPath.c_str(), resume ? "a" : "w");
+            if (!driftFiles[m]) {
+                printf("Unable to open drift report %s\n", driftPath.c_str());
+                return -1;
             }
-            faceImagesCounter++;
+        }
+    }
+
+    // Every store is held open for the whole build, a resumed CSV continues after the checkpoint
+    std::vector<std::unique_ptr<FeatureCsvWriter>> csvWriters(methods.size());
+    std::vector<std::unique_ptr<FeatureStoreWriter>> binaryWriters(methods.size());
+    for (size_t m = 0; m < methods.size(); m++) {
+        int status;
+        if (binaryOutput) {
+            binaryWriters[m] = std::make_unique<FeatureStoreWriter>();
+            // Only histogram methods are quantized or sparse, the others stay dense float32
+            bool histogram = isHistogramMethod(methods[m]);
+            int dtype = histogram ? quantization : FEATURE_STORE_FLOAT32;
+            status = binaryWriters[m]->open(writePaths[m], methods[m], config.decodeScales[m], dtype,
+                                            histogram && sparse);
         }
         else {
-            printf("Error, feature method not valid!\n");
+            csvWriters[m] = std::make_unique<FeatureCsvWriter>();
+            status = csvWriters[m]->open(writePaths[m], resume);
+        }
+        if (status != 0) {
+            return -1;
+        }
+    }
+
+    // Images are streamed from the walk straight into extraction
+    ImageEnumerator imageFiles;
+    imageFiles.setShard(shardIndex, shardCount);
+    if (imageFiles.start(dbDirectory, recursive) != 0) {
+        return -1;
+    }
+
+    // Skip the images finished before the checkpoint
+    size_t imagesDone = 0;
+    if (resume) {
+        std::string skipped;
+        while (imagesDone < resumeFrom.images && imageFiles.next(skipped)) {
+            imagesDone++;
+        }
+
+        if (imagesDone != resumeFrom.images || skipped != resumeFrom.lastPath) {
+            printf("Error, the image list changed since the checkpoint, cannot resume!\n");
             return -1;
         }
+        printf("Resuming after %zu images\n", imagesDone);
+    }
+
+    // Flush every output to disk, then record how far the build got
+    auto saveCheckpoint = [&](const std::string &lastPath) {
+        Checkpoint checkpoint;
+        checkpoint.images = imagesDone;
+        checkpoint.faceImages = faceImagesCounter;
+        checkpoint.lastPath = lastPath;
+        checkpoint.methods = methods;
 
+        if (syncFile(journal) != 0 || filePosition(journal, checkpoint.journalSize) != 0) {
+            return -1;
+        }
+
+        for (size_t m = 0; m < methods.size(); m++) {
+            uint64_t size = 0;
+            if (csvWriters[m]->flush() != 0 || syncPath(writePaths[m], size) != 0) {
+                return -1;
+            }
+            checkpoint.storeSizes.push_back(size);
+        }
+
+        for (size_t m = 0; m < methods.size(); m++) {
+            if (driftFiles[m]) {
+                uint64_t size = 0;
+                if (syncFile(driftFiles[m]) != 0 || filePosition(driftFiles[m], size) != 0) {
+                    return -1;
+                }
+                checkpoint.driftMethods.push_back(methods[m]);
+                checkpoint.driftSizes.push_back(size);
+                checkpoint.driftCounts.push_back(driftCount[m]);
+                checkpoint.driftSums.push_back(driftSum[m]);
+                checkpoint.driftMaxes.push_back(driftMax[m]);
+            }
+        }
+
+        return writeCheckpoint(checkpointFile, checkpoint);
+    };
+
+    // Write one finished image, rows are always written in enumeration order.
+    // A row that cannot be written stops the build
+    std::vector<float> carried;
+    bool writeFailed = false;
+    auto writeResult = [&](const std::string &imgPath, ImageResult &result) {
+        if (!result.found) {
+            return 0;
+        }
+        manifestEntries.push_back(result.entry);
+        if (journal) {
+            writeManifestEntry(journal, result.entry);
+        }
+
+        bool allReused = true;
+        for (size_t m = 0; m < methods.size(); m++) {
+            std::vector<float> *features = &result.features[m];
+
+            if (result.drift[m] >= 0 && driftFiles[m]) {
+                fprintf(driftFiles[m], "%s,%.5f\n", imgPath.c_str(), result.drift[m]);
+                driftSum[m] += result.drift[m];
+                driftMax[m] = std::max(driftMax[m], result.drift[m]);
+                driftCount[m]++;
+            }
+
+            if (result.status[m] == STATUS_REUSED) {
+                // Carry over the previous row, if there was one
+                auto it = previous[m].rows.find(imgPath);
+                if (it == previous[m].rows.end()) {
+                    continue;
+                }
+                // Quantized rows are carried over as their dequantized values
+                carried.resize(previous[m].database->dim());
+                previous[m].database->copyRow(it->second, carried.data());
+                features = &carried;
+            }
+            else {
+                allReused = false;
+
+                if (!result.readable) {
+                    continue;
+                }
+
+                if (result.status[m] == -2) {
+                    printf("Skipping! No face detected in %s!\n", imgPath.c_str());
+                    continue;
+                }
+
+                if (result.status[m] != 0) {
+                    printf("Warning: %s feature extraction failed for %s\n", methods[m].c_str(), imgPath.c_str());
+                    continue;
+                }
+            }
+
+            if (methods[m] == "face") {
+                faceImagesCounter++;
+            }
+
+            int status = binaryWriters[m] ? binaryWriters[m]->addRow(imgPath, *features)
+                                          : csvWriters[m]->addRow(imgPath, *features);
+            if (status != 0) {
+                printf("Error writing %s features of %s to %s, stopping the build\n", methods[m].c_str(),
+                       imgPath.c_str(), writePaths[m].c_str());
+                writeFailed = true;
+                return -1;
+            }
+        }
+
+        if (allReused) {
+            unchangedImages++;
+        }
+        return 0;
+    };
+
+    // Count a finished image and checkpoint periodically
+    auto imageDone = [&](const std::string &imgPath) {
+        imagesDone++;
+        if (checkpointEvery > 0 && imagesDone % checkpointEvery == 0 && saveCheckpoint(imgPath) != 0) {
+            printf("Warning: unable to write checkpoint after %s\n", imgPath.c_str());
+        }
+    };
+
+    // Drift checks sample images by their index in the whole enumeration, so a
+    // resumed build checks the same images as an uninterrupted one
+    size_t firstImage = imagesDone;
+
+    if (numThreads == 1) {
+        // Extract feature vector from each image
+        std::string imgPath;
+        for (size_t imageIndex = firstImage; imageFiles.next(imgPath); imageIndex++) {
+            ImageResult result;
+            processImage(imgPath, config, driftEvery > 0 && imageIndex % driftEvery == 0, result);
+            if (writeResult(imgPath, result) != 0) {
+                break;
+            }
+            imageDone(imgPath);
+        }
+    }
+    else {
+        // OpenCV's own threads would compete with the pool
+        cv::setNumThreads(1);
+
+        // Results wait in a ring of slots until every earlier image has been written,
+        // the ring bounds memory while giving the pool room to balance uneven images
+        size_t window = static_cast<size_t>(numThreads) * 16;
+        std::vector<ImageResult> slots(window);
+        std::vector<std::string> slotPaths(window);
+        std::vector<char> slotReady(window, 0);
+        std::mutex slotMutex;
+        std::condition_variable slotDone;
+
+        ThreadPool pool(numThreads);
+        size_t nextSubmit = 0;
+        bool enumerationDone = false;
+
+        for (size_t next = 0;; next++) {
+            // Keep the window full, only waiting on the walk when nothing is in flight
+            while (!enumerationDone && nextSubmit < next + window && (nextSubmit == next || imageFiles.ready())) {
+                size_t index = nextSubmit;
+                if (!imageFiles.next(slotPaths[index % window])) {
+                    enumerationDone = true;
+                    break;
+                }
+                nextSubmit++;
+
+                pool.submit([&, index, imgPath = slotPaths[index % window]] {
+                    ImageResult result;
+                    processImage(imgPath, config, driftEvery > 0 && (firstImage + index) % driftEvery == 0,
+                                 result);
+
+                    std::lock_guard<std::mutex> lock(slotMutex);
+                    slots[index % window] = std::move(result);
+                    slotReady[index % window] = 1;
+                    slotDone.notify_all();
+                });
+            }
+
+            if (next == nextSubmit) {
+                break;
+            }
+
+            // Wait for the next image in order
+            ImageResult result;
+            {
+                std::unique_lock<std::mutex> lock(slotMutex);
+                slotDone.wait(lock, [&] { return slotReady[next % window] != 0; });
+                result = std::move(slots[next % window]);
+                slotReady[next % window] = 0;
+            }
+
+            if (writeResult(slotPaths[next % window], result) != 0) {
+                break;
+            }
+            imageDone(slotPaths[next % window]);
+        }
+    }
+
+    if (writeFailed) {
+        return -1;
+    }
+
+    printf("Found %zu images.\n", imageFiles.count());
+
+    if (journal) {
+        fclose(journal);
+    }
+
+    for (size_t m = 0; m < methods.size(); m++) {
+        int status = binaryWriters[m] ? binaryWriters[m]->close() : csvWriters[m]->close();
         if (status != 0) {
-            printf("Warning: Feature extraction failed for %s\n", imgPath.c_str());
-            continue;
+            return -1;
         }
 
-        append_image_data_csv(outputCSV, const_cast<char*>(imgPath.c_str()), features, reset);
+        if (incremental) {
+            std::error_code ec;
+            fs::rename(writePaths[m], outputPaths[m], ec);
+            if (ec) {
+                printf("Error, unable to replace %s\n", outputPaths[m].c_str());
+                return -1;
+            }
+        }
 
-        reset = 0;       
+        if (writeManifest(manifestPath(outputPaths[m]), manifestEntries, config.decodeScales[m]) != 0) {
+            return -1;
+        }
+
+        if (driftFiles[m]) {
+            fclose(driftFiles[m]);
+            if (driftCount[m] > 0) {
+                printf("%s decoded at 1/%d: mean drift %.5f, max drift %.5f over %d images\n", methods[m].c_str(),
+                       config.decodeScales[m], driftSum[m] / driftCount[m], driftMax[m], driftCount[m]);
+            }
+        }
     }
 
-    if (featureMethod == "face") {
+    // The build is complete, the checkpoint is no longer needed
+    std::error_code ec;
+    fs::remove(checkpointFile, ec);
+    fs::remove(journalFile, ec);
+
+    if (incremental) {
+        // Images in an old manifest that were not seen again have been deleted
+        size_t removedImages = 0;
+        std::unordered_map<std::string, char> seen;
+        for (const auto &entry : manifestEntries) {
+            seen[entry.path] = 1;
+        }
+        for (const auto &store : previous) {
+            for (const auto &old : store.manifest) {
+                if (seen.emplace(old.first, 1).second) {
+                    removedImages++;
+                }
+            }
+        }
+
+        printf("Incremental build: %d unchanged, %d new or changed, %zu removed\n", unchangedImages,
+               static_cast<int>(manifestEntries.size()) - unchangedImages, removedImages);
+    }
+
+    if (std::find(methods.begin(), methods.end(), "face") != methods.end()) {
         printf("Found %d images with faces\n", faceImagesCounter);
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,295 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Checkpoint files for resuming long feature builds.
+*/
+
+#include "checkpoint.h"
+#include <cinttypes>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Define filesystem
+namespace fs = std::filesystem;
+
+/*
+    Checkpoint and manifest journal file names for a build
+
+    Parameters:
+        output: output path given on the command line
+
+    Returns:
+        checkpoint path or journal path
+*/
+std::string checkpointPath(const std::string &output) {
+    return output + ".checkpoint";
+}
+
+std::string journalPath(const std::string &output) {
+    return output + ".journal";
+}
+
+/*
+    Reads a checkpoint
+
+    Parameters:
+        filename: checkpoint path
+        checkpoint: output progress
+
+    Returns:
+        0 on success
+        -1 if the file is missing or malformed
+*/
+int readCheckpoint(const std::string &filename, Checkpoint &checkpoint) {
+    checkpoint = Checkpoint();
+
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (!fp) {
+        return -1;
+    }
+
+    char line[4096];
+    int fields = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+
+        char method[64];
+        uint64_t size;
+        int count = 0;
+        double sum = 0.0;
+        float max = 0.0f;
+        int driftFields;
+        if (sscanf(line, "images=%zu", &checkpoint.images) == 1 ||
+            sscanf(line, "faces=%d", &checkpoint.faceImages) == 1 ||
+            sscanf(line, "journal=%" SCNu64, &checkpoint.journalSize) == 1) {
+            fields++;
+        }
+        else if (strncmp(line, "last=", 5) == 0) {
+            checkpoint.lastPath = line + 5;
+        }
+        else if (sscanf(line, "store=%63[^,],%" SCNu64, method, &size) == 2) {
+            checkpoint.methods.push_back(method);
+            checkpoint.storeSizes.push_back(size);
+        }
+        else if ((driftFields = sscanf(line, "drift=%63[^,],%" SCNu64 ",%d,%lf,%f", method, &size, &count, &sum,
+                                       &max)) == 2 ||
+                 driftFields == 5) {
+            checkpoint.driftMethods.push_back(method);
+            checkpoint.driftSizes.push_back(size);
+            checkpoint.driftCounts.push_back(count);
+            checkpoint.driftSums.push_back(sum);
+            checkpoint.driftMaxes.push_back(max);
+        }
+        else {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return fields == 3 ? 0 : -1;
+}
+
+/*
+    Durably writes a checkpoint, replacing the previous one atomically
+
+    Parameters:
+        filename: checkpoint path
+        checkpoint: progress to record
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int writeCheckpoint(const std::string &filename, const Checkpoint &checkpoint) {
+    std::string tmpName = filename + ".tmp";
+
+    FILE *fp = fopen(tmpName.c_str(), "w");
+    if (!fp) {
+        printf("Unable to open checkpoint file %s\n", tmpName.c_str());
+        return -1;
+    }
+
+    fprintf(fp, "images=%zu\n", checkpoint.images);
+    fprintf(fp, "faces=%d\n", checkpoint.faceImages);
+    fprintf(fp, "journal=%" PRIu64 "\n", checkpoint.journalSize);
+    fprintf(fp, "last=%s\n", checkpoint.lastPath.c_str());
+    for (size_t m = 0; m < checkpoint.methods.size(); m++) {
+        fprintf(fp, "store=%s,%" PRIu64 "\n", checkpoint.methods[m].c_str(), checkpoint.storeSizes[m]);
+    }
+    for (size_t m = 0; m < checkpoint.driftMethods.size(); m++) {
+        fprintf(fp, "drift=%s,%" PRIu64 ",%d,%.17g,%.9g\n", checkpoint.driftMethods[m].c_str(),
+                checkpoint.driftSizes[m], checkpoint.driftCounts[m], checkpoint.driftSums[m],
+                static_cast<double>(checkpoint.driftMaxes[m]));
+    }
+
+    int status = syncFile(fp);
+    if (fclose(fp) != 0 || status != 0) {
+        printf("Error writing checkpoint file %s\n", tmpName.c_str());
+        return -1;
+    }
+
+    std::error_code ec;
+    fs::rename(tmpName, filename, ec);
+    if (ec) {
+        printf("Unable to replace checkpoint file %s\n", filename.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Flushes an open file to disk (fflush followed by fsync)
+
+    Parameters:
+        fp: open file
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int syncFile(FILE *fp) {
+    if (fflush(fp) != 0) {
+        return -1;
+    }
+
+#ifdef _WIN32
+    return _commit(_fileno(fp)) == 0 ? 0 : -1;
+#else
+    return fsync(fileno(fp)) == 0 ? 0 : -1;
+#endif
+}
+
+/*
+    Position of an open file, in 64 bits on every platform
+
+    Parameters:
+        fp: open file
+        position: output byte offset
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int filePosition(FILE *fp, uint64_t &position) {
+#ifdef _WIN32
+    __int64 offset = _ftelli64(fp);
+#else
+    off_t offset = ftello(fp);
+#endif
+    if (offset < 0) {
+        return -1;
+    }
+
+    position = static_cast<uint64_t>(offset);
+    return 0;
+}
+
+/*
+    Moves an open file to a byte offset, in 64 bits on every platform
+
+    Parameters:
+        fp: open file
+        offset: byte offset from the start
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int seekFile(FILE *fp, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(fp, static_cast<__int64>(offset), SEEK_SET) == 0 ? 0 : -1;
+#else
+    return fseeko(fp, static_cast<off_t>(offset), SEEK_SET) == 0 ? 0 : -1;
+#endif
+}
+
+/*
+    Flushes a file that is not held open to disk and reports its size
+
+    Parameters:
+        path: file path, a missing file has size 0
+        size: output file size in bytes
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int syncPath(const std::string &path, uint64_t &size) {
+    size = 0;
+
+    FILE *fp = fopen(path.c_str(), "rb+");
+    if (!fp) {
+        return fs::exists(path) ? -1 : 0;
+    }
+
+    int status = syncFile(fp);
+    fclose(fp);
+    if (status != 0) {
+        return -1;
+    }
+
+    std::error_code ec;
+    size = fs::file_size(path, ec);
+    return ec ? -1 : 0;
+}
+
+/*
+    Cuts a partial output file back to the length recorded at a checkpoint.
+
+    Parameters:
+        path: file path
+        size: length to keep
+
+    Returns:
+        0 on success
+        -1 if the file does not match the checkpoint
+*/
+int truncateToCheckpoint(const std::string &path, uint64_t size) {
+    std::error_code ec;
+    uint64_t actual = fs::exists(path) ? fs::file_size(path, ec) : 0;
+    if (ec || actual < size) {
+        printf("Error, %s is shorter than its checkpoint!\n", path.c_str());
+        return -1;
+    }
+
+    if (size > 0) {
+        // The kept part has to end on a complete row
+        FILE *fp = fopen(path.c_str(), "rb");
+        if (!fp) {
+            return -1;
+        }
+        int last = EOF;
+        if (seekFile(fp, size - 1) == 0) {
+            last = fgetc(fp);
+        }
+        fclose(fp);
+
+        if (last != '\n') {
+            printf("Error, %s does not end on a row at its checkpoint!\n", path.c_str());
+            return -1;
+        }
+    }
+
+    if (actual > size) {
+        printf("Dropping %" PRIu64 " bytes written after the checkpoint from %s\n", actual - size, path.c_str());
+        fs::resize_file(path, size, ec);
+        if (ec) {
+            printf("Unable to truncate %s\n", path.c_str());
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for the checkpoints buildFeatures writes during long
+    builds so a killed build can be resumed.
+
+    A checkpoint is a small text file written next to the output:
+        images=<images consumed from the enumeration>
+        faces=<images with faces written so far>
+        journal=<byte length of the manifest journal>
+        last=<path of the last image consumed>
+        store=<method>,<byte length of the store>   (one line per feature file)
+        drift=<method>,<byte length of the drift report>,<images>,<drift sum>,<max drift>
+                                                     (one line per drift report)
+    It is only written after every file it describes has been flushed to disk,
+    and it is replaced atomically, so the recorded lengths always end on a
+    complete row.
+*/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Progress of a build at a checkpoint
+struct Checkpoint {
+    size_t images = 0;
+    int faceImages = 0;
+    uint64_t journalSize = 0;
+    std::string lastPath;
+    std::vector<std::string> methods;
+    std::vector<uint64_t> storeSizes;
+    std::vector<std::string> driftMethods;
+    std::vector<uint64_t> driftSizes;
+    std::vector<int> driftCounts;
+    std::vector<double> driftSums;
+    std::vector<float> driftMaxes;
+};
+
+/*
+    Checkpoint and manifest journal file names for a build
+
+    Parameters:
+        output: output path given on the command line
+
+    Returns:
+        checkpoint path (output + ".checkpoint") or journal path (output + ".journal")
+*/
+std::string checkpointPath(const std::string &output);
+std::string journalPath(const std::string &output);
+
+/*
+    Reads a checkpoint
+
+    Parameters:
+        filename: checkpoint path
+        checkpoint: output progress
+
+    Returns:
+        0 on success
+        -1 if the file is missing or malformed
+*/
+int readCheckpoint(const std::string &filename, Checkpoint &checkpoint);
+
+/*
+    Durably writes a checkpoint, replacing the previous one atomically
+
+    Parameters:
+        filename: checkpoint path
+        checkpoint: progress to record
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int writeCheckpoint(const std::string &filename, const Checkpoint &checkpoint);
+
+/*
+    Flushes an open file to disk (fflush followed by fsync)
+
+    Parameters:
+        fp: open file
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int syncFile(FILE *fp);
+
+/*
+    Position of an open file, in 64 bits on every platform
+
+    Parameters:
+        fp: open file
+        position: output byte offset
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int filePosition(FILE *fp, uint64_t &position);
+
+/*
+    Moves an open file to a byte offset, in 64 bits on every platform
+
+    Parameters:
+        fp: open file
+        offset: byte offset from the start
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int seekFile(FILE *fp, uint64_t offset);
+
+/*
+    Flushes a file that is not held open to disk and reports its size
+
+    Parameters:
+        path: file path, a missing file has size 0
+        size: output file size in bytes
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int syncPath(const std::string &path, uint64_t &size);
+
+/*
+    Cuts a partial output file back to the length recorded at a checkpoint.
+    The file must be at least that long and the kept part must end on a row.
+
+    Parameters:
+        path: file path
+        size: length to keep
+
+    Returns:
+        0 on success
+        -1 if the file does not match the checkpoint
+*/
+int truncateToCheckpoint(const std::string &path, uint64_t size);
+
+#endif
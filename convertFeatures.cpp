@@ -0,0 +1,188 @@
+/*
+	Name: Aafi Mansuri & Terry Zhen
+
+	Purpose: Converts a feature file between the CSV format and the binary
+    feature store format (.fst). The direction is picked from the input: a
+    binary store is written out as a CSV, anything else is read as a CSV and
+    written as a binary store. The manifest, if any, is copied along.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "featureCsv.h"
+#include "featureDatabase.h"
+#include "featureStore.h"
+#include "manifest.h"
+
+/*
+    Copy the manifest of a feature file to the manifest of its converted file
+
+    Parameters:
+        input: feature file being converted
+        output: converted feature file
+        decodeScale: output decode scale of the manifest, 1 if there is none
+
+    Returns:
+        0 on success or if there is no manifest
+        -1 on error
+*/
+int copyManifest(const std::string &input, const std::string &output, int &decodeScale) {
+    std::vector<ManifestEntry> entries;
+    decodeScale = 1;
+    if (readManifestEntries(manifestPath(input), entries, &decodeScale) != 0) {
+        return 0;
+    }
+
+    return writeManifest(manifestPath(output), entries, decodeScale);
+}
+
+/*
+    Write a feature CSV as a binary feature store
+
+    Parameters:
+        input: feature CSV
+        output: binary store path
+        method: feature method recorded in the store header
+        decodeScale: decode scale recorded in the store header
+        dtype: element type of the store
+        sparse: write sparse row records
+        layout: feature layout recorded in the store, empty for the layout of the method
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int csvToBinary(const std::string &input, const std::string &output, const std::string &method, int decodeScale,
+                int dtype, bool sparse, const FeatureLayout &layout) {
+    FeatureDatabase database;
+    if (readFeatureCsv(input, database) != 0) {
+        return -1;
+    }
+
+    FeatureStoreWriter writer;
+    int status = writer.open(output, method, decodeScale, dtype, sparse);
+    if (status == 0 && !layout.empty()) {
+        status = writer.setLayout(layout);
+    }
+    for (ImageId id = 0; id < database.size() && status == 0; id++) {
+        status = writer.addRow(database.name(id), database.row(id), database.dim());
+    }
+    if (writer.close() != 0) {
+        status = -1;
+    }
+
+    if (status == 0) {
+        printf("Wrote %zu rows of %d features to %s\n", database.size(), database.dim(), output.c_str());
+    }
+
+    return status;
+}
+
+/*
+    Write a binary feature store as a feature CSV
+
+    Parameters:
+        input: binary store path
+        output: feature CSV
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int binaryToCsv(const std::string &input, const std::string &output) {
+    FeatureStore store;
+    if (store.open(input) != 0) {
+        return -1;
+    }
+
+    FeatureCsvWriter writer;
+    if (writer.open(output, false) != 0) {
+        return -1;
+    }
+
+    // Quantized stores are written as fractions of the quantization total
+    std::vector<float> row(store.dim());
+    for (size_t i = 0; i < store.rows(); i++) {
+        store.copyRow(i, row.data());
+        if (writer.addRow(store.name(i), row.data(), row.size()) != 0) {
+            return -1;
+        }
+    }
+
+    if (writer.close() != 0) {
+        return -1;
+    }
+
+    printf("Wrote %zu rows of %d features to %s\n", store.rows(), store.dim(), output.c_str());
+    return 0;
+}
+
+// Convert feature files between CSV and binary
+int main(int argc, char* argv[]) {
+    // Argument checks
+    if (argc < 3) {
+        printf("Usage: %s <input_file> <output_file> [--method name] [--quantize u8|u16] [--sparse]\n", argv[0]);
+        printf("       [--layout offset:length:metric:weight,...]\n");
+        printf("A CSV input is written as a binary feature store, a binary store as a CSV.\n");
+        printf("--method records the feature method in the header of a new binary store.\n");
+        printf("--quantize stores histogram bins as 8 or 16-bit integers (histogram methods only).\n");
+        printf("--sparse stores only the nonzero histogram bins of rows that are mostly empty.\n");
+        printf("--layout sets how rows are compared, metrics are intersection, l2 and cosine.\n");
+        return -1;
+    }
+
+    std::string input = argv[1];
+    std::string output = argv[2];
+
+    // Parse options
+    std::string method;
+    int dtype = FEATURE_STORE_FLOAT32;
+    bool sparse = false;
+    FeatureLayout layout;
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--method" && i + 1 < argc) {
+            method = argv[++i];
+        }
+        else if (option == "--quantize" && i + 1 < argc) {
+            if (parseQuantization(argv[++i], dtype) != 0) {
+                return -1;
+            }
+        }
+        else if (option == "--sparse") {
+            sparse = true;
+        }
+        else if (option == "--layout" && i + 1 < argc) {
+            if (parseLayout(argv[++i], layout) != 0) {
+                return -1;
+            }
+        }
+        else {
+            printf("Error, unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (input == output) {
+        printf("Error, input and output must be different files!\n");
+        return -1;
+    }
+
+    int decodeScale = 1;
+    if (copyManifest(input, output, decodeScale) != 0) {
+        return -1;
+    }
+
+    if (isFeatureStoreFile(input)) {
+        return binaryToCsv(input, output);
+    }
+
+    if (method.size() >= sizeof(FeatureStoreHeader::method)) {
+        printf("Error, method name %s is too long!\n", method.c_str());
+        return -1;
+    }
+
+    return csvToBinary(input, output, method, decodeScale, dtype, sparse, layout);
+}
@@ -15,89 +15,8 @@ The function returns a std::vector of char* for the filenames and a 2D std::vect
 #include <cstring>
 #include <vector>
 #include "opencv2/opencv.hpp"
-
-/*
-  reads a string from a CSV file. the 0-terminated string is returned in the char array os.
-
-  The function returns false if it is successfully read. It returns true if it reaches the end of the line or the file.
- */
-int getstring( FILE *fp, char os[] ) {
-  int p = 0;
-  int eol = 0;
-  
-  for(;;) {
-    char ch = fgetc( fp );
-    if( ch == ',' ) {
-      break;
-    }
-    else if( ch == '\n' || ch == EOF ) {
-      eol = 1;
-      break;
-    }
-    // printf("%c", ch ); // uncomment for debugging
-    os[p] = ch;
-    p++;
-  }
-  // printf("\n"); // uncomment for debugging
-  os[p] = '\0';
-
-  return(eol); // return true if eol
-}
-
-int getint(FILE *fp, int *v) {
-  char s[256];
-  int p = 0;
-  int eol = 0;
-
-  for(;;) {
-    char ch = fgetc( fp );
-    if( ch == ',') {
-      break;
-    }
-    else if(ch == '\n' || ch == EOF) {
-      eol = 1;
-      break;
-    }
-      
-    s[p] = ch;
-    p++;
-  }
-  s[p] = '\0'; // terminator
-  *v = atoi(s);
-
-  return(eol); // return true if eol
-}
-
-/*
-  Utility function for reading one float value from a CSV file
-
-  The value is stored in the v parameter
-
-  The function returns true if it reaches the end of a line or the file
- */
-int getfloat(FILE *fp, float *v) {
-  char s[256];
-  int p = 0;
-  int eol = 0;
-
-  for(;;) {
-    char ch = fgetc( fp );
-    if( ch == ',') {
-      break;
-    }
-    else if(ch == '\n' || ch == EOF) {
-      eol = 1;
-      break;
-    }
-      
-    s[p] = ch;
-    p++;
-  }
-  s[p] = '\0'; // terminator
-  *v = atof(s);
-
-  return(eol); // return true if eol
-}
+#include "featureCsv.h"
+#include "featureDatabase.h"
 
 /*
   Given a filename, and image filename, and the image features, by
@@ -112,36 +31,15 @@ int getfloat(FILE *fp, float *v) {
   The function returns a non-zero value in case of an error.
  */
 int append_image_data_csv( char *filename, char *image_filename, std::vector<float> &image_data, int reset_file ) {
-  char buffer[256];
-  char mode[8];
-  FILE *fp;
-
-  strcpy(mode, "a");
-
-  if( reset_file ) {
-    strcpy( mode, "w" );
-  }
-  
-  fp = fopen( filename, mode );
-  if(!fp) {
-    printf("Unable to open output file %s\n", filename );
+  // one row through the buffered writer, see featureCsv.h
+  FeatureCsvWriter writer;
+  if( writer.open( filename, !reset_file ) != 0 ) {
     exit(-1);
   }
 
-  // write the filename and the feature vector to the CSV file
-  strcpy(buffer, image_filename);
-  std::fwrite(buffer, sizeof(char), strlen(buffer), fp );
-  for(int i=0;i<image_data.size();i++) {
-    char tmp[256];
-    sprintf(tmp, ",%.4f", image_data[i] );
-    std::fwrite(tmp, sizeof(char), strlen(tmp), fp );
-  }
-      
-  std::fwrite("\n", sizeof(char), 1, fp); // EOL
+  writer.addRow( image_filename, image_data.data(), image_data.size() );
 
-  fclose(fp);
-  
-  return(0);
+  return( writer.close() );
 }
 
 /*
@@ -159,43 +57,22 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
   The function returns a non-zero value if something goes wrong.
  */
 int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file ) {
-  FILE *fp;
-  float fval;
-  char img_file[256];
+  printf("Reading %s\n", filename);
 
-  fp = fopen(filename, "r");
-  if( !fp ) {
-    printf("Unable to open feature file\n");
+  // parsed in parallel from a memory mapping into a FeatureDatabase, see featureCsv.h
+  FeatureDatabase database;
+  if( readFeatureCsv( filename, database ) != 0 ) {
     return(-1);
   }
 
-  printf("Reading %s\n", filename);
-  for(;;) {
-    std::vector<float> dvec;
-    
-    
-    // read the filename
-    if( getstring( fp, img_file ) ) {
-      break;
-    }
-    // printf("Evaluting %s\n", filename);
-
-    // read the whole feature file into memory
-    for(;;) {
-      // get next feature
-      float eol = getfloat( fp, &fval );
-      dvec.push_back( fval );
-      if( eol ) break;
-    }
-    // printf("read %lu features\n", dvec.size() );
-
-    data.push_back(dvec);
-
-    char *fname = new char[strlen(img_file)+1];
-    strcpy(fname, img_file);
+  for(ImageId id=0;id<database.size();id++) {
+    const char *name = database.name(id);
+    char *fname = new char[strlen(name)+1];
+    strcpy(fname, name);
     filenames.push_back( fname );
+
+    data.emplace_back( database.row(id), database.row(id) + database.dim() );
   }
-  fclose(fp);
   printf("Finished reading CSV file\n");
 
   if(echo_file) {
@@ -22,6 +22,9 @@
   floats.
 
   The function returns a non-zero value in case of an error.
+
+  Every call opens and closes the file; to write many rows keep a
+  FeatureCsvWriter (featureCsv.h) open instead.
  */
 int append_image_data_csv( char *filename, char *image_filename, std::vector<float> &image_data, int reset_file = 0 );
 
@@ -38,6 +41,13 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
   If echo_file is true, it prints out the contents of the file as read
   into memory.
 
+  Blank lines are skipped. Rows that do not parse, or that have a
+  different number of values than the first row, are reported and
+  skipped.
+
+  Every row is copied into its own vector; new code should load a
+  FeatureDatabase (featureDatabase.h), which keeps all rows in one block.
+
   The function returns a non-zero value if something goes wrong.
  */
 int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file = 0 );
@@ -3,8 +3,13 @@
 */
 
 #include "distanceFunctions.h"
+#include "distanceKernels.h"
 #include <cstdio>   
 #include <cmath>
+#include <algorithm>
+
+// Rows of a tile of the batch layout distances
+#define DISTANCE_TILE_ROWS 64
 
 /*
     Computes euclidean distance between two features
@@ -12,23 +17,22 @@
     Parameters:
         a: feature vector 1
         b: feature vector 2
+        size: number of features
 
     Returns:
         euclidean distance between two features
 */
+float euclideanDistance(const float *a, const float *b, int size) {
+    return std::sqrt(distanceKernels().squaredDistance(a, b, size));
+}
+
 float euclideanDistance(const std::vector<float> &a, const std::vector<float> &b) {
     if (a.size() != b.size()) {
         printf("Vector sizes do not match!");
         return -1;
     }
 
-    float sum = 0.0f;
-    for (size_t i = 0; i < a.size(); i++) {
-        float diff = a[i] - b[i];
-        sum += diff * diff;
-    }
-
-    return std::sqrt(sum);
+    return euclideanDistance(a.data(), b.data(), static_cast<int>(a.size()));
 }
 
 /*
@@ -42,41 +46,104 @@ float euclideanDistance(const std::vector<float> &a, const std::vector<float> &b
     Parameters:
         a: histogram 1 (normalized)
         b: histogram 2 (normalized)
+        size: number of bins
 
     Returns:
         histogram intersection distance (1 - intersection)
-        -1 on error
 */
+float histogramIntersection(const float *a, const float *b, int size) {
+    // Compute intersection: sum of minimum values at each bin
+    float intersection = distanceKernels().minSum(a, b, size);
+
+    // Since intersection is in [0,1] where 1 equals identical image, return 1 - intersection so 0 = identical image now
+    return 1 - intersection;
+}
+
 float histogramIntersection(const std::vector<float> &a, const std::vector<float> &b){
     if (a.size() != b.size()) {
         printf("Histogram sizes do not match!\n");
         return -1;
     }
 
-    // Compute intersection: sum of minimum values at each bin
-    float intersection = 0.0f;
-    for (size_t i = 0; i < a.size(); i++) {
-        intersection += std::min(a[i], b[i]);
+    return histogramIntersection(a.data(), b.data(), static_cast<int>(a.size()));
+}
+
+/*
+    Weighted sum of the segment distances of two feature arrays, added in
+    segment order
+
+    Parameters:
+        a: features 1
+        b: features 2
+        segments: segments to compare
+        count: number of segments
+
+    Returns:
+        combined distance
+*/
+static float fusedDistance(const float *a, const float *b, const FeatureSegment *segments, size_t count) {
+    const DistanceKernels &kernels = distanceKernels();
+    float total = 0;
+    for (size_t s = 0; s < count; s++) {
+        const FeatureSegment &segment = segments[s];
+        const float *x = a + segment.offset;
+        const float *y = b + segment.offset;
+        float dist;
+        if (segment.metric == SEGMENT_INTERSECTION) {
+            dist = 1.0f - kernels.minSum(x, y, segment.length);
+        }
+        else if (segment.metric == SEGMENT_L2) {
+            dist = std::sqrt(kernels.squaredDistance(x, y, segment.length));
+        }
+        else {
+            dist = cosineDistance(x, y, static_cast<int>(segment.length));
+        }
+
+        dist = segment.weight * dist;
+        total = s == 0 ? dist : total + dist;
     }
+    return total;
+}
 
-    // Since intersection is in [0,1] where 1 equals identical image, return 1 - intersection so 0 = identical image now
-    return 1 - intersection;
+/*
+    Distance of two feature arrays under a layout
+
+    Parameters:
+        a: features 1
+        b: features 2
+        layout: segments to compare, each inside the features
+
+    Returns:
+        weighted sum of the segment distances
+*/
+float layoutDistance(const float *a, const float *b, const FeatureLayout &layout) {
+    return fusedDistance(a, b, layout.data(), layout.size());
 }
 
 /*
     Computes distance for multi-histogram features.
-    Splits the feature vector into two histograms, compares each,
+    Compares the two halves of the feature vectors in place,
     then combines using weighted average.
     
     Parameters:
         a: multi-histogram feature vector 1 (size = 2 * histSize * histSize)
         b: multi-histogram feature vector 2 (size = 2 * histSize * histSize)
+        size: number of features
         wholeWeight: weight for whole image histogram (default 0.5), centerWeight = 1.0 - weightWhole
     
     Returns:
         combined distance
-        -1 on error
 */
+float multiHistogramDistance(const float *a, const float *b, int size, float wholeWeight) {
+    uint32_t halfSize = static_cast<uint32_t>(size / 2);
+
+    // Whole and center histograms, weighted
+    FeatureSegment segments[] = {{0, halfSize, SEGMENT_INTERSECTION, wholeWeight},
+                                 {halfSize, static_cast<uint32_t>(size) - halfSize, SEGMENT_INTERSECTION,
+                                  1.0f - wholeWeight}};
+    return fusedDistance(a, b, segments, 2);
+}
+
 float multiHistogramDistance(const std::vector<float> &a, const std::vector<float> &b, float wholeWeight) {
     // Validate histograms
     if (a.size() != b.size()) {
@@ -84,36 +151,46 @@ float multiHistogramDistance(const std::vector<float> &a, const std::vector<floa
         return -1;
     }
 
-    int halfSize = a.size() / 2;
-
-    // Split into whole and center histograms
-    std::vector<float> aWhole(a.begin(), a.begin() + halfSize);
-    std::vector<float> aCenter(a.begin() + halfSize, a.end());
+    return multiHistogramDistance(a.data(), b.data(), static_cast<int>(a.size()), wholeWeight);
+}
 
-    std::vector<float> bWhole(b.begin(), b.begin() + halfSize);
-    std::vector<float> bCenter(b.begin() + halfSize, b.end());
+/*
+    Color and texture segments of texture features
 
-    // Compute distances for each histogram
-    float wholeDist = histogramIntersection(aWhole, bWhole);
-    float centerDist = histogramIntersection(aCenter, bCenter);
+    Parameters:
+        size: number of features
+        colorWeight: weight for color distance, textureWeight = 1.0 - colorWeight
+        histSize: number of bins per histogram dimension
+        segments: output color and texture segments
 
-    // Incorprate weight
-    float centerWeight = 1.0f - wholeWeight;
-    float combinedDist = wholeWeight * wholeDist + centerWeight * centerDist;
+    Returns:
+        0 on success
+        -1 if the features are shorter than the color histogram
+*/
+static int textureColorSegments(int size, float colorWeight, int histSize, FeatureSegment *segments) {
+    int colorSize = histSize * histSize;
+    if (size < colorSize) {
+        printf("Feature vector size mismatch!\n");
+        return -1;
+    }
 
-    return combinedDist;
+    segments[0] = {0, static_cast<uint32_t>(colorSize), SEGMENT_INTERSECTION, colorWeight};
+    segments[1] = {static_cast<uint32_t>(colorSize), static_cast<uint32_t>(size - colorSize), SEGMENT_INTERSECTION,
+                   1.0f - colorWeight};
+    return 0;
 }
 
 /*
     Computes weighted distance combining color and texture histograms.
     
-    Separates the combined feature vector into color and texture portions,
-    computes histogram intersection for each, converts to distance,
-    and returns a weighted combination.
+    Compares the color and texture portions of the feature vectors in place
+    with histogram intersection, converts to distance, and returns a
+    weighted combination.
 
     Parameters:
         a: combined feature vector 1 [color (histSize*histSize) + texture (histSize)]
         b: combined feature vector 2 [color (histSize*histSize) + texture (histSize)]
+        size: number of features
         colorWeight: weight for color distance (default 0.5, range 0-1)
         histSize: number of bins per histogram dimension (default 16)
 
@@ -121,34 +198,53 @@ float multiHistogramDistance(const std::vector<float> &a, const std::vector<floa
         weighted distance where 0 = identical, 1 = completely different
         -1 on error
 */
+float textureColorDistance(const float *a, const float *b, int size, float colorWeight, int histSize) {
+    FeatureSegment segments[2];
+    if (textureColorSegments(size, colorWeight, histSize, segments) != 0) {
+        return -1;
+    }
+
+    return fusedDistance(a, b, segments, 2);
+}
+
 float textureColorDistance(const std::vector<float> &a, const std::vector<float> &b, 
                            float colorWeight, int histSize) {
-    int colorSize = histSize * histSize;
-    
     if (a.size() != b.size()) {
         printf("Feature vector size mismatch!\n");
         return -1;
     }
 
-    // Color histogram intersection (first 256 values)
-    float colorIntersection = 0.0f;
-    for (int i = 0; i < colorSize; i++) {
-        colorIntersection += std::min(a[i], b[i]);
-    }
+    return textureColorDistance(a.data(), b.data(), static_cast<int>(a.size()), colorWeight, histSize);
+}
 
-    // Texture histogram intersection (last 16 values)
-    float textureIntersection = 0.0f;
-    for (size_t i = colorSize; i < a.size(); i++) {
-        textureIntersection += std::min(a[i], b[i]);
-    }
+/*
+    Whole, face and background segments of face-detect features
+
+    Parameters:
+        size: number of features
+        wholeWeight: weight for whole histogram
+        faceWeight: weight for face histogram
+        backgroundWeight: weight for background histogram
+        histSize: each histogram size
+        segments: output whole, face and background segments
 
-    // Convert to distances (each intersection is 0-1 range)
-    float colorDist = 1.0f - colorIntersection;
-    float textureDist = 1.0f - textureIntersection;
+    Returns:
+        0 on success
+        -1 if the features are too short
+*/
+static int faceDetectSegments(int size, float wholeWeight, float faceWeight, float backgroundWeight, int histSize,
+                              FeatureSegment *segments) {
+    int oneHistogramSize = histSize * histSize;
+    if (size < 2 * oneHistogramSize) {
+        printf("Feature vector is too short for face-detect features!\n");
+        return -1;
+    }
 
-    // Weighted combination
-    float textureWeight = 1.0f - colorWeight;
-    return colorWeight * colorDist + textureWeight * textureDist;
+    uint32_t length = static_cast<uint32_t>(oneHistogramSize);
+    segments[0] = {0, length, SEGMENT_INTERSECTION, wholeWeight};
+    segments[1] = {length, length, SEGMENT_INTERSECTION, faceWeight};
+    segments[2] = {2 * length, static_cast<uint32_t>(size) - 2 * length, SEGMENT_INTERSECTION, backgroundWeight};
+    return 0;
 }
 
 /*
@@ -158,6 +254,7 @@ float textureColorDistance(const std::vector<float> &a, const std::vector<float>
     Parameters:
         a: face-aware feature vector 1 (size = 3 * histSize * histSize)
         b: face-aware feature vector 2 (size = 3 * histSize * histSize)
+        size: number of features
         wholeWeight: weight for whole histogram (default 0.2)
         faceWeight: weight for face histogram (default 0.6)
         backgroundWeight: weight for background histogram (default 0.2)
@@ -167,6 +264,17 @@ float textureColorDistance(const std::vector<float> &a, const std::vector<float>
         combined distance
         -1 on error
 */
+float faceDetectDistance(const float *a, const float *b, int size,
+                         float wholeWeight, float faceWeight, float backgroundWeight, int histSize) {
+    // Weighted distance of all three histograms, compared in place
+    FeatureSegment segments[3];
+    if (faceDetectSegments(size, wholeWeight, faceWeight, backgroundWeight, histSize, segments) != 0) {
+        return -1;
+    }
+
+    return fusedDistance(a, b, segments, 3);
+}
+
 float faceDetectDistance(const std::vector<float> &a, const std::vector<float> &b,
                         float wholeWeight, float faceWeight, float backgroundWeight, int histSize) {
     // Check vector sizes
@@ -175,26 +283,8 @@ float faceDetectDistance(const std::vector<float> &a, const std::vector<float> &
         return -1;
     }
 
-    int oneHistogramSize = histSize * histSize;
-
-    // Separate the three histograms
-    std::vector<float> aWhole(a.begin(), a.begin() + oneHistogramSize);
-    std::vector<float> aFace(a.begin() + oneHistogramSize, a.begin() + 2 * oneHistogramSize);
-    std::vector<float> aBackground(a.begin() + 2 * oneHistogramSize, a.end());
-
-    std::vector<float> bWhole(b.begin(), b.begin() + oneHistogramSize);
-    std::vector<float> bFace(b.begin() + oneHistogramSize, b.begin() + 2 * oneHistogramSize);
-    std::vector<float> bBackground(b.begin() + 2 * oneHistogramSize, b.end());
-
-    // Compute distance for each histogram
-    float wholeDist = histogramIntersection(aWhole, bWhole);
-    float faceDist = histogramIntersection(aFace, bFace);
-    float backgroundDist = histogramIntersection(aBackground, bBackground);
-
-    // Weighted distance of all three
-    float combinedDist = wholeWeight * wholeDist + faceWeight * faceDist + backgroundWeight * backgroundDist;
-
-    return combinedDist;
+    return faceDetectDistance(a.data(), b.data(), static_cast<int>(a.size()), wholeWeight, faceWeight,
+                              backgroundWeight, histSize);
 }
 
 /*
@@ -206,31 +296,476 @@ float faceDetectDistance(const std::vector<float> &a, const std::vector<float> &
     Parameters:
         a: feature vector 1
         b: feature vector 2
+        size: number of features
     
     Returns:
         cosine distance (0 = identical, 2 = opposite)
 */
+float cosineDistance(const float *a, const float *b, int size) {
+    float dotProduct, normA, normB;
+    distanceKernels().dotNorms(a, b, size, dotProduct, normA, normB);
+
+    normA = std::sqrt(normA);
+    normB = std::sqrt(normB);
+
+    if (normA == 0 || normB == 0) return 1.0f;
+
+    float similarity = dotProduct / (normA * normB);
+    return 1.0f - similarity;
+}
+
 float cosineDistance(const std::vector<float> &a, const std::vector<float> &b) {
     if (a.size() != b.size()) {
         printf("Vector sizes do not match!\n");
         return -1;
     }
 
-    float dotProduct = 0.0f;
-    float normA = 0.0f;
-    float normB = 0.0f;
+    return cosineDistance(a.data(), b.data(), static_cast<int>(a.size()));
+}
 
-    for (size_t i = 0; i < a.size(); i++) {
-        dotProduct += a[i] * b[i];
-        normA += a[i] * a[i];
-        normB += b[i] * b[i];
+/*
+    L2 norm of a query over each cosine segment of a layout, which does not
+    change from tile to tile
+
+    Parameters:
+        query: query features
+        segments: segments to compare
+        count: number of segments
+        queryNorms: output, LAYOUT_MAX_SEGMENTS norms, 0 for the other segments
+*/
+static void segmentNorms(const float *query, const FeatureSegment *segments, size_t count, float *queryNorms) {
+    for (size_t s = 0; s < count; s++) {
+        queryNorms[s] = segments[s].metric == SEGMENT_COSINE
+                            ? l2Norm(query + segments[s].offset, static_cast<int>(segments[s].length))
+                            : 0.0f;
     }
+}
 
-    normA = std::sqrt(normA);
-    normB = std::sqrt(normB);
+/*
+    Weighted sum of the segment distances over a batch of rows. Rows are
+    handled a tile at a time and every segment of the tile is compared before
+    moving on, so each row is brought into cache once for all its segments.
+    The distances equal those of fusedDistance.
 
-    if (normA == 0 || normB == 0) return 1.0f;
+    Parameters:
+        query: query features
+        matrix: first row
+        rows: number of rows
+        stride: distance between rows in floats
+        size: number of features
+        segments: segments to compare
+        count: number of segments
+        norms: L2 norm of each row, used by cosine segments over all size features, may be nullptr
+        queryNorms: L2 norm of the query over each cosine segment, from segmentNorms, may be
+                    nullptr without cosine segments
+        out: output distance of each row
+*/
+static void fusedDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size,
+                           const FeatureSegment *segments, size_t count, const float *norms,
+                           const float *queryNorms, float *out) {
+    const DistanceKernels &kernels = distanceKernels();
+    float sums[DISTANCE_TILE_ROWS];
+
+    for (size_t first = 0; first < rows; first += DISTANCE_TILE_ROWS) {
+        size_t tileRows = std::min<size_t>(DISTANCE_TILE_ROWS, rows - first);
+        const float *tile = matrix + first * stride;
+        for (size_t s = 0; s < count; s++) {
+            const FeatureSegment &segment = segments[s];
+            const float *a = query + segment.offset;
+            const float *b = tile + segment.offset;
+            if (segment.metric == SEGMENT_INTERSECTION) {
+                kernels.minSums(a, b, tileRows, stride, segment.length, sums);
+                for (size_t r = 0; r < tileRows; r++) {
+                    sums[r] = 1.0f - sums[r];
+                }
+            }
+            else if (segment.metric == SEGMENT_L2) {
+                kernels.squaredDistances(a, b, tileRows, stride, segment.length, sums);
+                for (size_t r = 0; r < tileRows; r++) {
+                    sums[r] = std::sqrt(sums[r]);
+                }
+            }
+            else {
+                // Same steps as cosineDistance, with the stored norms when they cover the segment
+                bool stored = norms && segment.offset == 0 && segment.length == static_cast<uint32_t>(size);
+                float queryNorm = queryNorms[s];
+                kernels.dots(a, b, tileRows, stride, segment.length, sums);
+                for (size_t r = 0; r < tileRows; r++) {
+                    float rowNorm = stored ? norms[first + r]
+                                           : l2Norm(b + r * stride, static_cast<int>(segment.length));
+                    sums[r] = queryNorm == 0 || rowNorm == 0 ? 1.0f : 1.0f - sums[r] / (queryNorm * rowNorm);
+                }
+            }
+
+            for (size_t r = 0; r < tileRows; r++) {
+                float dist = segment.weight * sums[r];
+                out[first + r] = s == 0 ? dist : out[first + r] + dist;
+            }
+        }
+    }
+}
 
-    float similarity = dotProduct / (normA * normB);
-    return 1.0f - similarity;
-}
\ No newline at end of file
+int layoutDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size,
+                    const FeatureLayout &layout, float *out, const float *norms) {
+    if (checkLayout(layout, size) != 0) {
+        printf("Error, the feature layout does not fit %d features!\n", size);
+        return -1;
+    }
+
+    float queryNorms[LAYOUT_MAX_SEGMENTS];
+    segmentNorms(query, layout.data(), layout.size(), queryNorms);
+    fusedDistances(query, matrix, rows, stride, size, layout.data(), layout.size(), norms, queryNorms, out);
+    return 0;
+}
+
+int layoutDistanceBlock(const float *queries, size_t queryCount, size_t queryStride, const float *matrix,
+                        size_t rows, size_t stride, int size, const FeatureLayout &layout, float *out,
+                        const float *norms) {
+    if (checkLayout(layout, size) != 0) {
+        printf("Error, the feature layout does not fit %d features!\n", size);
+        return -1;
+    }
+
+    std::vector<float> queryNorms(queryCount * LAYOUT_MAX_SEGMENTS);
+    for (size_t q = 0; q < queryCount; q++) {
+        segmentNorms(queries + q * queryStride, layout.data(), layout.size(), &queryNorms[q * LAYOUT_MAX_SEGMENTS]);
+    }
+
+    // Every query is compared with a tile before the next tile is read
+    for (size_t first = 0; first < rows; first += DISTANCE_TILE_ROWS) {
+        size_t tileRows = std::min<size_t>(DISTANCE_TILE_ROWS, rows - first);
+        for (size_t q = 0; q < queryCount; q++) {
+            fusedDistances(queries + q * queryStride, matrix + first * stride, tileRows, stride, size,
+                           layout.data(), layout.size(), norms ? norms + first : nullptr,
+                           &queryNorms[q * LAYOUT_MAX_SEGMENTS], out + q * rows + first);
+        }
+    }
+    return 0;
+}
+
+int dotProductBlock(const float *queries, size_t queryCount, size_t queryStride, const float *matrix, size_t rows,
+                    size_t stride, int size, float *out) {
+    const DistanceKernels &kernels = distanceKernels();
+    for (size_t first = 0; first < rows; first += DISTANCE_TILE_ROWS) {
+        size_t tileRows = std::min<size_t>(DISTANCE_TILE_ROWS, rows - first);
+        for (size_t q = 0; q < queryCount; q++) {
+            kernels.dots(queries + q * queryStride, matrix + first * stride, tileRows, stride, size,
+                         out + q * rows + first);
+        }
+    }
+    return 0;
+}
+
+int euclideanDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size, float *out) {
+    distanceKernels().squaredDistances(query, matrix, rows, stride, size, out);
+    for (size_t r = 0; r < rows; r++) {
+        out[r] = std::sqrt(out[r]);
+    }
+    return 0;
+}
+
+int histogramIntersections(const float *query, const float *matrix, size_t rows, size_t stride, int size,
+                           float *out) {
+    distanceKernels().minSums(query, matrix, rows, stride, size, out);
+    for (size_t r = 0; r < rows; r++) {
+        out[r] = 1 - out[r];
+    }
+    return 0;
+}
+
+int multiHistogramDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size,
+                            float *out, float wholeWeight) {
+    uint32_t halfSize = static_cast<uint32_t>(size / 2);
+    FeatureSegment segments[] = {{0, halfSize, SEGMENT_INTERSECTION, wholeWeight},
+                                 {halfSize, static_cast<uint32_t>(size) - halfSize, SEGMENT_INTERSECTION,
+                                  1.0f - wholeWeight}};
+    fusedDistances(query, matrix, rows, stride, size, segments, 2, nullptr, nullptr, out);
+    return 0;
+}
+
+int textureColorDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size,
+                          float *out, float colorWeight, int histSize) {
+    FeatureSegment segments[2];
+    if (textureColorSegments(size, colorWeight, histSize, segments) != 0) {
+        return -1;
+    }
+
+    fusedDistances(query, matrix, rows, stride, size, segments, 2, nullptr, nullptr, out);
+    return 0;
+}
+
+int faceDetectDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size, float *out,
+                        float wholeWeight, float faceWeight, float backgroundWeight, int histSize) {
+    FeatureSegment segments[3];
+    if (faceDetectSegments(size, wholeWeight, faceWeight, backgroundWeight, histSize, segments) != 0) {
+        return -1;
+    }
+
+    fusedDistances(query, matrix, rows, stride, size, segments, 3, nullptr, nullptr, out);
+    return 0;
+}
+
+int cosineDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size, float *out) {
+    for (size_t r = 0; r < rows; r++) {
+        out[r] = cosineDistance(query, matrix + r * stride, size);
+    }
+    return 0;
+}
+
+int cosineDistances(const float *query, const float *matrix, const float *norms, size_t rows, size_t stride,
+                    int size, float *out) {
+    float queryNorm = l2Norm(query, size);
+    distanceKernels().dots(query, matrix, rows, stride, size, out);
+
+    // Same steps as cosineDistance
+    for (size_t r = 0; r < rows; r++) {
+        out[r] = queryNorm == 0 || norms[r] == 0 ? 1.0f : 1.0f - out[r] / (queryNorm * norms[r]);
+    }
+    return 0;
+}
+
+float l2Norm(const float *a, int size) {
+    return std::sqrt(distanceKernels().dot(a, a, size));
+}
+
+/*
+    Sum of the bin minimums of two quantized histograms. Bins are at most
+    65535 so a uint32_t sum cannot overflow below 65536 bins.
+
+    Parameters:
+        a: quantized histogram 1
+        b: quantized histogram 2
+        size: number of bins
+
+    Returns:
+        integer intersection
+*/
+template <typename T>
+static uint32_t minSum(const T *a, const T *b, int size) {
+    uint32_t sum = 0;
+    for (int i = 0; i < size; i++) {
+        sum += std::min(a[i], b[i]);
+    }
+    return sum;
+}
+
+/*
+    Intersection distance of one quantized histogram
+
+    Parameters:
+        a: quantized histogram 1
+        b: quantized histogram 2
+        size: number of bins
+        total: total each histogram was quantized to
+
+    Returns:
+        1 - intersection
+*/
+template <typename T>
+static float quantizedIntersection(const T *a, const T *b, int size, uint32_t total) {
+    return 1.0f - static_cast<float>(minSum(a, b, size)) / total;
+}
+
+float histogramIntersection(const uint8_t *a, const uint8_t *b, int size, uint32_t total) {
+    return quantizedIntersection(a, b, size, total);
+}
+
+float histogramIntersection(const uint16_t *a, const uint16_t *b, int size, uint32_t total) {
+    return quantizedIntersection(a, b, size, total);
+}
+
+/*
+    Multi-histogram distance of quantized features, whole and center halves
+*/
+template <typename T>
+static float quantizedMultiHistogram(const T *a, const T *b, int size, uint32_t total, float wholeWeight) {
+    int halfSize = size / 2;
+    float wholeDist = quantizedIntersection(a, b, halfSize, total);
+    float centerDist = quantizedIntersection(a + halfSize, b + halfSize, size - halfSize, total);
+
+    return wholeWeight * wholeDist + (1.0f - wholeWeight) * centerDist;
+}
+
+float multiHistogramDistance(const uint8_t *a, const uint8_t *b, int size, uint32_t total, float wholeWeight) {
+    return quantizedMultiHistogram(a, b, size, total, wholeWeight);
+}
+
+float multiHistogramDistance(const uint16_t *a, const uint16_t *b, int size, uint32_t total, float wholeWeight) {
+    return quantizedMultiHistogram(a, b, size, total, wholeWeight);
+}
+
+/*
+    Texture and color distance of quantized features, color bins then texture bins
+*/
+template <typename T>
+static float quantizedTextureColor(const T *a, const T *b, int size, uint32_t total, float colorWeight,
+                                   int histSize) {
+    int colorSize = std::min(histSize * histSize, size);
+    float colorDist = quantizedIntersection(a, b, colorSize, total);
+    float textureDist = quantizedIntersection(a + colorSize, b + colorSize, size - colorSize, total);
+
+    return colorWeight * colorDist + (1.0f - colorWeight) * textureDist;
+}
+
+float textureColorDistance(const uint8_t *a, const uint8_t *b, int size, uint32_t total, float colorWeight,
+                           int histSize) {
+    return quantizedTextureColor(a, b, size, total, colorWeight, histSize);
+}
+
+float textureColorDistance(const uint16_t *a, const uint16_t *b, int size, uint32_t total, float colorWeight,
+                           int histSize) {
+    return quantizedTextureColor(a, b, size, total, colorWeight, histSize);
+}
+
+/*
+    Face-detect distance of quantized features, whole, face and background thirds
+*/
+template <typename T>
+static float quantizedFaceDetect(const T *a, const T *b, int size, uint32_t total, float wholeWeight,
+                                 float faceWeight, float backgroundWeight) {
+    int third = size / 3;
+    float wholeDist = quantizedIntersection(a, b, third, total);
+    float faceDist = quantizedIntersection(a + third, b + third, third, total);
+    float backgroundDist = quantizedIntersection(a + 2 * third, b + 2 * third, size - 2 * third, total);
+
+    return wholeWeight * wholeDist + faceWeight * faceDist + backgroundWeight * backgroundDist;
+}
+
+float faceDetectDistance(const uint8_t *a, const uint8_t *b, int size, uint32_t total, float wholeWeight,
+                         float faceWeight, float backgroundWeight) {
+    return quantizedFaceDetect(a, b, size, total, wholeWeight, faceWeight, backgroundWeight);
+}
+
+float faceDetectDistance(const uint16_t *a, const uint16_t *b, int size, uint32_t total, float wholeWeight,
+                         float faceWeight, float backgroundWeight) {
+    return quantizedFaceDetect(a, b, size, total, wholeWeight, faceWeight, backgroundWeight);
+}
+
+/*
+    Accumulator of the min-sum of one histogram. Quantized bins are summed
+    exactly in an integer, float bins are spread over the lanes of the dense
+    kernels by their offset in the histogram, so a sparse row gives the same
+    sum as its dense row.
+*/
+template <typename T>
+struct MinSum {
+    uint32_t sum = 0;
+
+    void add(int, T value) { sum += value; }
+    float total() { return static_cast<float>(sum); }
+    void clear() { sum = 0; }
+};
+
+template <>
+struct MinSum<float> {
+    float lanes[KERNEL_LANES] = {0};
+
+    void add(int offset, float value) { lanes[offset % KERNEL_LANES] += value; }
+    float total() { return reduceLanes(lanes); }
+    void clear() { std::fill(lanes, lanes + KERNEL_LANES, 0.0f); }
+};
+
+/*
+    Weighted distance of two sparse rows, merging the ascending bin indices.
+    Each histogram distance is added once the merge passes the end of the
+    histogram, bins past the dimension (corrupt rows) end the merge.
+*/
+template <typename T>
+float sparseHistogramDistance(const SparseHistogram<T> &a, const SparseHistogram<T> &b,
+                              const std::vector<int> &ends, const std::vector<float> &weights, uint32_t total) {
+    float dist = 0.0f;
+    size_t segment = 0;
+    int start = 0;
+    MinSum<T> sum;
+
+    uint32_t i = 0;
+    uint32_t j = 0;
+    while (i < a.count && j < b.count) {
+        int index = a.indices[i];
+        if (index < b.indices[j]) {
+            i++;
+            continue;
+        }
+        if (index > b.indices[j]) {
+            j++;
+            continue;
+        }
+
+        while (segment < ends.size() && index >= ends[segment]) {
+            dist += weights[segment] * (1.0f - sum.total() / total);
+            sum.clear();
+            start = ends[segment];
+            segment++;
+        }
+        if (segment == ends.size()) {
+            break;
+        }
+
+        sum.add(index - start, std::min(a.values[i], b.values[j]));
+        i++;
+        j++;
+    }
+
+    // Histograms after the last common bin
+    for (; segment < ends.size(); segment++) {
+        dist += weights[segment] * (1.0f - sum.total() / total);
+        sum.clear();
+    }
+
+    return dist;
+}
+
+/*
+    Weighted distance of a sparse row and a dense row, looking up the
+    nonzero bins of the sparse row in the dense one
+*/
+template <typename T>
+float sparseHistogramDistance(const SparseHistogram<T> &a, const T *b, const std::vector<int> &ends,
+                              const std::vector<float> &weights, uint32_t total) {
+    float dist = 0.0f;
+    size_t segment = 0;
+    int start = 0;
+    MinSum<T> sum;
+
+    for (uint32_t i = 0; i < a.count; i++) {
+        int index = a.indices[i];
+        while (segment < ends.size() && index >= ends[segment]) {
+            dist += weights[segment] * (1.0f - sum.total() / total);
+            sum.clear();
+            start = ends[segment];
+            segment++;
+        }
+        if (segment == ends.size()) {
+            break;
+        }
+
+        sum.add(index - start, std::min(a.values[i], b[index]));
+    }
+
+    for (; segment < ends.size(); segment++) {
+        dist += weights[segment] * (1.0f - sum.total() / total);
+        sum.clear();
+    }
+
+    return dist;
+}
+
+/*
+    Histogram intersection distance of two sparse histograms
+*/
+template <typename T>
+float histogramIntersection(const SparseHistogram<T> &a, const SparseHistogram<T> &b, int size, uint32_t total) {
+    return sparseHistogramDistance(a, b, std::vector<int>{size}, std::vector<float>{1.0f}, total);
+}
+
+// Sparse kernels are provided for float rows and both quantized bin types
+#define SPARSE_KERNELS(T)                                                                                        \
+    template float sparseHistogramDistance(const SparseHistogram<T> &, const SparseHistogram<T> &,              \
+                                           const std::vector<int> &, const std::vector<float> &, uint32_t);      \
+    template float sparseHistogramDistance(const SparseHistogram<T> &, const T *, const std::vector<int> &,      \
+                                           const std::vector<float> &, uint32_t);                                \
+    template float histogramIntersection(const SparseHistogram<T> &, const SparseHistogram<T> &, int, uint32_t);
+
+SPARSE_KERNELS(float)
+SPARSE_KERNELS(uint8_t)
+SPARSE_KERNELS(uint16_t)
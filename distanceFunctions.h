@@ -4,7 +4,11 @@
 #ifndef DISTANCEFUNCTIONS_H
 #define DISTANCEFUNCTIONS_H
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
+#include "featureLayout.h"
+#include "sparseHistogram.h"
 
 /*
     Computes euclidean distance between two features
@@ -18,6 +22,21 @@
 */
 float euclideanDistance(const std::vector<float> &a, const std::vector<float> &b);
 
+/*
+    Euclidean distance of two feature arrays, read in place. The vector
+    distances are wrappers around these pointer and length versions, which
+    let scans compare database rows and their segments without copying them.
+
+    Parameters:
+        a: features 1
+        b: features 2
+        size: number of features
+
+    Returns:
+        euclidean distance between two features
+*/
+float euclideanDistance(const float *a, const float *b, int size);
+
 /*
     Computes histogram intersection between two histograms and normalizes
     the histograms and returns a similarity value where higher values indicate
@@ -36,6 +55,19 @@ float euclideanDistance(const std::vector<float> &a, const std::vector<float> &b
 */
 float histogramIntersection(const std::vector<float> &a, const std::vector<float> &b);
 
+/*
+    Histogram intersection distance of two float histograms, read in place
+
+    Parameters:
+        a: histogram 1 (normalized)
+        b: histogram 2 (normalized)
+        size: number of bins
+
+    Returns:
+        histogram intersection distance (1 - intersection)
+*/
+float histogramIntersection(const float *a, const float *b, int size);
+
 /*
     Computes distance for multi-histogram features.
     Splits the feature vector into two histograms, compares each,
@@ -52,6 +84,20 @@ float histogramIntersection(const std::vector<float> &a, const std::vector<float
 */
 float multiHistogramDistance(const std::vector<float> &a, const std::vector<float> &b, float wholeWeight = 0.5f);
 
+/*
+    Multi-histogram distance of two float feature arrays, the halves are compared in place
+
+    Parameters:
+        a: multi-histogram features 1
+        b: multi-histogram features 2
+        size: number of features
+        wholeWeight: weight for whole image histogram, centerWeight = 1.0 - wholeWeight
+
+    Returns:
+        combined distance
+*/
+float multiHistogramDistance(const float *a, const float *b, int size, float wholeWeight = 0.5f);
+
 /*
     Computes weighted distance combining color and texture histograms.
     
@@ -72,6 +118,22 @@ float multiHistogramDistance(const std::vector<float> &a, const std::vector<floa
 float textureColorDistance(const std::vector<float> &a, const std::vector<float> &b, 
                            float colorWeight = 0.5f, int histSize = 16);
 
+/*
+    Texture and color distance of two float feature arrays, read in place
+
+    Parameters:
+        a: combined features 1 [color (histSize*histSize) + texture (histSize)]
+        b: combined features 2
+        size: number of features
+        colorWeight: weight for color distance
+        histSize: number of bins per histogram dimension
+
+    Returns:
+        weighted distance where 0 = identical, 1 = completely different
+        -1 on error
+*/
+float textureColorDistance(const float *a, const float *b, int size, float colorWeight = 0.5f, int histSize = 16);
+
 /*
     Computes distance for face-detect features.
     Assumes both feature vectors are from images that have face(s) (768 features).
@@ -91,6 +153,40 @@ float textureColorDistance(const std::vector<float> &a, const std::vector<float>
 float faceDetectDistance(const std::vector<float> &a, const std::vector<float> &b,
                         float wholeWeight = 0.2f, float faceWeight = 0.6f,float backgroundWeight = 0.2f, int histSize = 16);
 
+/*
+    Face-detect distance of two float feature arrays, the three histograms are compared in place
+
+    Parameters:
+        a: face-aware features 1 (whole, face and background histograms)
+        b: face-aware features 2
+        size: number of features
+        wholeWeight: weight for whole histogram
+        faceWeight: weight for face histogram
+        backgroundWeight: weight for background histogram
+        histSize: each histogram size
+
+    Returns:
+        combined distance
+        -1 on error
+*/
+float faceDetectDistance(const float *a, const float *b, int size, float wholeWeight = 0.2f,
+                         float faceWeight = 0.6f, float backgroundWeight = 0.2f, int histSize = 16);
+
+/*
+    Distance of two feature arrays under a layout, the weighted sum of the
+    distances of its segments. The multi-histogram, texture and face-detect
+    distances are this distance with their fixed layouts.
+
+    Parameters:
+        a: features 1
+        b: features 2
+        layout: segments to compare, each inside the features
+
+    Returns:
+        weighted sum of the segment distances
+*/
+float layoutDistance(const float *a, const float *b, const FeatureLayout &layout);
+
 /*
     Computes cosine distance between two feature vectors.
     
@@ -105,4 +201,278 @@ float faceDetectDistance(const std::vector<float> &a, const std::vector<float> &
         cosine distance (0 = identical, 2 = opposite)
 */
 float cosineDistance(const std::vector<float> &a, const std::vector<float> &b);
-#endif
\ No newline at end of file
+
+/*
+    Cosine distance of two feature arrays, read in place
+
+    Parameters:
+        a: features 1
+        b: features 2
+        size: number of features
+
+    Returns:
+        cosine distance (0 = identical, 2 = opposite)
+*/
+float cosineDistance(const float *a, const float *b, int size);
+
+/*
+    Batch distances from one query to consecutive rows of a feature matrix,
+    the primitive of every scan over a float store. The rows are compared in
+    tiles that stay in cache while each of their histograms is intersected,
+    and give exactly the distances of the one pair functions above.
+
+    Parameters:
+        query: query features
+        matrix: first row
+        rows: number of rows
+        stride: distance between rows in floats, at least size
+        size: number of features
+        out: output distance of each row
+        (the remaining parameters are those of the one pair functions)
+
+    Returns:
+        0 on success
+        -1 if the features are too short for the method
+*/
+int euclideanDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size, float *out);
+int histogramIntersections(const float *query, const float *matrix, size_t rows, size_t stride, int size,
+                           float *out);
+int multiHistogramDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size,
+                            float *out, float wholeWeight = 0.5f);
+int textureColorDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size,
+                          float *out, float colorWeight = 0.5f, int histSize = 16);
+int faceDetectDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size, float *out,
+                        float wholeWeight = 0.2f, float faceWeight = 0.6f, float backgroundWeight = 0.2f,
+                        int histSize = 16);
+int cosineDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size, float *out);
+
+/*
+    Cosine distances from one query to consecutive rows whose L2 norms are
+    known, such as the norms kept by a binary feature store. The query norm
+    is computed once, so each row costs one dot product instead of a dot
+    product and two norms, and the distances equal those of cosineDistance.
+
+    Parameters:
+        query: query features
+        matrix: first row
+        norms: L2 norm of each row, as computed by l2Norm
+        rows: number of rows
+        stride: distance between rows in floats, at least size
+        size: number of features
+        out: output distance of each row
+
+    Returns:
+        0 on success
+*/
+int cosineDistances(const float *query, const float *matrix, const float *norms, size_t rows, size_t stride,
+                    int size, float *out);
+
+/*
+    Batch distances under a layout from one query to consecutive rows. Each
+    tile of rows is compared on every segment while it is in cache, so a
+    row is read from memory once however many segments it has, and the
+    distances equal those of layoutDistance.
+
+    Parameters:
+        query: query features
+        matrix: first row
+        rows: number of rows
+        stride: distance between rows in floats, at least size
+        size: number of features
+        layout: segments to compare
+        out: output distance of each row
+        norms: L2 norm of each row, for a cosine segment over all features, nullptr to compute them
+
+    Returns:
+        0 on success
+        -1 if the layout does not fit the features
+*/
+int layoutDistances(const float *query, const float *matrix, size_t rows, size_t stride, int size,
+                    const FeatureLayout &layout, float *out, const float *norms = nullptr);
+
+/*
+    Batch distances under a layout from several queries to consecutive rows,
+    the whole query by row block. The rows are taken a tile at a time and
+    each tile is compared with every query while it is in cache, so the
+    matrix is read from memory once for all the queries. The distances equal
+    those of layoutDistances.
+
+    Parameters:
+        queries: first query
+        queryCount: number of queries
+        queryStride: distance between queries in floats, at least size
+        matrix: first row
+        rows: number of rows
+        stride: distance between rows in floats, at least size
+        size: number of features
+        layout: segments to compare
+        out: output, distance of query q and row r at out[q * rows + r]
+        norms: L2 norm of each row, for a cosine segment over all features, nullptr to compute them
+
+    Returns:
+        0 on success
+        -1 if the layout does not fit the features
+*/
+int layoutDistanceBlock(const float *queries, size_t queryCount, size_t queryStride, const float *matrix,
+                        size_t rows, size_t stride, int size, const FeatureLayout &layout, float *out,
+                        const float *norms = nullptr);
+
+/*
+    Dot products of several queries and consecutive rows, tiled like
+    layoutDistanceBlock, the product of the query matrix with the transposed
+    row matrix. With the squared norms it gives squared euclidean distances as
+    |a|^2 + |b|^2 - 2ab, one multiply and add per feature instead of a
+    subtract, multiply and add, at the cost of rounding errors that grow with
+    the norms. Each product equals the dot of the kernels.
+
+    Parameters:
+        queries: first query
+        queryCount: number of queries
+        queryStride: distance between queries in floats, at least size
+        matrix: first row
+        rows: number of rows
+        stride: distance between rows in floats, at least size
+        size: number of features
+        out: output, product of query q and row r at out[q * rows + r]
+
+    Returns:
+        0 on success
+*/
+int dotProductBlock(const float *queries, size_t queryCount, size_t queryStride, const float *matrix, size_t rows,
+                    size_t stride, int size, float *out);
+
+/*
+    L2 norm of a feature vector, summed in the order of the cosine distance
+
+    Parameters:
+        a: features
+        size: number of features
+
+    Returns:
+        sqrt of the sum of a[i]^2
+*/
+float l2Norm(const float *a, int size);
+
+/*
+    Integer histogram intersection of quantized histograms (see quantize.h).
+    Sums the bin minimums in integers, so the scan moves 1/4 (uint8) or 1/2
+    (uint16) of the bytes of a float histogram.
+
+    Parameters:
+        a: quantized histogram 1
+        b: quantized histogram 2
+        size: number of bins
+        total: total each histogram was quantized to
+
+    Returns:
+        histogram intersection distance (1 - intersection)
+*/
+float histogramIntersection(const uint8_t *a, const uint8_t *b, int size, uint32_t total);
+float histogramIntersection(const uint16_t *a, const uint16_t *b, int size, uint32_t total);
+
+/*
+    Multi-histogram distance of quantized features
+
+    Parameters:
+        a: quantized feature vector 1 (whole and center histograms)
+        b: quantized feature vector 2
+        size: number of bins in the feature vector
+        total: total each histogram was quantized to
+        wholeWeight: weight for whole image histogram, centerWeight = 1.0 - wholeWeight
+
+    Returns:
+        combined distance
+*/
+float multiHistogramDistance(const uint8_t *a, const uint8_t *b, int size, uint32_t total, float wholeWeight = 0.5f);
+float multiHistogramDistance(const uint16_t *a, const uint16_t *b, int size, uint32_t total, float wholeWeight = 0.5f);
+
+/*
+    Texture and color distance of quantized features
+
+    Parameters:
+        a: quantized feature vector 1 [color (histSize*histSize) + texture (histSize)]
+        b: quantized feature vector 2
+        size: number of bins in the feature vector
+        total: total each histogram was quantized to
+        colorWeight: weight for color distance
+        histSize: number of bins per histogram dimension
+
+    Returns:
+        weighted distance where 0 = identical, 1 = completely different
+*/
+float textureColorDistance(const uint8_t *a, const uint8_t *b, int size, uint32_t total,
+                           float colorWeight = 0.5f, int histSize = 16);
+float textureColorDistance(const uint16_t *a, const uint16_t *b, int size, uint32_t total,
+                           float colorWeight = 0.5f, int histSize = 16);
+
+/*
+    Face-detect distance of quantized features
+
+    Parameters:
+        a: quantized feature vector 1 (whole, face and background histograms)
+        b: quantized feature vector 2
+        size: number of bins in the feature vector
+        total: total each histogram was quantized to
+        wholeWeight: weight for whole histogram
+        faceWeight: weight for face histogram
+        backgroundWeight: weight for background histogram
+
+    Returns:
+        combined distance
+*/
+float faceDetectDistance(const uint8_t *a, const uint8_t *b, int size, uint32_t total,
+                         float wholeWeight = 0.2f, float faceWeight = 0.6f, float backgroundWeight = 0.2f);
+float faceDetectDistance(const uint16_t *a, const uint16_t *b, int size, uint32_t total,
+                         float wholeWeight = 0.2f, float faceWeight = 0.6f, float backgroundWeight = 0.2f);
+
+/*
+    Weighted histogram intersection distance of two sparse rows, found by
+    merging their ascending bin indices. Zero bins add nothing to an
+    intersection, so for float rows this gives exactly the dense distance.
+
+    Parameters:
+        a: sparse feature vector 1
+        b: sparse feature vector 2
+        ends: end bin of each histogram in the feature vector, the last is the dimension
+        weights: weight of each histogram distance
+        total: total of every histogram, 1 for float rows
+
+    Returns:
+        sum of weight * (1 - intersection / total) over the histograms
+*/
+template <typename T>
+float sparseHistogramDistance(const SparseHistogram<T> &a, const SparseHistogram<T> &b,
+                              const std::vector<int> &ends, const std::vector<float> &weights, uint32_t total);
+
+/*
+    Weighted histogram intersection distance of a sparse row and a dense row
+
+    Parameters:
+        a: sparse feature vector
+        b: dense feature vector, ends.back() values
+        ends: end bin of each histogram in the feature vector, the last is the dimension
+        weights: weight of each histogram distance
+        total: total of every histogram, 1 for float rows
+
+    Returns:
+        sum of weight * (1 - intersection / total) over the histograms
+*/
+template <typename T>
+float sparseHistogramDistance(const SparseHistogram<T> &a, const T *b, const std::vector<int> &ends,
+                              const std::vector<float> &weights, uint32_t total);
+
+/*
+    Histogram intersection distance of two sparse histograms
+
+    Parameters:
+        a: sparse histogram 1
+        b: sparse histogram 2
+        size: number of bins
+        total: total of each histogram, 1 for float rows
+
+    Returns:
+        1 - intersection / total
+*/
+template <typename T>
+float histogramIntersection(const SparseHistogram<T> &a, const SparseHistogram<T> &b, int size, uint32_t total);
+#endif
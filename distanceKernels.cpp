@@ -0,0 +1,694 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Scalar, SSE, AVX2 and AVX-512 versions of the distance inner
+    loops, picked at runtime from the features of the CPU.
+*/
+
+#include "distanceKernels.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// The vector versions use per-function target attributes, so the rest of the
+// program is still built for the baseline CPU
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define KERNELS_X86 1
+#include <immintrin.h>
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/*
+    Combine the lanes of a kernel in the fixed order every version uses
+
+    Parameters:
+        lanes: KERNEL_LANES partial sums, overwritten
+
+    Returns:
+        total
+*/
+float reduceLanes(float *lanes) {
+    for (int width = KERNEL_LANES / 2; width > 0; width /= 2) {
+        for (int j = 0; j < width; j++) {
+            lanes[j] += lanes[j + width];
+        }
+    }
+    return lanes[0];
+}
+
+// Lane by lane sums, used by the scalar kernels and for the tails of the vector ones.
+// n counts from a multiple of KERNEL_LANES, so element i belongs to lane i % KERNEL_LANES.
+
+static void addSquared(const float *a, const float *b, size_t n, float *lanes) {
+    for (size_t i = 0; i < n; i++) {
+        float diff = a[i] - b[i];
+        lanes[i % KERNEL_LANES] += diff * diff;
+    }
+}
+
+static void addMin(const float *a, const float *b, size_t n, float *lanes) {
+    for (size_t i = 0; i < n; i++) {
+        lanes[i % KERNEL_LANES] += std::min(a[i], b[i]);
+    }
+}
+
+static void addDotNorms(const float *a, const float *b, size_t n, float *dot, float *normA, float *normB) {
+    for (size_t i = 0; i < n; i++) {
+        dot[i % KERNEL_LANES] += a[i] * b[i];
+        normA[i % KERNEL_LANES] += a[i] * a[i];
+        normB[i % KERNEL_LANES] += b[i] * b[i];
+    }
+}
+
+static void addDot(const float *a, const float *b, size_t n, float *lanes) {
+    for (size_t i = 0; i < n; i++) {
+        lanes[i % KERNEL_LANES] += a[i] * b[i];
+    }
+}
+
+/*
+    One pair kernel from a lane accumulating one: sum into zeroed lanes, then combine them
+
+    Parameters:
+        a: first features
+        b: second features
+        n: number of features
+
+    Returns:
+        total
+*/
+template <void (*accumulate)(const float *, const float *, size_t, float *)>
+static float reduced(const float *a, const float *b, size_t n) {
+    float lanes[KERNEL_LANES] = {0};
+    accumulate(a, b, n, lanes);
+    return reduceLanes(lanes);
+}
+
+static void scalarDotNorms(const float *a, const float *b, size_t n, float &dot, float &normA, float &normB) {
+    float dotLanes[KERNEL_LANES] = {0};
+    float normALanes[KERNEL_LANES] = {0};
+    float normBLanes[KERNEL_LANES] = {0};
+    addDotNorms(a, b, n, dotLanes, normALanes, normBLanes);
+    dot = reduceLanes(dotLanes);
+    normA = reduceLanes(normALanes);
+    normB = reduceLanes(normBLanes);
+}
+
+/*
+    Batch version of a one pair kernel, for the versions that run one row at a time
+
+    Parameters:
+        query: query features
+        rows: first row
+        count: number of rows
+        stride: distance between rows in floats
+        n: number of features
+        out: count outputs
+*/
+template <float (*kernel)(const float *, const float *, size_t)>
+static void eachRow(const float *query, const float *rows, size_t count, size_t stride, size_t n, float *out) {
+    for (size_t r = 0; r < count; r++) {
+        const float *row = rows + r * stride;
+        for (size_t i = 0; i < n; i += 16) {
+            KERNEL_PREFETCH(row + KERNEL_PREFETCH_ROWS * stride + i);
+        }
+        out[r] = kernel(query, row, n);
+    }
+}
+
+#ifdef KERNELS_X86
+
+// min(b, a) returns a when the values are equal or unordered, like std::min(a, b)
+
+// SSE: 8 registers of 4 lanes
+
+KERNEL_TARGET("sse2")
+static void sseAddSquared(const float *a, const float *b, size_t n, float *lanes) {
+    __m128 acc[8];
+    for (int k = 0; k < 8; k++) {
+        acc[k] = _mm_loadu_ps(lanes + 4 * k);
+    }
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 8; k++) {
+            __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i + 4 * k), _mm_loadu_ps(b + i + 4 * k));
+            acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(diff, diff));
+        }
+    }
+
+    for (int k = 0; k < 8; k++) {
+        _mm_storeu_ps(lanes + 4 * k, acc[k]);
+    }
+    addSquared(a + i, b + i, n - i, lanes);
+}
+
+KERNEL_TARGET("sse2")
+static void sseAddMin(const float *a, const float *b, size_t n, float *lanes) {
+    __m128 acc[8];
+    for (int k = 0; k < 8; k++) {
+        acc[k] = _mm_loadu_ps(lanes + 4 * k);
+    }
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 8; k++) {
+            acc[k] = _mm_add_ps(acc[k], _mm_min_ps(_mm_loadu_ps(b + i + 4 * k), _mm_loadu_ps(a + i + 4 * k)));
+        }
+    }
+
+    for (int k = 0; k < 8; k++) {
+        _mm_storeu_ps(lanes + 4 * k, acc[k]);
+    }
+    addMin(a + i, b + i, n - i, lanes);
+}
+
+KERNEL_TARGET("sse2")
+static void sseAddDot(const float *a, const float *b, size_t n, float *lanes) {
+    __m128 acc[8];
+    for (int k = 0; k < 8; k++) {
+        acc[k] = _mm_loadu_ps(lanes + 4 * k);
+    }
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 8; k++) {
+            acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(_mm_loadu_ps(a + i + 4 * k), _mm_loadu_ps(b + i + 4 * k)));
+        }
+    }
+
+    for (int k = 0; k < 8; k++) {
+        _mm_storeu_ps(lanes + 4 * k, acc[k]);
+    }
+    addDot(a + i, b + i, n - i, lanes);
+}
+
+KERNEL_TARGET("sse2")
+static void sseDotNorms(const float *a, const float *b, size_t n, float &dot, float &normA, float &normB) {
+    __m128 dotAcc[8], normAAcc[8], normBAcc[8];
+    for (int k = 0; k < 8; k++) {
+        dotAcc[k] = normAAcc[k] = normBAcc[k] = _mm_setzero_ps();
+    }
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 8; k++) {
+            __m128 va = _mm_loadu_ps(a + i + 4 * k);
+            __m128 vb = _mm_loadu_ps(b + i + 4 * k);
+            dotAcc[k] = _mm_add_ps(dotAcc[k], _mm_mul_ps(va, vb));
+            normAAcc[k] = _mm_add_ps(normAAcc[k], _mm_mul_ps(va, va));
+            normBAcc[k] = _mm_add_ps(normBAcc[k], _mm_mul_ps(vb, vb));
+        }
+    }
+
+    float dotLanes[KERNEL_LANES], normALanes[KERNEL_LANES], normBLanes[KERNEL_LANES];
+    for (int k = 0; k < 8; k++) {
+        _mm_storeu_ps(dotLanes + 4 * k, dotAcc[k]);
+        _mm_storeu_ps(normALanes + 4 * k, normAAcc[k]);
+        _mm_storeu_ps(normBLanes + 4 * k, normBAcc[k]);
+    }
+    addDotNorms(a + i, b + i, n - i, dotLanes, normALanes, normBLanes);
+    dot = reduceLanes(dotLanes);
+    normA = reduceLanes(normALanes);
+    normB = reduceLanes(normBLanes);
+}
+
+// AVX2: 4 registers of 8 lanes
+
+KERNEL_TARGET("avx2")
+static void avx2AddSquared(const float *a, const float *b, size_t n, float *lanes) {
+    __m256 acc[4];
+    for (int k = 0; k < 4; k++) {
+        acc[k] = _mm256_loadu_ps(lanes + 8 * k);
+    }
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 4; k++) {
+            __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8 * k), _mm256_loadu_ps(b + i + 8 * k));
+            acc[k] = _mm256_add_ps(acc[k], _mm256_mul_ps(diff, diff));
+        }
+    }
+
+    for (int k = 0; k < 4; k++) {
+        _mm256_storeu_ps(lanes + 8 * k, acc[k]);
+    }
+    addSquared(a + i, b + i, n - i, lanes);
+}
+
+KERNEL_TARGET("avx2")
+static void avx2AddMin(const float *a, const float *b, size_t n, float *lanes) {
+    __m256 acc[4];
+    for (int k = 0; k < 4; k++) {
+        acc[k] = _mm256_loadu_ps(lanes + 8 * k);
+    }
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 4; k++) {
+            acc[k] = _mm256_add_ps(acc[k],
+                                   _mm256_min_ps(_mm256_loadu_ps(b + i + 8 * k), _mm256_loadu_ps(a + i + 8 * k)));
+        }
+    }
+
+    for (int k = 0; k < 4; k++) {
+        _mm256_storeu_ps(lanes + 8 * k, acc[k]);
+    }
+    addMin(a + i, b + i, n - i, lanes);
+}
+
+KERNEL_TARGET("avx2")
+static void avx2AddDot(const float *a, const float *b, size_t n, float *lanes) {
+    __m256 acc[4];
+    for (int k = 0; k < 4; k++) {
+        acc[k] = _mm256_loadu_ps(lanes + 8 * k);
+    }
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 4; k++) {
+            acc[k] = _mm256_add_ps(acc[k],
+                                   _mm256_mul_ps(_mm256_loadu_ps(a + i + 8 * k), _mm256_loadu_ps(b + i + 8 * k)));
+        }
+    }
+
+    for (int k = 0; k < 4; k++) {
+        _mm256_storeu_ps(lanes + 8 * k, acc[k]);
+    }
+    addDot(a + i, b + i, n - i, lanes);
+}
+
+KERNEL_TARGET("avx2")
+static void avx2DotNorms(const float *a, const float *b, size_t n, float &dot, float &normA, float &normB) {
+    __m256 dotAcc[4], normAAcc[4], normBAcc[4];
+    for (int k = 0; k < 4; k++) {
+        dotAcc[k] = normAAcc[k] = normBAcc[k] = _mm256_setzero_ps();
+    }
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 4; k++) {
+            __m256 va = _mm256_loadu_ps(a + i + 8 * k);
+            __m256 vb = _mm256_loadu_ps(b + i + 8 * k);
+            dotAcc[k] = _mm256_add_ps(dotAcc[k], _mm256_mul_ps(va, vb));
+            normAAcc[k] = _mm256_add_ps(normAAcc[k], _mm256_mul_ps(va, va));
+            normBAcc[k] = _mm256_add_ps(normBAcc[k], _mm256_mul_ps(vb, vb));
+        }
+    }
+
+    float dotLanes[KERNEL_LANES], normALanes[KERNEL_LANES], normBLanes[KERNEL_LANES];
+    for (int k = 0; k < 4; k++) {
+        _mm256_storeu_ps(dotLanes + 8 * k, dotAcc[k]);
+        _mm256_storeu_ps(normALanes + 8 * k, normAAcc[k]);
+        _mm256_storeu_ps(normBLanes + 8 * k, normBAcc[k]);
+    }
+    addDotNorms(a + i, b + i, n - i, dotLanes, normALanes, normBLanes);
+    dot = reduceLanes(dotLanes);
+    normA = reduceLanes(normALanes);
+    normB = reduceLanes(normBLanes);
+}
+
+// AVX2 batches: 2 rows at a time, the query block and the 8 accumulators fit the 16 registers
+
+KERNEL_TARGET("avx2")
+static void avx2SquaredDistances(const float *query, const float *rows, size_t count, size_t stride, size_t n,
+                                 float *out) {
+    size_t r = 0;
+    for (; r + 2 <= count; r += 2) {
+        const float *row[2] = {rows + r * stride, rows + (r + 1) * stride};
+        __m256 acc[2][4];
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < 4; k++) {
+                acc[j][k] = _mm256_setzero_ps();
+            }
+        }
+
+        size_t i = 0;
+        for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+            __m256 q[4];
+            for (int k = 0; k < 4; k++) {
+                q[k] = _mm256_loadu_ps(query + i + 8 * k);
+            }
+            for (int j = 0; j < 2; j++) {
+                KERNEL_PREFETCH(row[j] + 2 * stride + i);
+                KERNEL_PREFETCH(row[j] + 2 * stride + i + 16);
+                for (int k = 0; k < 4; k++) {
+                    __m256 diff = _mm256_sub_ps(q[k], _mm256_loadu_ps(row[j] + i + 8 * k));
+                    acc[j][k] = _mm256_add_ps(acc[j][k], _mm256_mul_ps(diff, diff));
+                }
+            }
+        }
+
+        for (int j = 0; j < 2; j++) {
+            float lanes[KERNEL_LANES];
+            for (int k = 0; k < 4; k++) {
+                _mm256_storeu_ps(lanes + 8 * k, acc[j][k]);
+            }
+            addSquared(query + i, row[j] + i, n - i, lanes);
+            out[r + j] = reduceLanes(lanes);
+        }
+    }
+
+    for (; r < count; r++) {
+        out[r] = reduced<avx2AddSquared>(query, rows + r * stride, n);
+    }
+}
+
+KERNEL_TARGET("avx2")
+static void avx2MinSums(const float *query, const float *rows, size_t count, size_t stride, size_t n, float *out) {
+    size_t r = 0;
+    for (; r + 2 <= count; r += 2) {
+        const float *row[2] = {rows + r * stride, rows + (r + 1) * stride};
+        __m256 acc[2][4];
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < 4; k++) {
+                acc[j][k] = _mm256_setzero_ps();
+            }
+        }
+
+        size_t i = 0;
+        for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+            __m256 q[4];
+            for (int k = 0; k < 4; k++) {
+                q[k] = _mm256_loadu_ps(query + i + 8 * k);
+            }
+            for (int j = 0; j < 2; j++) {
+                KERNEL_PREFETCH(row[j] + 2 * stride + i);
+                KERNEL_PREFETCH(row[j] + 2 * stride + i + 16);
+                for (int k = 0; k < 4; k++) {
+                    acc[j][k] = _mm256_add_ps(acc[j][k], _mm256_min_ps(_mm256_loadu_ps(row[j] + i + 8 * k), q[k]));
+                }
+            }
+        }
+
+        for (int j = 0; j < 2; j++) {
+            float lanes[KERNEL_LANES];
+            for (int k = 0; k < 4; k++) {
+                _mm256_storeu_ps(lanes + 8 * k, acc[j][k]);
+            }
+            addMin(query + i, row[j] + i, n - i, lanes);
+            out[r + j] = reduceLanes(lanes);
+        }
+    }
+
+    for (; r < count; r++) {
+        out[r] = reduced<avx2AddMin>(query, rows + r * stride, n);
+    }
+}
+
+KERNEL_TARGET("avx2")
+static void avx2Dots(const float *query, const float *rows, size_t count, size_t stride, size_t n, float *out) {
+    size_t r = 0;
+    for (; r + 2 <= count; r += 2) {
+        const float *row[2] = {rows + r * stride, rows + (r + 1) * stride};
+        __m256 acc[2][4];
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < 4; k++) {
+                acc[j][k] = _mm256_setzero_ps();
+            }
+        }
+
+        size_t i = 0;
+        for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+            __m256 q[4];
+            for (int k = 0; k < 4; k++) {
+                q[k] = _mm256_loadu_ps(query + i + 8 * k);
+            }
+            for (int j = 0; j < 2; j++) {
+                KERNEL_PREFETCH(row[j] + 2 * stride + i);
+                KERNEL_PREFETCH(row[j] + 2 * stride + i + 16);
+                for (int k = 0; k < 4; k++) {
+                    acc[j][k] = _mm256_add_ps(acc[j][k], _mm256_mul_ps(q[k], _mm256_loadu_ps(row[j] + i + 8 * k)));
+                }
+            }
+        }
+
+        for (int j = 0; j < 2; j++) {
+            float lanes[KERNEL_LANES];
+            for (int k = 0; k < 4; k++) {
+                _mm256_storeu_ps(lanes + 8 * k, acc[j][k]);
+            }
+            addDot(query + i, row[j] + i, n - i, lanes);
+            out[r + j] = reduceLanes(lanes);
+        }
+    }
+
+    for (; r < count; r++) {
+        out[r] = reduced<avx2AddDot>(query, rows + r * stride, n);
+    }
+}
+
+// AVX-512: 2 registers of 16 lanes
+
+KERNEL_TARGET("avx512f")
+static void avx512AddSquared(const float *a, const float *b, size_t n, float *lanes) {
+    __m512 acc[2] = {_mm512_loadu_ps(lanes), _mm512_loadu_ps(lanes + 16)};
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 2; k++) {
+            __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16 * k), _mm512_loadu_ps(b + i + 16 * k));
+            acc[k] = _mm512_add_ps(acc[k], _mm512_mul_ps(diff, diff));
+        }
+    }
+
+    _mm512_storeu_ps(lanes, acc[0]);
+    _mm512_storeu_ps(lanes + 16, acc[1]);
+    addSquared(a + i, b + i, n - i, lanes);
+}
+
+KERNEL_TARGET("avx512f")
+static void avx512AddMin(const float *a, const float *b, size_t n, float *lanes) {
+    __m512 acc[2] = {_mm512_loadu_ps(lanes), _mm512_loadu_ps(lanes + 16)};
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 2; k++) {
+            acc[k] = _mm512_add_ps(acc[k],
+                                   _mm512_min_ps(_mm512_loadu_ps(b + i + 16 * k), _mm512_loadu_ps(a + i + 16 * k)));
+        }
+    }
+
+    _mm512_storeu_ps(lanes, acc[0]);
+    _mm512_storeu_ps(lanes + 16, acc[1]);
+    addMin(a + i, b + i, n - i, lanes);
+}
+
+KERNEL_TARGET("avx512f")
+static void avx512AddDot(const float *a, const float *b, size_t n, float *lanes) {
+    __m512 acc[2] = {_mm512_loadu_ps(lanes), _mm512_loadu_ps(lanes + 16)};
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 2; k++) {
+            acc[k] = _mm512_add_ps(acc[k],
+                                   _mm512_mul_ps(_mm512_loadu_ps(a + i + 16 * k), _mm512_loadu_ps(b + i + 16 * k)));
+        }
+    }
+
+    _mm512_storeu_ps(lanes, acc[0]);
+    _mm512_storeu_ps(lanes + 16, acc[1]);
+    addDot(a + i, b + i, n - i, lanes);
+}
+
+KERNEL_TARGET("avx512f")
+static void avx512DotNorms(const float *a, const float *b, size_t n, float &dot, float &normA, float &normB) {
+    __m512 dotAcc[2], normAAcc[2], normBAcc[2];
+    for (int k = 0; k < 2; k++) {
+        dotAcc[k] = normAAcc[k] = normBAcc[k] = _mm512_setzero_ps();
+    }
+
+    size_t i = 0;
+    for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+        for (int k = 0; k < 2; k++) {
+            __m512 va = _mm512_loadu_ps(a + i + 16 * k);
+            __m512 vb = _mm512_loadu_ps(b + i + 16 * k);
+            dotAcc[k] = _mm512_add_ps(dotAcc[k], _mm512_mul_ps(va, vb));
+            normAAcc[k] = _mm512_add_ps(normAAcc[k], _mm512_mul_ps(va, va));
+            normBAcc[k] = _mm512_add_ps(normBAcc[k], _mm512_mul_ps(vb, vb));
+        }
+    }
+
+    float dotLanes[KERNEL_LANES], normALanes[KERNEL_LANES], normBLanes[KERNEL_LANES];
+    for (int k = 0; k < 2; k++) {
+        _mm512_storeu_ps(dotLanes + 16 * k, dotAcc[k]);
+        _mm512_storeu_ps(normALanes + 16 * k, normAAcc[k]);
+        _mm512_storeu_ps(normBLanes + 16 * k, normBAcc[k]);
+    }
+    addDotNorms(a + i, b + i, n - i, dotLanes, normALanes, normBLanes);
+    dot = reduceLanes(dotLanes);
+    normA = reduceLanes(normALanes);
+    normB = reduceLanes(normBLanes);
+}
+
+// AVX-512 batches: 4 rows at a time, 2 query registers and 8 accumulators
+
+KERNEL_TARGET("avx512f")
+static void avx512SquaredDistances(const float *query, const float *rows, size_t count, size_t stride, size_t n,
+                                   float *out) {
+    size_t r = 0;
+    for (; r + 4 <= count; r += 4) {
+        const float *row[4];
+        __m512 acc[4][2];
+        for (int j = 0; j < 4; j++) {
+            row[j] = rows + (r + j) * stride;
+            acc[j][0] = acc[j][1] = _mm512_setzero_ps();
+        }
+
+        size_t i = 0;
+        for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+            __m512 q[2] = {_mm512_loadu_ps(query + i), _mm512_loadu_ps(query + i + 16)};
+            for (int j = 0; j < 4; j++) {
+                KERNEL_PREFETCH(row[j] + 4 * stride + i);
+                KERNEL_PREFETCH(row[j] + 4 * stride + i + 16);
+                for (int k = 0; k < 2; k++) {
+                    __m512 diff = _mm512_sub_ps(q[k], _mm512_loadu_ps(row[j] + i + 16 * k));
+                    acc[j][k] = _mm512_add_ps(acc[j][k], _mm512_mul_ps(diff, diff));
+                }
+            }
+        }
+
+        for (int j = 0; j < 4; j++) {
+            float lanes[KERNEL_LANES];
+            _mm512_storeu_ps(lanes, acc[j][0]);
+            _mm512_storeu_ps(lanes + 16, acc[j][1]);
+            addSquared(query + i, row[j] + i, n - i, lanes);
+            out[r + j] = reduceLanes(lanes);
+        }
+    }
+
+    for (; r < count; r++) {
+        out[r] = reduced<avx512AddSquared>(query, rows + r * stride, n);
+    }
+}
+
+KERNEL_TARGET("avx512f")
+static void avx512MinSums(const float *query, const float *rows, size_t count, size_t stride, size_t n,
+                          float *out) {
+    size_t r = 0;
+    for (; r + 4 <= count; r += 4) {
+        const float *row[4];
+        __m512 acc[4][2];
+        for (int j = 0; j < 4; j++) {
+            row[j] = rows + (r + j) * stride;
+            acc[j][0] = acc[j][1] = _mm512_setzero_ps();
+        }
+
+        size_t i = 0;
+        for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+            __m512 q[2] = {_mm512_loadu_ps(query + i), _mm512_loadu_ps(query + i + 16)};
+            for (int j = 0; j < 4; j++) {
+                KERNEL_PREFETCH(row[j] + 4 * stride + i);
+                KERNEL_PREFETCH(row[j] + 4 * stride + i + 16);
+                for (int k = 0; k < 2; k++) {
+                    acc[j][k] = _mm512_add_ps(acc[j][k], _mm512_min_ps(_mm512_loadu_ps(row[j] + i + 16 * k), q[k]));
+                }
+            }
+        }
+
+        for (int j = 0; j < 4; j++) {
+            float lanes[KERNEL_LANES];
+            _mm512_storeu_ps(lanes, acc[j][0]);
+            _mm512_storeu_ps(lanes + 16, acc[j][1]);
+            addMin(query + i, row[j] + i, n - i, lanes);
+            out[r + j] = reduceLanes(lanes);
+        }
+    }
+
+    for (; r < count; r++) {
+        out[r] = reduced<avx512AddMin>(query, rows + r * stride, n);
+    }
+}
+
+KERNEL_TARGET("avx512f")
+static void avx512Dots(const float *query, const float *rows, size_t count, size_t stride, size_t n, float *out) {
+    size_t r = 0;
+    for (; r + 4 <= count; r += 4) {
+        const float *row[4];
+        __m512 acc[4][2];
+        for (int j = 0; j < 4; j++) {
+            row[j] = rows + (r + j) * stride;
+            acc[j][0] = acc[j][1] = _mm512_setzero_ps();
+        }
+
+        size_t i = 0;
+        for (; i + KERNEL_LANES <= n; i += KERNEL_LANES) {
+            __m512 q[2] = {_mm512_loadu_ps(query + i), _mm512_loadu_ps(query + i + 16)};
+            for (int j = 0; j < 4; j++) {
+                KERNEL_PREFETCH(row[j] + 4 * stride + i);
+                KERNEL_PREFETCH(row[j] + 4 * stride + i + 16);
+                for (int k = 0; k < 2; k++) {
+                    acc[j][k] = _mm512_add_ps(acc[j][k], _mm512_mul_ps(q[k], _mm512_loadu_ps(row[j] + i + 16 * k)));
+                }
+            }
+        }
+
+        for (int j = 0; j < 4; j++) {
+            float lanes[KERNEL_LANES];
+            _mm512_storeu_ps(lanes, acc[j][0]);
+            _mm512_storeu_ps(lanes + 16, acc[j][1]);
+            addDot(query + i, row[j] + i, n - i, lanes);
+            out[r + j] = reduceLanes(lanes);
+        }
+    }
+
+    for (; r < count; r++) {
+        out[r] = reduced<avx512AddDot>(query, rows + r * stride, n);
+    }
+}
+
+#endif
+
+/*
+    Pick the widest kernels the CPU supports, or the ones named by CBIR_SIMD
+
+    Returns:
+        the selected kernels
+*/
+static DistanceKernels selectKernels() {
+    std::vector<DistanceKernels> available = {
+        {"scalar", reduced<addSquared>, reduced<addMin>, scalarDotNorms, reduced<addDot>,
+         eachRow<reduced<addSquared>>, eachRow<reduced<addMin>>, eachRow<reduced<addDot>>, addSquared, addMin}};
+#ifdef KERNELS_X86
+    if (__builtin_cpu_supports("sse2")) {
+        available.push_back({"sse", reduced<sseAddSquared>, reduced<sseAddMin>, sseDotNorms, reduced<sseAddDot>,
+                             eachRow<reduced<sseAddSquared>>, eachRow<reduced<sseAddMin>>,
+                             eachRow<reduced<sseAddDot>>, sseAddSquared, sseAddMin});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        available.push_back({"avx2", reduced<avx2AddSquared>, reduced<avx2AddMin>, avx2DotNorms,
+                             reduced<avx2AddDot>, avx2SquaredDistances, avx2MinSums, avx2Dots, avx2AddSquared,
+                             avx2AddMin});
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        available.push_back({"avx512", reduced<avx512AddSquared>, reduced<avx512AddMin>, avx512DotNorms,
+                             reduced<avx512AddDot>, avx512SquaredDistances, avx512MinSums, avx512Dots,
+                             avx512AddSquared, avx512AddMin});
+    }
+#endif
+
+    const char *requested = getenv("CBIR_SIMD");
+    if (requested) {
+        for (const DistanceKernels &kernels : available) {
+            if (strcmp(requested, kernels.name) == 0) {
+                return kernels;
+            }
+        }
+        printf("Warning: CBIR_SIMD=%s is not available, using %s kernels\n", requested, available.back().name);
+    }
+
+    return available.back();
+}
+
+/*
+    Kernels for this CPU, detected once
+
+    Returns:
+        the selected kernels
+*/
+const DistanceKernels &distanceKernels() {
+    static const DistanceKernels kernels = selectKernels();
+    return kernels;
+}
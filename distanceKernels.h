@@ -0,0 +1,96 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for the vectorized inner loops of the distance functions.
+
+    Every kernel spreads its sums over KERNEL_LANES independent accumulators:
+    element i is added to lane i % KERNEL_LANES, in order, and the lanes are
+    combined with reduceLanes(). The scalar, SSE, AVX2 and AVX-512 versions
+    all follow that order exactly (SSE keeps the 32 lanes in 8 registers,
+    AVX2 in 4, AVX-512 in 2), so every CPU computes bit-identical distances
+    and rankings. This needs multiply and add to stay separate operations,
+    the makefile builds with -ffp-contract=off.
+
+    The batch kernels compare one query with consecutive rows of a matrix.
+    The AVX2 and AVX-512 versions run 2 and 4 rows at a time, loading each
+    block of the query once for all of them, and every version prefetches
+    the rows ahead. They keep the lanes of each row separate, so a batch
+    gives the same distances as the kernels of one pair.
+
+    The widest version the CPU supports is picked on first use. Setting the
+    environment variable CBIR_SIMD to scalar, sse, avx2 or avx512 picks a
+    narrower one instead, for comparing them.
+*/
+
+#ifndef DISTANCEKERNELS_H
+#define DISTANCEKERNELS_H
+
+#include <cstddef>
+
+// Number of independent accumulators of every kernel
+#define KERNEL_LANES 32
+
+// Prefetching never faults, so rows past the end of a matrix may be named
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define KERNEL_PREFETCH(address)
+#endif
+
+// Rows ahead of the current one that the kernels that run one row at a time prefetch
+#define KERNEL_PREFETCH_ROWS 2
+
+// One implementation of the distance kernels
+struct DistanceKernels {
+    const char *name;
+
+    // Sum of (a[i] - b[i])^2
+    float (*squaredDistance)(const float *a, const float *b, size_t n);
+
+    // Sum of min(a[i], b[i])
+    float (*minSum)(const float *a, const float *b, size_t n);
+
+    // Sums of a[i] * b[i], a[i]^2 and b[i]^2
+    void (*dotNorms)(const float *a, const float *b, size_t n, float &dot, float &normA, float &normB);
+
+    // Sum of a[i] * b[i], equal to the dot and, for a == b, the norms of dotNorms
+    float (*dot)(const float *a, const float *b, size_t n);
+
+    // squaredDistance of query and each of count rows, stride floats apart
+    void (*squaredDistances)(const float *query, const float *rows, size_t count, size_t stride, size_t n,
+                             float *out);
+
+    // minSum of query and each of count rows, stride floats apart
+    void (*minSums)(const float *query, const float *rows, size_t count, size_t stride, size_t n, float *out);
+
+    // dot of query and each of count rows, stride floats apart
+    void (*dots)(const float *query, const float *rows, size_t count, size_t stride, size_t n, float *out);
+
+    // Add the terms of squaredDistance and minSum to KERNEL_LANES running lanes instead of
+    // returning the total. Calls on consecutive slices that start at multiples of KERNEL_LANES
+    // leave the same lanes as one call on the whole range, so the sum can be checked part way
+    void (*addSquared)(const float *a, const float *b, size_t n, float *lanes);
+    void (*addMin)(const float *a, const float *b, size_t n, float *lanes);
+};
+
+/*
+    Kernels for this CPU, detected once
+
+    Returns:
+        the selected kernels
+*/
+const DistanceKernels &distanceKernels();
+
+/*
+    Combine the lanes of a kernel in the fixed order every version uses:
+    lane j + 16 is added to lane j, then lane j + 8, j + 4, j + 2 and j + 1
+
+    Parameters:
+        lanes: KERNEL_LANES partial sums, overwritten
+
+    Returns:
+        total
+*/
+float reduceLanes(float *lanes);
+
+#endif
@@ -21,11 +21,11 @@
      if the length of the vector is zero, no faces were found
  */
 int detectFaces(cv::Mat &grey, std::vector<cv::Rect> &faces ) {
-  // a static variable to hold a half-size image
-  static cv::Mat half;
+  // a per-thread variable to hold a half-size image
+  thread_local cv::Mat half;
   
-  // a static variable to hold the classifier
-  static cv::CascadeClassifier face_cascade;
+  // a per-thread variable to hold the classifier (detectMultiScale is not safe to share across threads)
+  thread_local cv::CascadeClassifier face_cascade;
 
   // the path to the haar cascade file
   static cv::String face_cascade_file(FACE_CASCADE_FILE);
@@ -0,0 +1,437 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Fast feature CSV reader, parsing newline aligned chunks of a
+    memory mapped file in parallel, and the buffered feature CSV writer.
+*/
+
+#include "featureCsv.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "featureDatabase.h"
+#include "mappedFile.h"
+#include "threadPool.h"
+
+// Files smaller than this are parsed on the calling thread
+#define CSV_MIN_CHUNK (1 << 20)
+
+// Reports printed per file, the remaining malformed rows are only counted
+#define CSV_MAX_REPORTS 10
+
+// Size of the writer buffer, rows are written to the file in blocks of about this size
+#define CSV_WRITE_BUFFER (1 << 20)
+
+// Longest text of one formatted value, ",%.4f" of the largest float is 46 characters
+#define CSV_MAX_VALUE 64
+
+// A line that could not be parsed
+struct CsvError {
+    size_t line;  // line number within the chunk, from 0
+    std::string reason;
+};
+
+// One newline aligned range of the file and the rows parsed from it
+struct CsvChunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    size_t lines = 0;
+    size_t rows = 0;
+    std::vector<float> values;     // rows x columns values
+    std::string names;             // names of the rows, back to back
+    std::vector<size_t> nameEnds;  // end of each name in names
+    std::vector<CsvError> errors;
+};
+
+/*
+    Parse one feature value. Surrounding blanks and a leading '+' are allowed,
+    the value is parsed as a double and rounded to float, which gives the same
+    result as atof.
+
+    Parameters:
+        begin: first character of the field
+        end: one past the last character of the field
+        value: output value
+
+    Returns:
+        true if the whole field is a number
+*/
+static bool parseValue(const char *begin, const char *end, float &value) {
+    while (begin < end && (*begin == ' ' || *begin == '\t')) {
+        begin++;
+    }
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    if (begin < end && *begin == '+') {
+        begin++;
+    }
+    if (begin == end) {
+        return false;
+    }
+
+    double parsed;
+#if defined(__cpp_lib_to_chars)
+    std::from_chars_result result = std::from_chars(begin, end, parsed);
+    if (result.ec != std::errc() || result.ptr != end) {
+        return false;
+    }
+#else
+    // Without floating point from_chars the field is copied so strtod sees a terminated string
+    char field[64];
+    size_t length = static_cast<size_t>(end - begin);
+    if (length >= sizeof(field)) {
+        return false;
+    }
+    memcpy(field, begin, length);
+    field[length] = '\0';
+
+    char *parsedEnd;
+    parsed = strtod(field, &parsedEnd);
+    if (parsedEnd != field + length) {
+        return false;
+    }
+#endif
+
+    value = static_cast<float>(parsed);
+    return true;
+}
+
+/*
+    Parse every line of a chunk
+
+    Parameters:
+        chunk: range to parse, rows, names and errors are filled in
+        expectedColumns: number of values every row must have, 0 to accept any
+*/
+static void parseChunk(CsvChunk &chunk, size_t expectedColumns) {
+    std::vector<float> row;
+    const char *p = chunk.begin;
+
+    while (p < chunk.end) {
+        const char *lineEnd = static_cast<const char *>(memchr(p, '\n', chunk.end - p));
+        if (!lineEnd) {
+            lineEnd = chunk.end;
+        }
+        const char *end = lineEnd;
+        if (end > p && end[-1] == '\r') {
+            end--;
+        }
+
+        const char *line = p;
+        size_t lineNumber = chunk.lines++;
+        p = lineEnd + 1;
+
+        if (end == line) {
+            continue;
+        }
+
+        const char *comma = static_cast<const char *>(memchr(line, ',', end - line));
+        if (!comma) {
+            chunk.errors.push_back({lineNumber, "no feature values"});
+            continue;
+        }
+
+        // Parse the values into the reused row buffer
+        row.clear();
+        bool valid = true;
+        for (const char *field = comma + 1;;) {
+            const char *fieldEnd = static_cast<const char *>(memchr(field, ',', end - field));
+            if (!fieldEnd) {
+                fieldEnd = end;
+            }
+
+            float value;
+            if (!parseValue(field, fieldEnd, value)) {
+                chunk.errors.push_back({lineNumber, "value " + std::to_string(row.size() + 1) + " is not a number"});
+                valid = false;
+                break;
+            }
+            row.push_back(value);
+
+            if (fieldEnd == end) {
+                break;
+            }
+            field = fieldEnd + 1;
+        }
+        if (!valid) {
+            continue;
+        }
+
+        if (expectedColumns > 0 && row.size() != expectedColumns) {
+            chunk.errors.push_back({lineNumber, std::to_string(row.size()) + " values, expected " +
+                                                    std::to_string(expectedColumns)});
+            continue;
+        }
+
+        chunk.values.insert(chunk.values.end(), row.begin(), row.end());
+        chunk.names.append(line, comma - line);
+        chunk.nameEnds.push_back(chunk.names.size());
+        chunk.rows++;
+    }
+}
+
+/*
+    Count the values of the first row with values, so every chunk can check
+    its rows against it
+
+    Parameters:
+        begin: start of the file
+        end: end of the file
+
+    Returns:
+        number of values, 0 if there is no valid row
+*/
+static size_t firstRowColumns(const char *begin, const char *end) {
+    CsvChunk chunk;
+    chunk.begin = begin;
+    chunk.end = begin;
+
+    // Grow the range one line at a time until a row parses
+    while (chunk.end < end && chunk.rows == 0) {
+        const char *lineEnd = static_cast<const char *>(memchr(chunk.end, '\n', end - chunk.end));
+        chunk.begin = chunk.end;
+        chunk.end = lineEnd ? lineEnd + 1 : end;
+        parseChunk(chunk, 0);
+    }
+
+    return chunk.values.size();
+}
+
+/*
+    Reads a feature CSV
+
+    Parameters:
+        filename: feature CSV
+        database: output rows, any rows already in it must have the same dimension
+        numThreads: parsing threads, 0 for one per core
+
+    Returns:
+        0 on success
+        -1 if the file could not be opened or does not match the database
+*/
+int readFeatureCsv(const std::string &filename, FeatureDatabase &database, int numThreads) {
+    MappedFile file;
+    if (file.open(filename) != 0) {
+        printf("Unable to open feature file %s\n", filename.c_str());
+        return -1;
+    }
+
+    const char *begin = file.data();
+    const char *end = begin + file.size();
+
+    if (numThreads <= 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Split into chunks of at least CSV_MIN_CHUNK bytes, each extended to the end of its last line
+    size_t numChunks = std::max<size_t>(1, std::min<size_t>(numThreads * 4, file.size() / CSV_MIN_CHUNK));
+    std::vector<CsvChunk> chunks(numChunks);
+    const char *chunkStart = begin;
+    for (size_t c = 0; c < numChunks; c++) {
+        const char *chunkEnd = c + 1 == numChunks ? end : begin + file.size() / numChunks * (c + 1);
+        if (chunkEnd < chunkStart) {
+            chunkEnd = chunkStart;
+        }
+        if (chunkEnd < end) {
+            const char *newline = static_cast<const char *>(memchr(chunkEnd, '\n', end - chunkEnd));
+            chunkEnd = newline ? newline + 1 : end;
+        }
+
+        chunks[c].begin = chunkStart;
+        chunks[c].end = chunkEnd;
+        chunkStart = chunkEnd;
+    }
+
+    size_t columns = firstRowColumns(begin, end);
+
+    if (numChunks == 1) {
+        parseChunk(chunks[0], columns);
+    }
+    else {
+        // The pool finishes every chunk before it is destroyed
+        ThreadPool pool(std::min<int>(numThreads, static_cast<int>(numChunks)));
+        for (auto &chunk : chunks) {
+            pool.submit([&chunk, columns] { parseChunk(chunk, columns); });
+        }
+    }
+
+    // Join the chunks in file order and report malformed rows with file line numbers
+    size_t totalRows = database.size();
+    for (const auto &chunk : chunks) {
+        totalRows += chunk.rows;
+    }
+    database.reserve(totalRows, static_cast<int>(columns));
+
+    size_t firstLine = 1;
+    size_t malformed = 0;
+    for (auto &chunk : chunks) {
+        for (const auto &error : chunk.errors) {
+            if (malformed++ < CSV_MAX_REPORTS) {
+                printf("Warning: skipping malformed row at %s:%zu (%s)\n", filename.c_str(), firstLine + error.line,
+                       error.reason.c_str());
+            }
+        }
+        firstLine += chunk.lines;
+
+        size_t nameStart = 0;
+        for (size_t r = 0; r < chunk.rows; r++) {
+            if (database.addRow(chunk.names.data() + nameStart, chunk.nameEnds[r] - nameStart,
+                                chunk.values.data() + r * columns, columns) < 0) {
+                printf("Error, %s does not have the dimension of the rows already loaded\n", filename.c_str());
+                return -1;
+            }
+            nameStart = chunk.nameEnds[r];
+        }
+
+        // Release each chunk once copied so peak memory stays near one copy of the file
+        std::vector<float>().swap(chunk.values);
+        std::string().swap(chunk.names);
+    }
+
+    if (malformed > CSV_MAX_REPORTS) {
+        printf("Warning: skipped %zu malformed rows in %s\n", malformed, filename.c_str());
+    }
+
+    return 0;
+}
+
+FeatureCsvWriter::~FeatureCsvWriter() {
+    close();
+}
+
+/*
+    Opens the output file
+
+    Parameters:
+        path: feature CSV
+        append: true to add rows to the end of an existing file, false to replace it
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int FeatureCsvWriter::open(const std::string &path, bool append) {
+    close();
+
+    this->path = path;
+    fp = fopen(path.c_str(), append ? "a" : "w");
+    if (!fp) {
+        printf("Unable to open output file %s\n", path.c_str());
+        return -1;
+    }
+
+    buffer.resize(CSV_WRITE_BUFFER);
+    used = 0;
+    failed = false;
+    return 0;
+}
+
+/*
+    Format one value as ",%.4f"
+
+    Parameters:
+        out: output buffer with room for CSV_MAX_VALUE characters
+        value: value to format
+
+    Returns:
+        number of characters written
+*/
+static size_t formatValue(char *out, float value) {
+    out[0] = ',';
+#if defined(__cpp_lib_to_chars)
+    // Fixed precision to_chars is specified to match printf with the same precision
+    std::to_chars_result result = std::to_chars(out + 1, out + CSV_MAX_VALUE, value, std::chars_format::fixed, 4);
+    return static_cast<size_t>(result.ptr - out);
+#else
+    return 1 + static_cast<size_t>(snprintf(out + 1, CSV_MAX_VALUE - 1, "%.4f", value));
+#endif
+}
+
+/*
+    Adds a row to the buffer, writing the buffer out once it is full
+
+    Parameters:
+        name: image name (first column)
+        values: feature values
+        count: number of values
+
+    Returns:
+        0 on success
+        -1 on write error
+*/
+int FeatureCsvWriter::addRow(const char *name, const float *values, size_t count) {
+    if (!fp || failed) {
+        return -1;
+    }
+
+    // Make room for the whole row, a row bigger than the buffer grows it
+    size_t nameLength = strlen(name);
+    size_t rowMax = nameLength + count * CSV_MAX_VALUE + 1;
+    if (used + rowMax > buffer.size()) {
+        if (flush() != 0) {
+            return -1;
+        }
+        if (rowMax > buffer.size()) {
+            buffer.resize(rowMax);
+        }
+    }
+
+    char *out = buffer.data() + used;
+    memcpy(out, name, nameLength);
+    out += nameLength;
+    for (size_t i = 0; i < count; i++) {
+        out += formatValue(out, values[i]);
+    }
+    *out++ = '\n';
+
+    used = static_cast<size_t>(out - buffer.data());
+    return 0;
+}
+
+/*
+    Writes the buffered rows to the file and flushes the stdio buffer
+
+    Returns:
+        0 on success
+        -1 on write error
+*/
+int FeatureCsvWriter::flush() {
+    if (!fp || failed) {
+        return -1;
+    }
+
+    if ((used > 0 && fwrite(buffer.data(), 1, used, fp) != used) || fflush(fp) != 0) {
+        printf("Error writing output file %s\n", path.c_str());
+        failed = true;
+        return -1;
+    }
+
+    used = 0;
+    return 0;
+}
+
+/*
+    Flushes and closes the file
+
+    Returns:
+        0 on success
+        -1 on write error
+*/
+int FeatureCsvWriter::close() {
+    if (!fp) {
+        return 0;
+    }
+
+    int status = flush();
+    if (fclose(fp) != 0) {
+        printf("Error writing output file %s\n", path.c_str());
+        status = -1;
+    }
+    fp = nullptr;
+
+    return status;
+}
@@ -0,0 +1,108 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for the fast feature CSV reader and the buffered
+    feature CSV writer.
+
+    Feature CSVs have an image name in the first column followed by the
+    feature values. The reader memory maps the file, splits it into chunks
+    that end on a line boundary and parses the chunks in parallel, so large
+    CSVs (e.g. 1M ResNet embeddings) are read at disk speed.
+*/
+
+#ifndef FEATURECSV_H
+#define FEATURECSV_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class FeatureDatabase;
+
+/*
+    Reads a feature CSV. Rows are appended to the database in file order.
+    Blank lines are skipped; rows with no feature values, a value that is not
+    a number, or a different number of values than the first row are
+    reported and skipped.
+
+    Parameters:
+        filename: feature CSV
+        database: output rows, any rows already in it must have the same dimension
+        numThreads: parsing threads, 0 for one per core
+
+    Returns:
+        0 on success
+        -1 if the file could not be opened or does not match the database
+*/
+int readFeatureCsv(const std::string &filename, FeatureDatabase &database, int numThreads = 0);
+
+/*
+    Writes feature CSV rows through a large buffer to a file that stays open,
+    in the same format as append_image_data_csv (values printed as %.4f).
+    Rows reach the file when the buffer fills, on flush() and on close().
+*/
+class FeatureCsvWriter {
+public:
+    FeatureCsvWriter() = default;
+    ~FeatureCsvWriter();
+
+    FeatureCsvWriter(const FeatureCsvWriter &) = delete;
+    FeatureCsvWriter &operator=(const FeatureCsvWriter &) = delete;
+
+    /*
+        Opens the output file
+
+        Parameters:
+            path: feature CSV
+            append: true to add rows to the end of an existing file, false to replace it
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int open(const std::string &path, bool append);
+
+    /*
+        Adds a row to the buffer, writing the buffer out once it is full
+
+        Parameters:
+            name: image name (first column)
+            values: feature values
+            count: number of values
+
+        Returns:
+            0 on success
+            -1 on write error
+    */
+    int addRow(const char *name, const float *values, size_t count);
+    int addRow(const std::string &name, const std::vector<float> &values) {
+        return addRow(name.c_str(), values.data(), values.size());
+    }
+
+    /*
+        Writes the buffered rows to the file and flushes the stdio buffer
+
+        Returns:
+            0 on success
+            -1 on write error
+    */
+    int flush();
+
+    /*
+        Flushes and closes the file
+
+        Returns:
+            0 on success
+            -1 on write error
+    */
+    int close();
+
+private:
+    FILE *fp = nullptr;
+    std::string path;
+    std::vector<char> buffer;
+    size_t used = 0;
+    bool failed = false;
+};
+
+#endif
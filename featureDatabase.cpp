@@ -0,0 +1,285 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: In-memory feature database, one aligned float block with an
+    interned name table.
+*/
+
+#include "featureDatabase.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include "distanceFunctions.h"
+#include "featureCsv.h"
+
+FeatureDatabase::~FeatureDatabase() {
+    clear();
+}
+
+/*
+    Loads a feature file, either a CSV or a binary feature store
+
+    Parameters:
+        path: feature file
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int FeatureDatabase::load(const std::string &path) {
+    clear();
+
+    if (!isFeatureStoreFile(path)) {
+        if (readFeatureCsv(path, *this) != 0) {
+            return -1;
+        }
+        indexNames();
+        return 0;
+    }
+
+    auto store = std::make_unique<FeatureStore>();
+    if (store->open(path) != 0) {
+        return -1;
+    }
+
+    if (store->rows() > UINT32_MAX) {
+        printf("Error, %s has more rows than image IDs can address\n", path.c_str());
+        return -1;
+    }
+
+    // Quantized rows are only reached through rowU8/rowU16 and copyRow, sparse rows through sparseRow
+    matrix = store->dtype() == FEATURE_STORE_FLOAT32 && !store->sparse() ? store->row(0) : nullptr;
+    numRows = store->rows();
+    numDims = store->dim();
+    rowStride = store->stride();
+    mapped = std::move(store);
+
+    // Stores written before the name index get one in memory
+    if (!mapped->hasNameIndex()) {
+        indexNames();
+    }
+
+    return 0;
+}
+
+/*
+    Removes every row and releases the storage
+*/
+void FeatureDatabase::clear() {
+    if (block) {
+        ::operator delete(block, std::align_val_t(FEATURE_STORE_ALIGN));
+    }
+
+    mapped.reset();
+    block = nullptr;
+    capacity = 0;
+    matrix = nullptr;
+    numRows = 0;
+    numDims = 0;
+    rowStride = 0;
+    names.clear();
+    nameOffsets.clear();
+    rowNorms.clear();
+    nameSlots.clear();
+    nameBits = 0;
+    indexedRows = 0;
+    layout.clear();
+}
+
+/*
+    Moves the owned rows to a block that can hold more rows
+
+    Parameters:
+        rows: number of rows the new block must hold
+*/
+void FeatureDatabase::grow(size_t rows) {
+    if (rows <= capacity) {
+        return;
+    }
+
+    size_t bytes = rows * rowStride * sizeof(float);
+    float *larger = static_cast<float *>(::operator new(std::max<size_t>(bytes, 1),
+                                                        std::align_val_t(FEATURE_STORE_ALIGN)));
+    if (block) {
+        memcpy(larger, block, numRows * rowStride * sizeof(float));
+        ::operator delete(block, std::align_val_t(FEATURE_STORE_ALIGN));
+    }
+
+    block = larger;
+    matrix = block;
+    capacity = rows;
+}
+
+/*
+    Sets the dimension of an empty database and reserves room for rows
+
+    Parameters:
+        rows: number of rows to reserve
+        dim: features per row
+*/
+void FeatureDatabase::reserve(size_t rows, int dim) {
+    if (mapped) {
+        return;
+    }
+
+    if (numRows == 0 && capacity == 0) {
+        numDims = dim;
+        rowStride = (dim + FEATURE_STORE_ALIGN / sizeof(float) - 1) / (FEATURE_STORE_ALIGN / sizeof(float)) *
+                    (FEATURE_STORE_ALIGN / sizeof(float));
+    }
+
+    grow(rows);
+    nameOffsets.reserve(rows);
+}
+
+/*
+    Appends a row
+
+    Parameters:
+        name: image name
+        nameLength: length of the name
+        values: feature values
+        count: number of values, must equal dim()
+
+    Returns:
+        ID of the new row
+        -1 if the count does not match or the database is a mapped store
+*/
+long FeatureDatabase::addRow(const char *name, size_t nameLength, const float *values, size_t count) {
+    if (mapped || numRows >= UINT32_MAX) {
+        return -1;
+    }
+
+    if (numRows == 0 && capacity == 0) {
+        reserve(16, static_cast<int>(count));
+    }
+    if (count != static_cast<size_t>(numDims)) {
+        return -1;
+    }
+
+    if (numRows == capacity) {
+        grow(capacity * 2);
+    }
+
+    // Padding is zeroed so a row can be read as stride() values
+    float *out = block + numRows * rowStride;
+    std::copy(values, values + count, out);
+    std::fill(out + count, out + rowStride, 0.0f);
+
+    nameOffsets.push_back(names.size());
+    names.append(name, nameLength);
+    names.push_back('\0');
+
+    return static_cast<long>(numRows++);
+}
+
+/*
+    Copies the features of an image as floats, dequantizing quantized rows
+
+    Parameters:
+        id: image ID
+        out: output, dim() values
+*/
+void FeatureDatabase::copyRow(ImageId id, float *out) const {
+    if (mapped) {
+        mapped->copyRow(id, out);
+        return;
+    }
+
+    std::copy(row(id), row(id) + numDims, out);
+}
+
+/*
+    L2 norm of every row of a float32 database, read from the binary store
+    when it keeps them and computed on the first call otherwise
+
+    Returns:
+        size() norms, valid until the database changes
+*/
+const float *FeatureDatabase::norms() const {
+    if (mapped && mapped->norms()) {
+        return mapped->norms();
+    }
+
+    // Rows added since the last call make the count differ
+    if (rowNorms.size() != numRows) {
+        rowNorms.resize(numRows);
+        for (size_t id = 0; id < numRows; id++) {
+            rowNorms[id] = l2Norm(row(static_cast<ImageId>(id)), numDims);
+        }
+    }
+    return rowNorms.data();
+}
+
+/*
+    Indexes the names in memory, for owned rows and binary stores without
+    a name index. load() calls it, call it again after adding rows. Past
+    NAME_INDEX_MAX_ROWS rows nothing is indexed and findName compares every name.
+*/
+void FeatureDatabase::indexNames() {
+    if (numRows > NAME_INDEX_MAX_ROWS) {
+        return;
+    }
+    nameBits = buildNameIndex(numRows, [this](size_t i) { return name(static_cast<ImageId>(i)); }, nameSlots);
+    indexedRows = numRows;
+}
+
+/*
+    Finds an image by name or file name, see lookupNameIndex. Uses the
+    name index of the binary store or the one built by indexNames(), and
+    compares every name if rows were added since.
+
+    Parameters:
+        key: image name or file name
+        length: length of the key
+        id: output image ID
+
+    Returns:
+        0 if the image was found
+        -1 otherwise
+*/
+int FeatureDatabase::findName(const char *key, size_t length, ImageId &id) const {
+    size_t row;
+    if (mapped && mapped->hasNameIndex()) {
+        if (mapped->findName(key, length, row) != 0) {
+            return -1;
+        }
+        id = static_cast<ImageId>(row);
+        return 0;
+    }
+
+    if (indexedRows == numRows && !nameSlots.empty()) {
+        auto slotAt = [this](uint64_t i, NameIndexSlot &slot) {
+            slot = nameSlots[i];
+            return true;
+        };
+        auto matchAt = [this, key, length](size_t i) {
+            return matchName(name(static_cast<ImageId>(i)), key, length);
+        };
+        if (lookupNameIndex(slotAt, nameBits, matchAt, numRows, key, length, row) != 0) {
+            return -1;
+        }
+        id = static_cast<ImageId>(row);
+        return 0;
+    }
+
+    // The first exact match, or else the first file name match
+    long baseRow = -1;
+    for (size_t i = 0; i < numRows; i++) {
+        int match = matchName(name(static_cast<ImageId>(i)), key, length);
+        if (match == NAME_EXACT_MATCH) {
+            id = static_cast<ImageId>(i);
+            return 0;
+        }
+        if (match == NAME_BASE_MATCH && baseRow < 0) {
+            baseRow = static_cast<long>(i);
+        }
+    }
+
+    if (baseRow < 0) {
+        return -1;
+    }
+    id = static_cast<ImageId>(baseRow);
+    return 0;
+}
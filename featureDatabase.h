@@ -0,0 +1,187 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for the in-memory feature database used by the
+    loaders and scan loops.
+
+    All feature vectors live in one row-major float block. Every row starts
+    on a 64-byte boundary and is zero padded from dim() to stride() values,
+    the same layout as a binary feature store, so a binary store is used in
+    place from its memory mapping and a CSV is parsed straight into the block.
+    Image names are kept in one string arena and rows are addressed by
+    integer image IDs (row indices).
+*/
+
+#ifndef FEATUREDATABASE_H
+#define FEATUREDATABASE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "featureStore.h"
+
+// Row index of an image in a feature database
+typedef uint32_t ImageId;
+
+/*
+    Feature vectors and image names of a feature file
+*/
+class FeatureDatabase {
+public:
+    FeatureDatabase() = default;
+    ~FeatureDatabase();
+
+    FeatureDatabase(const FeatureDatabase &) = delete;
+    FeatureDatabase &operator=(const FeatureDatabase &) = delete;
+
+    /*
+        Loads a feature file, either a CSV or a binary feature store (found
+        from its magic bytes). A binary store is memory mapped, not copied.
+
+        Parameters:
+            path: feature file
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int load(const std::string &path);
+
+    // Removes every row and releases the storage
+    void clear();
+
+    /*
+        Sets the dimension of an empty database and reserves room for rows
+
+        Parameters:
+            rows: number of rows to reserve
+            dim: features per row
+    */
+    void reserve(size_t rows, int dim);
+
+    /*
+        Appends a row, the first row fixes the dimension if reserve() was not called
+
+        Parameters:
+            name: image name
+            nameLength: length of the name
+            values: feature values
+            count: number of values, must equal dim()
+
+        Returns:
+            ID of the new row
+            -1 if the count does not match or the database is a mapped store
+    */
+    long addRow(const char *name, size_t nameLength, const float *values, size_t count);
+
+    size_t size() const { return numRows; }
+    int dim() const { return numDims; }
+    int stride() const { return rowStride; }
+
+    // Element type of the rows, quantized types only come from binary stores
+    int dtype() const { return mapped ? mapped->dtype() : FEATURE_STORE_FLOAT32; }
+    uint32_t quantTotal() const { return mapped ? mapped->quantTotal() : 0; }
+
+    // True if the rows are sparse store records, only reached through sparseRow and copyRow
+    bool sparse() const { return mapped && mapped->sparse(); }
+
+    // Features of an image in a float32 database, stride() values of which the first dim() are used
+    const float *row(ImageId id) const { return matrix + static_cast<size_t>(id) * rowStride; }
+
+    // Quantized bins of an image in a uint8 or uint16 database
+    const uint8_t *rowU8(ImageId id) const { return static_cast<const uint8_t *>(mapped->rowData(id)); }
+    const uint16_t *rowU16(ImageId id) const { return static_cast<const uint16_t *>(mapped->rowData(id)); }
+
+    /*
+        Row of an image in a sparse database, T must match dtype()
+
+        Parameters:
+            id: image ID
+            row: output nonzero bins of a sparse row
+            dense: output dim() values of a dense row
+
+        Returns:
+            true if the row is sparse, false if it is dense
+    */
+    template <typename T>
+    bool sparseRow(ImageId id, SparseHistogram<T> &row, const T *&dense) const {
+        return mapped->sparseRow(id, row, dense);
+    }
+
+    /*
+        Copies the features of an image as floats, dequantizing quantized rows
+
+        Parameters:
+            id: image ID
+            out: output, dim() values
+    */
+    void copyRow(ImageId id, float *out) const;
+
+    /*
+        L2 norm of every row of a float32 database, read from the binary store
+        when it keeps them and computed on the first call otherwise
+
+        Returns:
+            size() norms, valid until the database changes
+    */
+    const float *norms() const;
+
+    // Name of an image
+    const char *name(ImageId id) const {
+        return mapped ? mapped->name(id) : names.data() + nameOffsets[id];
+    }
+
+    /*
+        Indexes the names in memory, for owned rows and binary stores without
+        a name index. load() calls it, call it again after adding rows. Past
+        NAME_INDEX_MAX_ROWS rows nothing is indexed and findName compares every name.
+    */
+    void indexNames();
+
+    /*
+        Finds an image by name or file name, see lookupNameIndex. Uses the
+        name index of the binary store or the one built by indexNames(), and
+        compares every name if rows were added since.
+
+        Parameters:
+            key: image name or file name
+            length: length of the key
+            id: output image ID
+
+        Returns:
+            0 if the image was found
+            -1 otherwise
+    */
+    int findName(const char *key, size_t length, ImageId &id) const;
+
+    // Decode scale recorded in a binary store, 0 if the file does not record one
+    int decodeScale() const { return mapped ? mapped->decodeScale() : 0; }
+
+    // Segments the rows are compared by, recorded in a binary store or set with setLayout(), empty if unknown
+    const FeatureLayout &featureLayout() const { return mapped ? mapped->featureLayout() : layout; }
+
+    // Sets the layout of owned rows
+    void setLayout(const FeatureLayout &layout) { this->layout = layout; }
+
+private:
+    std::unique_ptr<FeatureStore> mapped;  // binary store the rows point into
+    float *block = nullptr;                // owned rows when not mapped
+    size_t capacity = 0;                   // rows the owned block can hold
+    const float *matrix = nullptr;
+    size_t numRows = 0;
+    int numDims = 0;
+    int rowStride = 0;
+    std::string names;                     // '\0' terminated names of owned rows
+    std::vector<uint64_t> nameOffsets;     // start of each name in names
+    mutable std::vector<float> rowNorms;   // norms computed by norms()
+    std::vector<NameIndexSlot> nameSlots;  // name index built by indexNames()
+    uint32_t nameBits = 0;
+    size_t indexedRows = 0;                // rows in nameSlots
+    FeatureLayout layout;                  // layout of owned rows
+
+    void grow(size_t rows);
+};
+
+#endif
@@ -0,0 +1,197 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Feature layouts, the segments a feature vector is compared by.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include "featureLayout.h"
+#include "quantize.h"
+
+/*
+    Layout matchImage compares the features of a method by
+
+    Parameters:
+        featureMethod: baseline, chistogram, mhistogram, texture, face or resnet
+        dim: features per row
+        layout: output layout
+
+    Returns:
+        0 on success
+        -1 if the method is unknown or its features do not split at this dimension
+*/
+int methodLayout(const std::string &featureMethod, int dim, FeatureLayout &layout) {
+    layout.clear();
+    if (dim <= 0) {
+        return -1;
+    }
+
+    if (featureMethod == "baseline" || featureMethod == "resnet") {
+        layout.push_back({0, static_cast<uint32_t>(dim), SEGMENT_L2, 1.0f});
+        return 0;
+    }
+
+    // Histogram methods weigh their histograms as the dense distance functions do
+    std::vector<int> segments;
+    std::vector<float> weights;
+    if (featureMethod == "chistogram") {
+        weights = {1.0f};
+    }
+    else if (featureMethod == "mhistogram") {
+        weights = {0.5f, 1.0f - 0.5f};
+    }
+    else if (featureMethod == "texture") {
+        weights = {0.4f, 1.0f - 0.4f};
+    }
+    else if (featureMethod == "face") {
+        weights = {0.2f, 0.6f, 0.2f};
+    }
+    if (weights.empty() || histogramSegments(featureMethod, dim, segments) != 0 ||
+        segments.size() != weights.size()) {
+        return -1;
+    }
+
+    uint32_t offset = 0;
+    for (size_t h = 0; h < segments.size(); h++) {
+        layout.push_back({offset, static_cast<uint32_t>(segments[h]), SEGMENT_INTERSECTION, weights[h]});
+        offset += segments[h];
+    }
+    return 0;
+}
+
+/*
+    Check that every segment lies inside the features and has a known metric
+
+    Parameters:
+        layout: layout to check
+        dim: features per row
+
+    Returns:
+        0 if the layout is valid
+        -1 otherwise
+*/
+int checkLayout(const FeatureLayout &layout, int dim) {
+    if (layout.empty() || layout.size() > LAYOUT_MAX_SEGMENTS) {
+        return -1;
+    }
+
+    for (const FeatureSegment &segment : layout) {
+        if (segment.length == 0 || segment.offset > static_cast<uint32_t>(dim) ||
+            segment.length > static_cast<uint32_t>(dim) - segment.offset || segment.metric > SEGMENT_COSINE) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Parse a layout given as comma separated offset:length:metric:weight
+    segments, for example 0:512:l2:0.01,512:256:intersection:0.5
+
+    Parameters:
+        spec: layout text
+        layout: output layout
+
+    Returns:
+        0 on success
+        -1 on a syntax error
+*/
+int parseLayout(const std::string &spec, FeatureLayout &layout) {
+    layout.clear();
+    std::stringstream segments(spec);
+    std::string text;
+    while (std::getline(segments, text, ',')) {
+        std::stringstream fields(text);
+        std::string offset, length, metric, weight;
+        if (!std::getline(fields, offset, ':') || !std::getline(fields, length, ':') ||
+            !std::getline(fields, metric, ':') || !std::getline(fields, weight)) {
+            printf("Error, layout segment %s is not offset:length:metric:weight\n", text.c_str());
+            return -1;
+        }
+
+        char *end;
+        FeatureSegment segment;
+        segment.offset = static_cast<uint32_t>(strtoul(offset.c_str(), &end, 10));
+        bool valid = !offset.empty() && *end == '\0';
+        segment.length = static_cast<uint32_t>(strtoul(length.c_str(), &end, 10));
+        valid = valid && !length.empty() && *end == '\0';
+        segment.weight = strtof(weight.c_str(), &end);
+        valid = valid && !weight.empty() && *end == '\0';
+
+        if (metric == "intersection") {
+            segment.metric = SEGMENT_INTERSECTION;
+        }
+        else if (metric == "l2") {
+            segment.metric = SEGMENT_L2;
+        }
+        else if (metric == "cosine") {
+            segment.metric = SEGMENT_COSINE;
+        }
+        else {
+            valid = false;
+        }
+
+        if (!valid) {
+            printf("Error, invalid layout segment %s, metrics are intersection, l2 and cosine\n", text.c_str());
+            return -1;
+        }
+        layout.push_back(segment);
+    }
+
+    if (layout.empty()) {
+        printf("Error, empty layout\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Histograms of a layout made only of intersection segments that follow
+    each other from feature 0, as quantized and sparse rows need
+
+    Parameters:
+        layout: layout
+        ends: output end feature of each histogram
+        weights: output weight of each histogram
+
+    Returns:
+        true if the layout is such a list of histograms
+*/
+bool histogramLayout(const FeatureLayout &layout, std::vector<int> &ends, std::vector<float> &weights) {
+    ends.clear();
+    weights.clear();
+    for (const FeatureSegment &segment : layout) {
+        if (segment.metric != SEGMENT_INTERSECTION || segment.offset != (ends.empty() ? 0u : ends.back())) {
+            return false;
+        }
+        ends.push_back(static_cast<int>(segment.offset + segment.length));
+        weights.push_back(segment.weight);
+    }
+    return !ends.empty();
+}
+
+/*
+    Check if two layouts have the same segments in the same order
+
+    Parameters:
+        a: layout 1
+        b: layout 2
+
+    Returns:
+        true if the layouts are equal
+*/
+bool sameLayout(const FeatureLayout &a, const FeatureLayout &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (size_t s = 0; s < a.size(); s++) {
+        if (a[s].offset != b[s].offset || a[s].length != b[s].length || a[s].metric != b[s].metric ||
+            a[s].weight != b[s].weight) {
+            return false;
+        }
+    }
+    return true;
+}
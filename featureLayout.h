@@ -0,0 +1,113 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for feature layouts, the segments a feature vector is compared by.
+
+    A layout splits a feature vector into segments, each with its own metric
+    and weight, and the distance of two vectors is the weighted sum of the
+    segment distances, added in segment order:
+        intersection    1 - sum of min(a[i], b[i]), for histograms summing to 1
+        l2              euclidean distance
+        cosine          1 - cosine similarity, 1 if either segment is all zero
+    The histogram methods are intersection layouts (mhistogram: whole and
+    center histograms weighted 0.5 and 0.5), baseline and resnet one l2
+    segment. A binary store keeps the layout of its rows next to the matrix,
+    so a new composite feature only needs a layout, not new distance code.
+*/
+
+#ifndef FEATURELAYOUT_H
+#define FEATURELAYOUT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Segment metrics
+#define SEGMENT_INTERSECTION 0
+#define SEGMENT_L2 1
+#define SEGMENT_COSINE 2
+
+// Most segments a layout may have
+#define LAYOUT_MAX_SEGMENTS 64
+
+// One segment of a layout, also the on-disk record of a binary store
+struct FeatureSegment {
+    uint32_t offset;    // first feature of the segment
+    uint32_t length;    // number of features
+    uint32_t metric;    // SEGMENT_INTERSECTION, _L2 or _COSINE
+    float weight;       // weight of the segment distance
+};
+
+static_assert(sizeof(FeatureSegment) == 16, "feature segment must be 16 bytes");
+
+// Segments of a feature vector, in the order their distances are added
+typedef std::vector<FeatureSegment> FeatureLayout;
+
+/*
+    Layout matchImage compares the features of a method by
+
+    Parameters:
+        featureMethod: baseline, chistogram, mhistogram, texture, face or resnet
+        dim: features per row
+        layout: output layout
+
+    Returns:
+        0 on success
+        -1 if the method is unknown or its features do not split at this dimension
+*/
+int methodLayout(const std::string &featureMethod, int dim, FeatureLayout &layout);
+
+/*
+    Check that every segment lies inside the features and has a known metric
+
+    Parameters:
+        layout: layout to check
+        dim: features per row
+
+    Returns:
+        0 if the layout is valid
+        -1 otherwise
+*/
+int checkLayout(const FeatureLayout &layout, int dim);
+
+/*
+    Parse a layout given as comma separated offset:length:metric:weight
+    segments, for example 0:512:l2:0.01,512:256:intersection:0.5
+
+    Parameters:
+        spec: layout text
+        layout: output layout
+
+    Returns:
+        0 on success
+        -1 on a syntax error
+*/
+int parseLayout(const std::string &spec, FeatureLayout &layout);
+
+/*
+    Histograms of a layout made only of intersection segments that follow
+    each other from feature 0, as quantized and sparse rows need
+
+    Parameters:
+        layout: layout
+        ends: output end feature of each histogram
+        weights: output weight of each histogram
+
+    Returns:
+        true if the layout is such a list of histograms
+*/
+bool histogramLayout(const FeatureLayout &layout, std::vector<int> &ends, std::vector<float> &weights);
+
+/*
+    Check if two layouts have the same segments in the same order
+
+    Parameters:
+        a: layout 1
+        b: layout 2
+
+    Returns:
+        true if the layouts are equal
+*/
+bool sameLayout(const FeatureLayout &a, const FeatureLayout &b);
+
+#endif
@@ -0,0 +1,736 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Naming and locating feature stores written by buildFeatures,
+    and reading and writing binary feature stores.
+*/
+
+#include "featureStore.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include "distanceFunctions.h"
+#include "quantize.h"
+
+// Define filesystem
+namespace fs = std::filesystem;
+
+/*
+    Feature methods buildFeatures can extract, in the order "all" runs them
+
+    Returns:
+        list of method names
+*/
+const std::vector<std::string> &buildMethods() {
+    static const std::vector<std::string> methods = {"baseline", "chistogram", "mhistogram", "texture", "face"};
+    return methods;
+}
+
+/*
+    Check if a feature method name is supported by buildFeatures
+
+    Parameters:
+        featureMethod: feature method name
+
+    Returns:
+        true if the method is valid
+*/
+bool validFeatureMethod(const std::string &featureMethod) {
+    const std::vector<std::string> &methods = buildMethods();
+    return std::find(methods.begin(), methods.end(), featureMethod) != methods.end();
+}
+
+/*
+    Output store path for a method.
+
+    Parameters:
+        output: output path given on the command line
+        method: feature method name
+        multiMethod: true if more than one method is being written
+
+    Returns:
+        output path for the method
+*/
+std::string storePath(const std::string &output, const std::string &method, bool multiMethod) {
+    if (!multiMethod) {
+        return output;
+    }
+
+    fs::path path(output);
+    fs::path methodPath = path.parent_path() / (path.stem().string() + "_" + method + path.extension().string());
+    return methodPath.string();
+}
+
+/*
+    Round a byte count up to a multiple of an alignment
+
+    Parameters:
+        value: byte count
+        alignment: power of two alignment
+
+    Returns:
+        aligned byte count
+*/
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+/*
+    Check that a store header is supported and that every section it
+    describes lies inside the file
+
+    Parameters:
+        header: store header
+        size: size of the file
+        path: store path for error messages
+
+    Returns:
+        0 if the header is valid
+        -1 otherwise
+*/
+int checkFeatureStoreHeader(const FeatureStoreHeader &header, uint64_t size, const std::string &path) {
+    if (memcmp(header.magic, FEATURE_STORE_MAGIC, sizeof(header.magic)) != 0) {
+        printf("Error, %s is not a feature store\n", path.c_str());
+        return -1;
+    }
+    if (header.version != FEATURE_STORE_VERSION || featureStoreElementSize(header.dtype) == 0 ||
+        (header.dtype != FEATURE_STORE_FLOAT32 && header.quantTotal == 0) || header.layout > FEATURE_STORE_SPARSE) {
+        printf("Error, %s has an unsupported feature store version\n", path.c_str());
+        return -1;
+    }
+
+    // Sizes are checked without overflow
+    bool sparseLayout = header.layout == FEATURE_STORE_SPARSE;
+    uint64_t rowBytes = static_cast<uint64_t>(header.stride) * featureStoreElementSize(header.dtype);
+    bool valid = header.headerSize >= sizeof(header) && header.dim <= header.stride &&
+                 header.dataOffset % FEATURE_STORE_ALIGN == 0 && header.dataOffset <= size &&
+                 (sparseLayout || rowBytes == 0 || header.rows <= (size - header.dataOffset) / rowBytes) &&
+                 header.namesOffset % sizeof(uint64_t) == 0 && header.namesOffset <= size &&
+                 header.namesSize <= size - header.namesOffset && header.rows < header.namesSize / sizeof(uint64_t);
+
+    // The row index of a sparse store follows the matrix
+    if (sparseLayout) {
+        valid = valid && header.dim <= SPARSE_MAX_DIM && header.rowIndexOffset % sizeof(uint64_t) == 0 &&
+                header.rowIndexOffset >= header.dataOffset && header.rowIndexOffset <= size &&
+                header.rows < (size - header.rowIndexOffset) / sizeof(uint64_t);
+    }
+
+    // Row norms are only kept by dense float32 stores
+    if (header.normsOffset != 0) {
+        valid = valid && !sparseLayout && header.dtype == FEATURE_STORE_FLOAT32 &&
+                header.normsOffset % sizeof(float) == 0 && header.normsOffset <= size &&
+                header.rows <= (size - header.normsOffset) / sizeof(float);
+    }
+
+    // The layout is a short array of segments
+    if (header.segmentCount != 0) {
+        valid = valid && header.segmentCount <= LAYOUT_MAX_SEGMENTS &&
+                header.segmentsOffset % sizeof(uint32_t) == 0 && header.segmentsOffset <= size &&
+                header.segmentCount <= (size - header.segmentsOffset) / sizeof(FeatureSegment);
+    }
+
+    // The name index is a power of two table of slots
+    if (header.nameIndexBits != 0) {
+        valid = valid && header.nameIndexBits <= NAME_INDEX_MAX_BITS && header.rows <= NAME_INDEX_MAX_ROWS &&
+                header.nameIndexOffset % sizeof(uint64_t) == 0 && header.nameIndexOffset <= size &&
+                (static_cast<uint64_t>(1) << header.nameIndexBits) <=
+                    (size - header.nameIndexOffset) / sizeof(NameIndexSlot);
+    }
+
+    if (!valid) {
+        printf("Error, feature store %s is truncated or corrupt\n", path.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Check that the records of consecutive rows of a sparse store lie inside
+    the bytes read for them. Bin indices are not checked here, the readers
+    ignore bins past the dimension.
+
+    Parameters:
+        offsets: rows + 1 record offsets, offsets[0] is the record at matrix
+        rows: number of rows
+        matrix: records of the rows
+        matrixSize: bytes available at matrix
+        dim: features per row
+        dtype: element type
+
+    Returns:
+        0 if the records are valid
+        -1 otherwise
+*/
+int checkSparseRecords(const uint64_t *offsets, size_t rows, const char *matrix, uint64_t matrixSize, uint32_t dim,
+                       int dtype) {
+    size_t elementSize = featureStoreElementSize(dtype);
+    if (offsets[rows] < offsets[0] || offsets[rows] - offsets[0] > matrixSize) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < rows; i++) {
+        uint64_t length = offsets[i + 1] - offsets[i];
+        if (offsets[i + 1] < offsets[i] || offsets[i] % sizeof(uint32_t) != 0 || length < sizeof(uint32_t)) {
+            return -1;
+        }
+
+        uint32_t count;
+        memcpy(&count, matrix + (offsets[i] - offsets[0]), sizeof(count));
+        uint64_t needed = count == FEATURE_STORE_DENSE_ROW
+                              ? sizeof(uint32_t) + static_cast<uint64_t>(dim) * elementSize
+                              : (count <= dim ? sparseValuesOffset(count, elementSize) + count * elementSize
+                                              : UINT64_MAX);
+        if (needed > length) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Maps a binary feature store and validates its header
+
+    Parameters:
+        path: store path
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int FeatureStore::open(const std::string &path) {
+    if (file.open(path) != 0) {
+        printf("Unable to open feature store %s\n", path.c_str());
+        return -1;
+    }
+
+    const char *base = file.data();
+    uint64_t size = file.size();
+
+    FeatureStoreHeader header;
+    if (size < sizeof(header)) {
+        printf("Error, %s is not a feature store\n", path.c_str());
+        return -1;
+    }
+    memcpy(&header, base, sizeof(header));
+
+    if (checkFeatureStoreHeader(header, size, path) != 0) {
+        return -1;
+    }
+
+    rowBytes = static_cast<size_t>(header.stride) * featureStoreElementSize(header.dtype);
+    nameOffsets = reinterpret_cast<const uint64_t *>(base + header.namesOffset);
+    names = base + header.namesOffset + (header.rows + 1) * sizeof(uint64_t);
+    namesLength = header.namesSize - (header.rows + 1) * sizeof(uint64_t);
+
+    // The names end with a '\0', so any in-range offset gives a terminated string
+    if (nameOffsets[header.rows] != namesLength || (namesLength > 0 && names[namesLength - 1] != '\0')) {
+        printf("Error, feature store %s has a corrupt name table\n", path.c_str());
+        return -1;
+    }
+
+    // Sparse records are checked once here so the accessors can trust the row index
+    matrix = base + header.dataOffset;
+    rowIndex = nullptr;
+    if (header.layout == FEATURE_STORE_SPARSE) {
+        const uint64_t *offsets = reinterpret_cast<const uint64_t *>(base + header.rowIndexOffset);
+        if (offsets[0] != 0 || checkSparseRecords(offsets, header.rows, matrix, header.rowIndexOffset - header.dataOffset,
+                                                  header.dim, header.dtype) != 0) {
+            printf("Error, feature store %s has a corrupt row index\n", path.c_str());
+            return -1;
+        }
+        rowIndex = offsets;
+    }
+    rowNorms = header.normsOffset != 0 ? reinterpret_cast<const float *>(base + header.normsOffset) : nullptr;
+    nameSlots = header.nameIndexBits != 0 ? reinterpret_cast<const NameIndexSlot *>(base + header.nameIndexOffset)
+                                          : nullptr;
+    nameBits = header.nameIndexBits;
+
+    const FeatureSegment *segments = reinterpret_cast<const FeatureSegment *>(base + header.segmentsOffset);
+    layout.assign(segments, segments + header.segmentCount);
+    if (!layout.empty() && checkLayout(layout, static_cast<int>(header.dim)) != 0) {
+        printf("Error, feature store %s has a corrupt feature layout\n", path.c_str());
+        return -1;
+    }
+
+    elementType = static_cast<int>(header.dtype);
+    total = header.quantTotal;
+    numRows = static_cast<size_t>(header.rows);
+    numDims = static_cast<int>(header.dim);
+    rowStride = static_cast<int>(header.stride);
+    scale = header.decodeScale;
+    featureMethod.assign(header.method, strnlen(header.method, sizeof(header.method)));
+
+    return 0;
+}
+
+/*
+    Image name of a row
+
+    Parameters:
+        i: row index
+
+    Returns:
+        name of the image, "" if the name table entry is out of range
+*/
+const char *FeatureStore::name(size_t i) const {
+    uint64_t offset = nameOffsets[i];
+    return offset < namesLength ? names + offset : "";
+}
+
+/*
+    Finds a row by image name with the name index of the store, see lookupNameIndex
+
+    Parameters:
+        key: image name or file name
+        length: length of the key
+        row: output row
+
+    Returns:
+        0 if the image was found
+        -1 otherwise, or if the store has no name index
+*/
+int FeatureStore::findName(const char *key, size_t length, size_t &row) const {
+    if (!nameSlots) {
+        return -1;
+    }
+
+    return lookupNameIndex(
+        [this](uint64_t i, NameIndexSlot &slot) {
+            slot = nameSlots[i];
+            return true;
+        },
+        nameBits, [this, key, length](size_t i) { return matchName(name(i), key, length); }, numRows, key, length,
+        row);
+}
+
+/*
+    Copies the features of a row as floats, dequantizing quantized rows
+
+    Parameters:
+        i: row index
+        out: output, dim() values
+*/
+void FeatureStore::copyRow(size_t i, float *out) const {
+    if (rowIndex) {
+        if (elementType == FEATURE_STORE_UINT8) {
+            copySparseRow<uint8_t>(*this, i, out);
+        }
+        else if (elementType == FEATURE_STORE_UINT16) {
+            copySparseRow<uint16_t>(*this, i, out);
+        }
+        else {
+            copySparseRow<float>(*this, i, out);
+        }
+    }
+    else if (elementType == FEATURE_STORE_UINT8) {
+        dequantizeHistograms(static_cast<const uint8_t *>(rowData(i)), numDims, total, out);
+    }
+    else if (elementType == FEATURE_STORE_UINT16) {
+        dequantizeHistograms(static_cast<const uint16_t *>(rowData(i)), numDims, total, out);
+    }
+    else {
+        std::copy(row(i), row(i) + numDims, out);
+    }
+}
+
+FeatureStoreWriter::~FeatureStoreWriter() {
+    if (fp) {
+        fclose(fp);
+    }
+}
+
+/*
+    Creates a store, replacing any existing file
+
+    Parameters:
+        path: store path
+        method: feature method recorded in the header, may be empty for float32
+        decodeScale: decode scale recorded in the header
+        dtype: element type, quantized types need a histogram method
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int FeatureStoreWriter::open(const std::string &path, const std::string &method, int decodeScale, int dtype,
+                             bool sparse) {
+    if (dtype != FEATURE_STORE_FLOAT32 && !isHistogramMethod(method)) {
+        printf("Error, %s features cannot be quantized, only histogram methods can\n",
+               method.empty() ? "unnamed" : method.c_str());
+        return -1;
+    }
+    if (sparse && !isHistogramMethod(method)) {
+        printf("Error, %s features cannot be stored sparse, only histogram methods can\n",
+               method.empty() ? "unnamed" : method.c_str());
+        return -1;
+    }
+
+    this->path = path;
+    fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        printf("Unable to open feature store %s for writing\n", path.c_str());
+        return -1;
+    }
+
+    header = FeatureStoreHeader{};
+    memcpy(header.magic, FEATURE_STORE_MAGIC, sizeof(header.magic));
+    header.version = FEATURE_STORE_VERSION;
+    header.headerSize = sizeof(header);
+    header.dataOffset = alignUp(sizeof(header), FEATURE_STORE_ALIGN);
+    header.decodeScale = decodeScale;
+    header.dtype = static_cast<uint32_t>(dtype);
+    header.quantTotal = dtype == FEATURE_STORE_UINT8 ? QUANT_TOTAL_U8 : dtype == FEATURE_STORE_UINT16 ? QUANT_TOTAL_U16 : 0;
+    header.layout = sparse ? FEATURE_STORE_SPARSE : FEATURE_STORE_DENSE;
+    strncpy(header.method, method.c_str(), sizeof(header.method) - 1);
+
+    nameOffsets.assign(1, 0);
+    rowOffsets.assign(1, 0);
+    rowNorms.clear();
+    names.clear();
+    layout.clear();
+    failed = false;
+
+    // The header is rewritten on close once the sizes are known
+    std::vector<char> zeros(header.dataOffset, 0);
+    if (fwrite(zeros.data(), 1, zeros.size(), fp) != zeros.size()) {
+        failed = true;
+    }
+
+    return failed ? -1 : 0;
+}
+
+/*
+    Encodes a row as a sparse store record, sparse if that is smaller than dense
+
+    Parameters:
+        values: row values
+        dim: number of values
+        record: output record, padded to a multiple of 4 bytes
+*/
+template <typename T>
+static void encodeRecord(const T *values, int dim, std::vector<char> &record) {
+    uint32_t count = 0;
+    for (int i = 0; i < dim; i++) {
+        count += values[i] != 0;
+    }
+
+    size_t denseBytes = sizeof(uint32_t) + dim * sizeof(T);
+    size_t sparseBytes = sparseValuesOffset(count, sizeof(T)) + count * sizeof(T);
+    if (sparseBytes >= denseBytes) {
+        count = FEATURE_STORE_DENSE_ROW;
+    }
+
+    record.assign(alignUp(std::min(denseBytes, sparseBytes), sizeof(uint32_t)), 0);
+    memcpy(record.data(), &count, sizeof(count));
+    if (count == FEATURE_STORE_DENSE_ROW) {
+        memcpy(record.data() + sizeof(uint32_t), values, dim * sizeof(T));
+        return;
+    }
+
+    uint16_t *indices = reinterpret_cast<uint16_t *>(record.data() + sizeof(uint32_t));
+    T *bins = reinterpret_cast<T *>(record.data() + sparseValuesOffset(count, sizeof(T)));
+    for (int i = 0; i < dim; i++) {
+        if (values[i] != 0) {
+            *indices++ = static_cast<uint16_t>(i);
+            *bins++ = values[i];
+        }
+    }
+}
+
+/*
+    Appends a row, the first row fixes the dimension of the store
+
+    Parameters:
+        name: image name
+        features: feature values
+        dim: number of feature values
+
+    Returns:
+        0 on success
+        -1 on error (write failure or wrong dimension)
+*/
+int FeatureStoreWriter::addRow(const std::string &name, const float *features, size_t dim) {
+    if (!fp || failed) {
+        return -1;
+    }
+
+    size_t elementSize = featureStoreElementSize(header.dtype);
+    if (header.rows == 0) {
+        std::string method(header.method);
+        if (header.dtype != FEATURE_STORE_FLOAT32 && histogramSegments(method, static_cast<int>(dim), segments) != 0) {
+            printf("Error, %zu features do not split into %s histograms\n", dim, method.c_str());
+            failed = true;
+            return -1;
+        }
+
+        if (header.layout == FEATURE_STORE_SPARSE && dim > SPARSE_MAX_DIM) {
+            printf("Error, %zu features are too many for a sparse store\n", dim);
+            failed = true;
+            return -1;
+        }
+
+        // Without an explicit layout the store records the layout of its method
+        if (layout.empty()) {
+            methodLayout(method, static_cast<int>(dim), layout);
+        }
+        else if (checkLayout(layout, static_cast<int>(dim)) != 0) {
+            printf("Error, the feature layout does not fit %zu features\n", dim);
+            failed = true;
+            return -1;
+        }
+
+        // Quantized and sparse rows are compared histogram by histogram, quantized rows by the
+        // histograms they were quantized in
+        std::vector<int> ends, quantizedEnds;
+        std::vector<float> weights;
+        for (int size : segments) {
+            quantizedEnds.push_back(quantizedEnds.empty() ? size : quantizedEnds.back() + size);
+        }
+        if ((header.dtype != FEATURE_STORE_FLOAT32 || header.layout == FEATURE_STORE_SPARSE) &&
+            (!histogramLayout(layout, ends, weights) || ends.back() != static_cast<int>(dim) ||
+             (header.dtype != FEATURE_STORE_FLOAT32 && ends != quantizedEnds))) {
+            printf("Error, quantized and sparse stores need a layout of their %s histograms\n", method.c_str());
+            failed = true;
+            return -1;
+        }
+
+        header.dim = static_cast<uint32_t>(dim);
+        header.stride = static_cast<uint32_t>(alignUp(dim, FEATURE_STORE_ALIGN / elementSize));
+        padded.assign(header.stride * elementSize, 0);
+    }
+    else if (dim != header.dim) {
+        printf("Error, %s has %zu features, %s expects %u\n", name.c_str(), dim, path.c_str(), header.dim);
+        failed = true;
+        return -1;
+    }
+
+    if (header.dtype == FEATURE_STORE_UINT8) {
+        quantizeHistograms(features, segments, header.quantTotal, reinterpret_cast<uint8_t *>(padded.data()));
+    }
+    else if (header.dtype == FEATURE_STORE_UINT16) {
+        quantizeHistograms(features, segments, header.quantTotal, reinterpret_cast<uint16_t *>(padded.data()));
+    }
+    else {
+        memcpy(padded.data(), features, dim * sizeof(float));
+    }
+
+    // Sparse stores write a record of the quantized or float row
+    const std::vector<char> *out = &padded;
+    if (header.layout == FEATURE_STORE_SPARSE) {
+        if (header.dtype == FEATURE_STORE_UINT8) {
+            encodeRecord(reinterpret_cast<const uint8_t *>(padded.data()), header.dim, record);
+        }
+        else if (header.dtype == FEATURE_STORE_UINT16) {
+            encodeRecord(reinterpret_cast<const uint16_t *>(padded.data()), header.dim, record);
+        }
+        else {
+            encodeRecord(reinterpret_cast<const float *>(padded.data()), header.dim, record);
+        }
+        out = &record;
+    }
+
+    if (fwrite(out->data(), 1, out->size(), fp) != out->size()) {
+        printf("Error writing feature store %s\n", path.c_str());
+        failed = true;
+        return -1;
+    }
+
+    if (header.dtype == FEATURE_STORE_FLOAT32 && header.layout == FEATURE_STORE_DENSE) {
+        rowNorms.push_back(l2Norm(features, static_cast<int>(dim)));
+    }
+
+    names.append(name);
+    names.push_back('\0');
+    nameOffsets.push_back(names.size());
+    rowOffsets.push_back(rowOffsets.back() + out->size());
+    header.rows++;
+
+    return 0;
+}
+
+/*
+    Sets the feature layout recorded in the store, before the first row.
+    Without one the store records the layout of its method, if it has one.
+
+    Parameters:
+        layout: segments the rows are compared by
+
+    Returns:
+        0 on success
+        -1 if rows were already added
+*/
+int FeatureStoreWriter::setLayout(const FeatureLayout &layout) {
+    if (header.rows != 0 || layout.size() > LAYOUT_MAX_SEGMENTS) {
+        printf("Error, the feature layout of %s cannot be changed\n", path.c_str());
+        return -1;
+    }
+
+    this->layout = layout;
+    return 0;
+}
+
+/*
+    Writes the name table and header and closes the file
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int FeatureStoreWriter::close() {
+    if (!fp) {
+        return -1;
+    }
+
+    // The name table follows the matrix, the row index of a sparse store or
+    // the row norms of a float32 store and the layout, nameOffsets[0] and rowOffsets[0] are already 0
+    static const char zeros[sizeof(uint64_t)] = {0};
+    bool sparse = header.layout == FEATURE_STORE_SPARSE;
+    uint64_t matrixEnd = header.dataOffset + (sparse ? rowOffsets.back()
+                                                     : header.rows * header.stride * featureStoreElementSize(header.dtype));
+    uint64_t tablesOffset = alignUp(matrixEnd, sizeof(uint64_t));
+    size_t padding = static_cast<size_t>(tablesOffset - matrixEnd);
+    bool ok = !failed && fwrite(zeros, 1, padding, fp) == padding;
+
+    if (sparse) {
+        header.rowIndexOffset = tablesOffset;
+        ok = ok && fwrite(rowOffsets.data(), sizeof(uint64_t), rowOffsets.size(), fp) == rowOffsets.size();
+        tablesOffset += rowOffsets.size() * sizeof(uint64_t);
+    }
+    else if (header.dtype == FEATURE_STORE_FLOAT32) {
+        header.normsOffset = tablesOffset;
+        ok = ok && fwrite(rowNorms.data(), sizeof(float), rowNorms.size(), fp) == rowNorms.size();
+        uint64_t normsEnd = tablesOffset + rowNorms.size() * sizeof(float);
+        tablesOffset = alignUp(normsEnd, sizeof(uint64_t));
+        padding = static_cast<size_t>(tablesOffset - normsEnd);
+        ok = ok && fwrite(zeros, 1, padding, fp) == padding;
+    }
+
+    // Segments are 16 bytes, so the name table stays 8-byte aligned
+    if (!layout.empty() && header.rows != 0) {
+        header.segmentsOffset = tablesOffset;
+        header.segmentCount = static_cast<uint32_t>(layout.size());
+        ok = ok && fwrite(layout.data(), sizeof(FeatureSegment), layout.size(), fp) == layout.size();
+        tablesOffset += layout.size() * sizeof(FeatureSegment);
+    }
+
+    header.namesOffset = tablesOffset;
+    header.namesSize = nameOffsets.size() * sizeof(uint64_t) + names.size();
+    ok = ok && fwrite(nameOffsets.data(), sizeof(uint64_t), nameOffsets.size(), fp) == nameOffsets.size() &&
+              fwrite(names.data(), 1, names.size(), fp) == names.size();
+
+    // The name index follows the name table, 8-byte aligned. Stores with more
+    // rows than its slots can address are written without one
+    if (header.rows != 0 && header.rows <= NAME_INDEX_MAX_ROWS) {
+        std::vector<NameIndexSlot> slots;
+        header.nameIndexBits = buildNameIndex(
+            static_cast<size_t>(header.rows), [this](size_t i) { return names.data() + nameOffsets[i]; }, slots);
+        uint64_t namesEnd = header.namesOffset + header.namesSize;
+        header.nameIndexOffset = alignUp(namesEnd, sizeof(uint64_t));
+        padding = static_cast<size_t>(header.nameIndexOffset - namesEnd);
+        ok = ok && fwrite(zeros, 1, padding, fp) == padding &&
+                  fwrite(slots.data(), sizeof(NameIndexSlot), slots.size(), fp) == slots.size();
+    }
+
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    fp = nullptr;
+
+    if (!ok) {
+        printf("Error writing feature store %s\n", path.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Check if an output path names a binary feature store (.fst extension)
+
+    Parameters:
+        path: store path
+
+    Returns:
+        true for a binary store
+*/
+bool isBinaryStorePath(const std::string &path) {
+    return fs::path(path).extension() == ".fst";
+}
+
+/*
+    Check if an existing file is a binary feature store, from its magic bytes
+
+    Parameters:
+        path: file path
+
+    Returns:
+        true for a binary store
+*/
+bool isFeatureStoreFile(const std::string &path) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    char magic[8];
+    bool isStore = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+                   memcmp(magic, FEATURE_STORE_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return isStore;
+}
+
+/*
+    Size of one value of a store element type
+
+    Parameters:
+        dtype: FEATURE_STORE_FLOAT32, _UINT8 or _UINT16
+
+    Returns:
+        size in bytes, 0 for an unknown type
+*/
+size_t featureStoreElementSize(int dtype) {
+    switch (dtype) {
+        case FEATURE_STORE_FLOAT32:
+            return sizeof(float);
+        case FEATURE_STORE_UINT8:
+            return sizeof(uint8_t);
+        case FEATURE_STORE_UINT16:
+            return sizeof(uint16_t);
+        default:
+            return 0;
+    }
+}
+
+/*
+    Parse a --quantize option value
+
+    Parameters:
+        name: "u8", "u16" or "none"
+        dtype: output element type
+
+    Returns:
+        0 on success
+        -1 if the name is not known
+*/
+int parseQuantization(const std::string &name, int &dtype) {
+    if (name == "u8") {
+        dtype = FEATURE_STORE_UINT8;
+    }
+    else if (name == "u16") {
+        dtype = FEATURE_STORE_UINT16;
+    }
+    else if (name == "none") {
+        dtype = FEATURE_STORE_FLOAT32;
+    }
+    else {
+        printf("Error, quantization must be u8, u16 or none!\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,476 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for naming and locating feature stores written by buildFeatures,
+    and for the binary feature store format.
+
+    A binary feature store (.fst) holds the same rows as a feature CSV, laid out
+    so it can be memory mapped and used in place:
+        header        FeatureStoreHeader, 256 bytes
+        matrix        rows x stride values at dataOffset, each row starts on a
+                      64-byte boundary and is zero padded from dim to stride.
+                      Values are float32, or for histogram methods optionally
+                      uint8/uint16 quantized bins (see quantize.h)
+        name table    rows + 1 uint64 offsets at namesOffset, followed by the
+                      '\0' terminated image names the offsets point into
+
+    A sparse store (layout FEATURE_STORE_SPARSE, histogram methods only) holds
+    one variable length record per row instead of a fixed stride. A record
+    starts on a 4-byte boundary with a uint32 count and is either
+        count uint16 bin indices in ascending order, padding to the element
+        size and the values of those count nonzero bins (see sparseHistogram.h)
+    or, when count is FEATURE_STORE_DENSE_ROW, the dim values of a dense row.
+    The writer picks whichever is smaller for each row, so a row is sparse
+    while it is less than 2/3 (float32), 1/2 (uint16) or 1/3 (uint8) full.
+    rows + 1 uint64 record offsets from dataOffset are kept at rowIndexOffset.
+
+    A dense float32 store also keeps the L2 norm of every row, rows floats at
+    normsOffset after the matrix, so cosine scans do not recompute them.
+    Stores written before the norms were added have normsOffset 0.
+
+    Every store written now also keeps its feature layout (see featureLayout.h),
+    segmentCount FeatureSegment records at segmentsOffset, before the name
+    table. Older stores have segmentCount 0 and are compared by the layout of
+    their method.
+
+    Stores also keep a hash index from image names and file names to rows
+    (see nameIndex.h), 2^nameIndexBits 8-byte slots at nameIndexOffset after
+    the name table, so a target is found without reading the names. Older
+    stores have nameIndexBits 0 and are indexed in memory when loaded, stores
+    of more than NAME_INDEX_MAX_ROWS rows have none either.
+
+    All values are stored in the byte order of the machine that wrote them
+    (little-endian on every platform the project builds on).
+*/
+
+#ifndef FEATURESTORE_H
+#define FEATURESTORE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "featureLayout.h"
+#include "mappedFile.h"
+#include "nameIndex.h"
+#include "sparseHistogram.h"
+
+// Binary feature store identification
+#define FEATURE_STORE_MAGIC "CBIRFST1"
+#define FEATURE_STORE_VERSION 1
+
+// Alignment of the feature matrix and of every row, in bytes
+#define FEATURE_STORE_ALIGN 64
+
+// Element types of the feature matrix
+#define FEATURE_STORE_FLOAT32 0
+#define FEATURE_STORE_UINT8 1
+#define FEATURE_STORE_UINT16 2
+
+// Matrix layouts
+#define FEATURE_STORE_DENSE 0
+#define FEATURE_STORE_SPARSE 1
+
+// Count of a dense row in a sparse store
+#define FEATURE_STORE_DENSE_ROW 0xFFFFFFFFu
+
+// On-disk header of a binary feature store
+struct FeatureStoreHeader {
+    char magic[8];          // FEATURE_STORE_MAGIC, not '\0' terminated
+    uint32_t version;       // FEATURE_STORE_VERSION
+    uint32_t headerSize;    // sizeof(FeatureStoreHeader)
+    uint64_t rows;          // number of images
+    uint32_t dim;           // features per row
+    uint32_t stride;        // values per row including padding
+    uint64_t dataOffset;    // byte offset of the matrix
+    uint64_t namesOffset;   // byte offset of the name table
+    uint64_t namesSize;     // byte length of the name table
+    int32_t decodeScale;    // decode scale the features were extracted at
+    uint32_t dtype;         // element type, FEATURE_STORE_FLOAT32, _UINT8 or _UINT16
+    char method[32];        // feature method, '\0' terminated, empty if unknown
+    uint32_t quantTotal;    // total of every quantized histogram, 0 for float32
+    uint32_t layout;        // FEATURE_STORE_DENSE or FEATURE_STORE_SPARSE
+    uint64_t rowIndexOffset;  // byte offset of the record offsets of a sparse store, 0 if dense
+    uint64_t normsOffset;   // byte offset of the row norms of a dense float32 store, 0 if none
+    uint64_t segmentsOffset;  // byte offset of the feature layout, 0 if none
+    uint32_t segmentCount;  // number of layout segments, 0 if none
+    uint32_t nameIndexBits;   // the name index has 2^nameIndexBits slots, 0 if none
+    uint64_t nameIndexOffset; // byte offset of the name index, 0 if none
+    uint8_t reserved[112];  // zero
+};
+
+static_assert(sizeof(FeatureStoreHeader) == 256, "feature store header must be 256 bytes");
+
+/*
+    Byte offset of the values in a sparse row record
+
+    Parameters:
+        count: number of nonzero bins
+        elementSize: size of one value
+
+    Returns:
+        offset from the start of the record
+*/
+inline size_t sparseValuesOffset(uint32_t count, size_t elementSize) {
+    size_t offset = sizeof(uint32_t) + count * sizeof(uint16_t);
+    return (offset + elementSize - 1) / elementSize * elementSize;
+}
+
+// Value of a stored bin as a float, quantized bins as fractions of the total
+template <typename T>
+inline float binValue(T bin, uint32_t total) {
+    return static_cast<float>(static_cast<double>(bin) / total);
+}
+
+inline float binValue(float value, uint32_t) {
+    return value;
+}
+
+/*
+    Copies a row of a sparse store or chunk as floats
+
+    Parameters:
+        rows: sparse store or chunk, with dim(), quantTotal() and sparseRow()
+        i: row index
+        out: output, dim() values
+*/
+template <typename T, typename Rows>
+void copySparseRow(const Rows &rows, size_t i, float *out) {
+    SparseHistogram<T> row;
+    const T *dense = nullptr;
+    int dim = rows.dim();
+    if (!rows.sparseRow(i, row, dense)) {
+        for (int j = 0; j < dim; j++) {
+            out[j] = binValue(dense[j], rows.quantTotal());
+        }
+        return;
+    }
+
+    std::fill(out, out + dim, 0.0f);
+    for (uint32_t k = 0; k < row.count; k++) {
+        if (row.indices[k] < dim) {
+            out[row.indices[k]] = binValue(row.values[k], rows.quantTotal());
+        }
+    }
+}
+
+/*
+    Read-only view of a binary feature store. Opening maps the file and checks
+    the header, so it takes the same time for any store size; rows and names
+    point straight into the mapping.
+*/
+class FeatureStore {
+public:
+    /*
+        Maps a binary feature store and validates its header
+
+        Parameters:
+            path: store path
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int open(const std::string &path);
+
+    size_t rows() const { return numRows; }
+    int dim() const { return numDims; }
+    int stride() const { return rowStride; }
+    int decodeScale() const { return scale; }
+    int dtype() const { return elementType; }
+    uint32_t quantTotal() const { return total; }
+    const std::string &method() const { return featureMethod; }
+    bool sparse() const { return rowIndex != nullptr; }
+
+    // L2 norm of every row of a dense float32 store, nullptr if the store does not keep them
+    const float *norms() const { return rowNorms; }
+
+    // Segments the rows are compared by, empty if the store does not keep them
+    const FeatureLayout &featureLayout() const { return layout; }
+
+    // Row i of a dense store in the stored element type, stride() values of which the first dim() are used
+    const void *rowData(size_t i) const { return matrix + i * rowBytes; }
+
+    // Features of row i of a float32 store
+    const float *row(size_t i) const { return static_cast<const float *>(rowData(i)); }
+
+    /*
+        Copies the features of a row as floats, dequantizing quantized rows
+
+        Parameters:
+            i: row index
+            out: output, dim() values
+    */
+    void copyRow(size_t i, float *out) const;
+
+    /*
+        Row i of a sparse store, T must match the element type
+
+        Parameters:
+            i: row index
+            row: output nonzero bins of a sparse row
+            dense: output dim() values of a dense row
+
+        Returns:
+            true if the row is sparse, false if it is dense
+    */
+    template <typename T>
+    bool sparseRow(size_t i, SparseHistogram<T> &row, const T *&dense) const {
+        const char *record = matrix + rowIndex[i];
+        uint32_t count;
+        memcpy(&count, record, sizeof(count));
+        if (count == FEATURE_STORE_DENSE_ROW) {
+            dense = reinterpret_cast<const T *>(record + sizeof(uint32_t));
+            return false;
+        }
+
+        row.count = count;
+        row.indices = reinterpret_cast<const uint16_t *>(record + sizeof(uint32_t));
+        row.values = reinterpret_cast<const T *>(record + sparseValuesOffset(count, sizeof(T)));
+        return true;
+    }
+
+    // Image name of row i
+    const char *name(size_t i) const;
+
+    // True if the store keeps a name index
+    bool hasNameIndex() const { return nameSlots != nullptr; }
+
+    /*
+        Finds a row by image name with the name index of the store, see lookupNameIndex
+
+        Parameters:
+            key: image name or file name
+            length: length of the key
+            row: output row
+
+        Returns:
+            0 if the image was found
+            -1 otherwise, or if the store has no name index
+    */
+    int findName(const char *key, size_t length, size_t &row) const;
+
+private:
+    MappedFile file;
+    const char *matrix = nullptr;
+    const uint64_t *rowIndex = nullptr;
+    const float *rowNorms = nullptr;
+    size_t rowBytes = 0;
+    int elementType = FEATURE_STORE_FLOAT32;
+    uint32_t total = 0;
+    const uint64_t *nameOffsets = nullptr;
+    const char *names = nullptr;
+    uint64_t namesLength = 0;
+    const NameIndexSlot *nameSlots = nullptr;
+    uint32_t nameBits = 0;
+    size_t numRows = 0;
+    int numDims = 0;
+    int rowStride = 0;
+    int scale = 1;
+    std::string featureMethod;
+    FeatureLayout layout;
+};
+
+/*
+    Writes a binary feature store one row at a time. The matrix is streamed to
+    disk, names are kept in memory and written with the header on close().
+    Quantized stores take float rows and quantize each histogram on the way in,
+    sparse stores also keep the record offsets in memory until close(), and
+    dense float32 stores the row norms. The feature layout and the name index
+    are written on close().
+*/
+class FeatureStoreWriter {
+public:
+    FeatureStoreWriter() = default;
+    ~FeatureStoreWriter();
+
+    FeatureStoreWriter(const FeatureStoreWriter &) = delete;
+    FeatureStoreWriter &operator=(const FeatureStoreWriter &) = delete;
+
+    /*
+        Creates a store, replacing any existing file
+
+        Parameters:
+            path: store path
+            method: feature method recorded in the header, may be empty for float32
+            decodeScale: decode scale recorded in the header
+            dtype: element type, quantized types need a histogram method
+            sparse: store rows as sparse records where that is smaller, needs a histogram method
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int open(const std::string &path, const std::string &method, int decodeScale,
+             int dtype = FEATURE_STORE_FLOAT32, bool sparse = false);
+
+    /*
+        Appends a row, the first row fixes the dimension of the store
+
+        Parameters:
+            name: image name
+            features: feature vector
+
+        Returns:
+            0 on success
+            -1 on error (write failure or wrong dimension)
+    */
+    int addRow(const std::string &name, const float *features, size_t dim);
+    int addRow(const std::string &name, const std::vector<float> &features) {
+        return addRow(name, features.data(), features.size());
+    }
+
+    /*
+        Sets the feature layout recorded in the store, before the first row.
+        Without one the store records the layout of its method, if it has one.
+
+        Parameters:
+            layout: segments the rows are compared by
+
+        Returns:
+            0 on success
+            -1 if rows were already added
+    */
+    int setLayout(const FeatureLayout &layout);
+
+    /*
+        Writes the name table and header and closes the file
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int close();
+
+private:
+    FILE *fp = nullptr;
+    std::string path;
+    FeatureStoreHeader header{};
+    std::vector<uint64_t> nameOffsets;
+    std::string names;
+    std::vector<char> padded;
+    std::vector<char> record;
+    std::vector<uint64_t> rowOffsets;
+    std::vector<float> rowNorms;
+    std::vector<int> segments;
+    FeatureLayout layout;
+    bool failed = false;
+};
+
+/*
+    Check that a store header is supported and that every section it
+    describes lies inside the file
+
+    Parameters:
+        header: store header
+        size: size of the file
+        path: store path for error messages
+
+    Returns:
+        0 if the header is valid
+        -1 otherwise
+*/
+int checkFeatureStoreHeader(const FeatureStoreHeader &header, uint64_t size, const std::string &path);
+
+/*
+    Check that the records of consecutive rows of a sparse store lie inside
+    the bytes read for them
+
+    Parameters:
+        offsets: rows + 1 record offsets, offsets[0] is the record at matrix
+        rows: number of rows
+        matrix: records of the rows
+        matrixSize: bytes available at matrix
+        dim: features per row
+        dtype: element type
+
+    Returns:
+        0 if the records are valid
+        -1 otherwise
+*/
+int checkSparseRecords(const uint64_t *offsets, size_t rows, const char *matrix, uint64_t matrixSize, uint32_t dim,
+                       int dtype);
+
+/*
+    Size of one value of a store element type
+
+    Parameters:
+        dtype: FEATURE_STORE_FLOAT32, _UINT8 or _UINT16
+
+    Returns:
+        size in bytes, 0 for an unknown type
+*/
+size_t featureStoreElementSize(int dtype);
+
+/*
+    Parse a --quantize option value
+
+    Parameters:
+        name: "u8", "u16" or "none"
+        dtype: output element type
+
+    Returns:
+        0 on success
+        -1 if the name is not known
+*/
+int parseQuantization(const std::string &name, int &dtype);
+
+/*
+    Check if an output path names a binary feature store (.fst extension)
+
+    Parameters:
+        path: store path
+
+    Returns:
+        true for a binary store
+*/
+bool isBinaryStorePath(const std::string &path);
+
+/*
+    Check if an existing file is a binary feature store, from its magic bytes
+
+    Parameters:
+        path: file path
+
+    Returns:
+        true for a binary store
+*/
+bool isFeatureStoreFile(const std::string &path);
+
+/*
+    Feature methods buildFeatures can extract, in the order "all" runs them
+
+    Returns:
+        list of method names
+*/
+const std::vector<std::string> &buildMethods();
+
+/*
+    Check if a feature method name is supported by buildFeatures
+
+    Parameters:
+        featureMethod: feature method name
+
+    Returns:
+        true if the method is valid
+*/
+bool validFeatureMethod(const std::string &featureMethod);
+
+/*
+    Output store path for a method. With a single method the output path is used as is,
+    with several methods the method name is inserted before the extension
+    (features.csv -> features_baseline.csv).
+
+    Parameters:
+        output: output path given on the command line
+        method: feature method name
+        multiMethod: true if more than one method is being written
+
+    Returns:
+        output path for the method
+*/
+std::string storePath(const std::string &output, const std::string &method, bool multiMethod);
+
+#endif
@@ -0,0 +1,478 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Scanning binary feature stores chunk by chunk with read-ahead.
+*/
+
+#include "featureStream.h"
+#include "distanceFunctions.h"
+#include "quantize.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <fcntl.h>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+// Define filesystem
+namespace fs = std::filesystem;
+
+// Block size for reading the name table
+#define NAME_BLOCK_SIZE (1 << 20)
+
+/*
+    Copies the features of a row as floats, dequantizing quantized rows
+
+    Parameters:
+        i: row index within the chunk
+        out: output, dim() values
+*/
+void FeatureChunk::copyRow(size_t i, float *out) const {
+    if (sparse()) {
+        if (elementType == FEATURE_STORE_UINT8) {
+            copySparseRow<uint8_t>(*this, i, out);
+        }
+        else if (elementType == FEATURE_STORE_UINT16) {
+            copySparseRow<uint16_t>(*this, i, out);
+        }
+        else {
+            copySparseRow<float>(*this, i, out);
+        }
+    }
+    else if (elementType == FEATURE_STORE_UINT8) {
+        dequantizeHistograms(rowU8(i), numDims, total, out);
+    }
+    else if (elementType == FEATURE_STORE_UINT16) {
+        dequantizeHistograms(rowU16(i), numDims, total, out);
+    }
+    else {
+        std::copy(row(i), row(i) + numDims, out);
+    }
+}
+
+FeatureStoreStream::~FeatureStoreStream() {
+    if (pending.valid()) {
+        pending.wait();
+    }
+    if (fp) {
+        fclose(fp);
+    }
+}
+
+/*
+    Reads bytes at a file offset. pread keeps no file position, so the
+    read-ahead thread and the caller read at the same time; without it the
+    reads are serialized
+
+    Parameters:
+        offset: file offset
+        buffer: output bytes
+        bytes: number of bytes
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int FeatureStoreStream::readAt(uint64_t offset, void *buffer, size_t bytes) {
+#ifdef _WIN32
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (_fseeki64(fp, static_cast<__int64>(offset), SEEK_SET) != 0 || fread(buffer, 1, bytes, fp) != bytes) {
+        printf("Error reading feature store %s\n", path.c_str());
+        return -1;
+    }
+#else
+    char *out = static_cast<char *>(buffer);
+    while (bytes > 0) {
+        ssize_t got = pread(fileno(fp), out, bytes, static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            printf("Error reading feature store %s\n", path.c_str());
+            return -1;
+        }
+        out += got;
+        offset += static_cast<uint64_t>(got);
+        bytes -= static_cast<size_t>(got);
+    }
+#endif
+
+    return 0;
+}
+
+/*
+    Opens a binary feature store and validates its header
+
+    Parameters:
+        path: store path
+        chunkBytes: largest number of matrix bytes read at once, at least one row is read
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int FeatureStoreStream::open(const std::string &path, size_t chunkBytes) {
+    this->path = path;
+    fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        printf("Unable to open feature store %s\n", path.c_str());
+        return -1;
+    }
+
+    // Chunks are read in one go, stdio buffering would only add a copy
+    setvbuf(fp, nullptr, _IONBF, 0);
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    if (ec || size < sizeof(header) || readAt(0, &header, sizeof(header)) != 0) {
+        printf("Error, %s is not a feature store\n", path.c_str());
+        return -1;
+    }
+    if (checkFeatureStoreHeader(header, size, path) != 0) {
+        return -1;
+    }
+    if (header.rows > UINT32_MAX) {
+        printf("Error, %s has more rows than image IDs can address\n", path.c_str());
+        return -1;
+    }
+
+    // The name table has to end where its last offset says, with a '\0'
+    uint64_t lastOffset = 0;
+    char lastChar = '\0';
+    uint64_t namesLength = header.namesSize - (header.rows + 1) * sizeof(uint64_t);
+    if (readAt(header.namesOffset + header.rows * sizeof(uint64_t), &lastOffset, sizeof(lastOffset)) != 0 ||
+        (namesLength > 0 && readAt(header.namesOffset + header.namesSize - 1, &lastChar, 1) != 0) ||
+        lastOffset != namesLength || lastChar != '\0') {
+        printf("Error, feature store %s has a corrupt name table\n", path.c_str());
+        return -1;
+    }
+
+    layout.resize(header.segmentCount);
+    if (!layout.empty() &&
+        (readAt(header.segmentsOffset, layout.data(), layout.size() * sizeof(FeatureSegment)) != 0 ||
+         checkLayout(layout, static_cast<int>(header.dim)) != 0)) {
+        printf("Error, feature store %s has a corrupt feature layout\n", path.c_str());
+        return -1;
+    }
+
+    // Chunks hold whole rows, sparse chunks are sized for rows that are all dense
+    size_t elementSize = featureStoreElementSize(header.dtype);
+    size_t rowBytes = sparse() ? (sizeof(uint32_t) + header.dim * elementSize + 3) / 4 * 4
+                               : header.stride * elementSize;
+    chunkRows = std::max<size_t>(1, chunkBytes / std::max<size_t>(rowBytes, 1));
+    nextRow = 0;
+    current = 0;
+
+    return 0;
+}
+
+/*
+    Reads the rows of a chunk, run on the read-ahead thread
+
+    Parameters:
+        chunk: output chunk
+        firstRow: first row to read
+
+    Returns:
+        number of rows read, 0 past the last row
+        -1 on error
+*/
+long FeatureStoreStream::readChunk(FeatureChunk &chunk, size_t firstRow) {
+    return readRows(chunk, firstRow, std::min(chunkRows, rows() - std::min(firstRow, rows())));
+}
+
+/*
+    Reads consecutive rows into a chunk
+
+    Parameters:
+        chunk: output chunk
+        firstRow: first row to read
+        count: number of rows, all of them in the store
+
+    Returns:
+        number of rows read
+        -1 on error
+*/
+long FeatureStoreStream::readRows(FeatureChunk &chunk, size_t firstRow, size_t count) {
+    chunk.first = static_cast<ImageId>(firstRow);
+    chunk.numRows = count;
+    chunk.numDims = dim();
+    chunk.rowStride = static_cast<int>(header.stride);
+    chunk.elementType = dtype();
+    chunk.total = quantTotal();
+    chunk.offsets.clear();
+    chunk.rowNorms.clear();
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t elementSize = featureStoreElementSize(header.dtype);
+    if (!sparse()) {
+        chunk.rowBytes = header.stride * elementSize;
+        chunk.data.resize(count * chunk.rowBytes);
+        uint64_t offset = header.dataOffset + static_cast<uint64_t>(firstRow) * chunk.rowBytes;
+        if (readAt(offset, chunk.data.data(), chunk.data.size()) != 0) {
+            return -1;
+        }
+
+        // Row norms of float32 rows, for cosine scans
+        if (withNorms && dtype() == FEATURE_STORE_FLOAT32) {
+            chunk.rowNorms.resize(count);
+            if (header.normsOffset != 0) {
+                return readAt(header.normsOffset + firstRow * sizeof(float), chunk.rowNorms.data(),
+                              count * sizeof(float)) == 0 ? static_cast<long>(count) : -1;
+            }
+            for (size_t i = 0; i < count; i++) {
+                chunk.rowNorms[i] = l2Norm(chunk.row(i), dim());
+            }
+        }
+        return static_cast<long>(count);
+    }
+
+    // A sparse chunk reads its record offsets first, then the records they span
+    chunk.rowBytes = 0;
+    chunk.offsets.resize(count + 1);
+    if (readAt(header.rowIndexOffset + firstRow * sizeof(uint64_t), chunk.offsets.data(),
+               chunk.offsets.size() * sizeof(uint64_t)) != 0) {
+        return -1;
+    }
+
+    uint64_t maxRecord = (sizeof(uint32_t) + header.dim * elementSize + 3) / 4 * 4;
+    uint64_t matrixSize = header.rowIndexOffset - header.dataOffset;
+    uint64_t begin = chunk.offsets[0];
+    uint64_t end = chunk.offsets[count];
+    if (end < begin || end > matrixSize || end - begin > count * maxRecord) {
+        printf("Error, feature store %s has a corrupt row index\n", path.c_str());
+        return -1;
+    }
+
+    chunk.data.resize(end - begin);
+    if (readAt(header.dataOffset + begin, chunk.data.data(), chunk.data.size()) != 0) {
+        return -1;
+    }
+    if (checkSparseRecords(chunk.offsets.data(), count, chunk.data.data(), chunk.data.size(), header.dim,
+                           header.dtype) != 0) {
+        printf("Error, feature store %s has a corrupt row index\n", path.c_str());
+        return -1;
+    }
+
+    return static_cast<long>(count);
+}
+
+/*
+    Waits for the next chunk and starts reading the one after it
+
+    Parameters:
+        chunk: output chunk
+
+    Returns:
+        number of rows in the chunk, 0 after the last chunk
+        -1 on error
+*/
+long FeatureStoreStream::next(const FeatureChunk *&chunk) {
+    if (!fp) {
+        return -1;
+    }
+
+    // The first chunk has nothing to overlap with
+    if (!pending.valid()) {
+        pending = std::async(std::launch::async, &FeatureStoreStream::readChunk, this, std::ref(chunks[current]),
+                             nextRow);
+    }
+
+    long count = pending.get();
+    if (count <= 0) {
+        return count;
+    }
+
+    chunk = &chunks[current];
+    nextRow += static_cast<size_t>(count);
+    current ^= 1;
+    if (nextRow < rows()) {
+        pending = std::async(std::launch::async, &FeatureStoreStream::readChunk, this, std::ref(chunks[current]),
+                             nextRow);
+    }
+
+    return count;
+}
+
+/*
+    Reads the name of an image
+
+    Parameters:
+        id: image ID
+        name: output name
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int FeatureStoreStream::readName(ImageId id, std::string &name) {
+    uint64_t offsets[2];
+    uint64_t namesStart = header.namesOffset + (header.rows + 1) * sizeof(uint64_t);
+    uint64_t namesLength = header.namesSize - (header.rows + 1) * sizeof(uint64_t);
+    if (id >= header.rows || readAt(header.namesOffset + id * sizeof(uint64_t), offsets, sizeof(offsets)) != 0 ||
+        offsets[0] >= offsets[1] || offsets[1] > namesLength) {
+        return -1;
+    }
+
+    // The stored length includes the '\0'
+    name.resize(offsets[1] - offsets[0]);
+    if (readAt(namesStart + offsets[0], &name[0], name.size()) != 0) {
+        return -1;
+    }
+    name.resize(strnlen(name.c_str(), name.size()));
+
+    return 0;
+}
+
+/*
+    Compares the name of an image with a key as matchName does. Only the end
+    of the name, as long as the key, is read, into a fixed buffer.
+
+    Parameters:
+        id: image ID
+        key: image name or file name
+        length: length of the key
+
+    Returns:
+        NAME_EXACT_MATCH, NAME_BASE_MATCH or NAME_NO_MATCH, NAME_NO_MATCH on a read error
+*/
+int FeatureStoreStream::matchNameAt(ImageId id, const char *key, size_t length) {
+    uint64_t offsets[2];
+    uint64_t namesStart = header.namesOffset + (header.rows + 1) * sizeof(uint64_t);
+    uint64_t namesLength = header.namesSize - (header.rows + 1) * sizeof(uint64_t);
+    if (id >= header.rows || readAt(header.namesOffset + id * sizeof(uint64_t), offsets, sizeof(offsets)) != 0 ||
+        offsets[0] >= offsets[1] || offsets[1] > namesLength) {
+        return NAME_NO_MATCH;
+    }
+
+    // The stored length includes the '\0'
+    uint64_t nameLength = offsets[1] - offsets[0] - 1;
+    if (nameLength < length) {
+        return NAME_NO_MATCH;
+    }
+
+    // A file name match is a key without directories right after the last separator
+    int match = NAME_EXACT_MATCH;
+    uint64_t start = namesStart + offsets[0];
+    if (nameLength > length) {
+        char separator;
+        start += nameLength - length;
+        if (baseNameOffset(key, length) > 0 || readAt(start - 1, &separator, 1) != 0 ||
+            (separator != '/' && separator != '\\')) {
+            return NAME_NO_MATCH;
+        }
+        match = NAME_BASE_MATCH;
+    }
+
+    char buffer[256];
+    for (size_t done = 0; done < length;) {
+        size_t bytes = std::min(sizeof(buffer), length - done);
+        if (readAt(start + done, buffer, bytes) != 0 || memcmp(buffer, key + done, bytes) != 0) {
+            return NAME_NO_MATCH;
+        }
+        done += bytes;
+    }
+
+    return match;
+}
+
+/*
+    Finds an image by name or file name, see lookupNameIndex. Reads the slots
+    of the name index and the ends of the names they point to, without
+    allocating, or the whole name table in order for stores without an index.
+
+    Parameters:
+        key: image name or file name
+        length: length of the key
+        id: output image ID
+
+    Returns:
+        0 if the image was found
+        -1 otherwise
+*/
+int FeatureStoreStream::findName(const char *key, size_t length, ImageId &id) {
+    size_t row;
+    if (header.nameIndexBits != 0) {
+        auto slotAt = [this](uint64_t i, NameIndexSlot &slot) {
+            return readAt(header.nameIndexOffset + i * sizeof(NameIndexSlot), &slot, sizeof(slot)) == 0;
+        };
+        auto matchAt = [this, key, length](size_t i) { return matchNameAt(static_cast<ImageId>(i), key, length); };
+        if (lookupNameIndex(slotAt, header.nameIndexBits, matchAt, header.rows, key, length, row) != 0) {
+            return -1;
+        }
+        id = static_cast<ImageId>(row);
+        return 0;
+    }
+
+    uint64_t namesStart = header.namesOffset + (header.rows + 1) * sizeof(uint64_t);
+    uint64_t namesLength = header.namesSize - (header.rows + 1) * sizeof(uint64_t);
+
+    // Names are stored in row order, one after the other. The first exact match
+    // is taken, or else the first file name match
+    std::vector<char> block(NAME_BLOCK_SIZE);
+    std::string current;
+    long baseRow = -1;
+    ImageId rowId = 0;
+    for (uint64_t offset = 0; offset < namesLength && rowId < header.rows;) {
+        size_t bytes = static_cast<size_t>(std::min<uint64_t>(block.size(), namesLength - offset));
+        if (readAt(namesStart + offset, block.data(), bytes) != 0) {
+            return -1;
+        }
+        offset += bytes;
+
+        for (size_t i = 0; i < bytes; i++) {
+            if (block[i] != '\0') {
+                current.push_back(block[i]);
+                continue;
+            }
+            int match = matchName(current.c_str(), key, length);
+            if (match == NAME_EXACT_MATCH) {
+                id = rowId;
+                return 0;
+            }
+            if (match == NAME_BASE_MATCH && baseRow < 0) {
+                baseRow = static_cast<long>(rowId);
+            }
+            current.clear();
+            rowId++;
+        }
+    }
+
+    if (baseRow < 0) {
+        return -1;
+    }
+    id = static_cast<ImageId>(baseRow);
+    return 0;
+}
+
+/*
+    Reads the features of one image as floats, dequantizing quantized rows
+
+    Parameters:
+        id: image ID
+        features: output dim() features
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int FeatureStoreStream::readRow(ImageId id, std::vector<float> &features) {
+    FeatureChunk chunk;
+    if (id >= header.rows || readRows(chunk, id, 1) != 1) {
+        printf("Error reading image %u of feature store %s\n", id, path.c_str());
+        return -1;
+    }
+
+    features.resize(header.dim);
+    chunk.copyRow(0, features.data());
+    return 0;
+}
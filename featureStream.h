@@ -0,0 +1,214 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for scanning binary feature stores that do not fit in memory.
+
+    A FeatureStoreStream reads the matrix of a store in chunks of whole rows
+    with plain file reads instead of mapping it. While the caller scans one
+    chunk the next one is read on a background thread, so the disk and the
+    distance computation overlap and at most two chunks are held in memory.
+    Image names stay on disk and are read one at a time for the rows that
+    are reported.
+*/
+
+#ifndef FEATURESTREAM_H
+#define FEATURESTREAM_H
+
+#include <cstdio>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "featureDatabase.h"
+#include "featureStore.h"
+
+// Default chunk size of a streaming scan
+#define FEATURE_STREAM_CHUNK_MB 64
+
+/*
+    Consecutive rows of a binary feature store read into memory. The row
+    accessors take the index of a row within the chunk and mirror those of
+    FeatureDatabase, so the same scan loop runs over either.
+*/
+class FeatureChunk {
+public:
+    size_t size() const { return numRows; }
+    ImageId firstId() const { return first; }
+    int dim() const { return numDims; }
+    int stride() const { return rowStride; }
+    int dtype() const { return elementType; }
+    uint32_t quantTotal() const { return total; }
+    bool sparse() const { return !offsets.empty(); }
+
+    // Rows of a dense chunk, stride values of which the first dim() are used
+    const float *row(size_t i) const { return reinterpret_cast<const float *>(data.data() + i * rowBytes); }
+    const uint8_t *rowU8(size_t i) const { return reinterpret_cast<const uint8_t *>(data.data() + i * rowBytes); }
+    const uint16_t *rowU16(size_t i) const { return reinterpret_cast<const uint16_t *>(data.data() + i * rowBytes); }
+
+    // L2 norm of every row of a dense float32 chunk, when the stream was asked for them
+    const float *norms() const { return rowNorms.data(); }
+
+    /*
+        Row of a sparse chunk, T must match dtype()
+
+        Parameters:
+            i: row index within the chunk
+            row: output nonzero bins of a sparse row
+            dense: output dim() values of a dense row
+
+        Returns:
+            true if the row is sparse, false if it is dense
+    */
+    template <typename T>
+    bool sparseRow(size_t i, SparseHistogram<T> &row, const T *&dense) const {
+        const char *record = data.data() + (offsets[i] - offsets[0]);
+        uint32_t count;
+        memcpy(&count, record, sizeof(count));
+        if (count == FEATURE_STORE_DENSE_ROW) {
+            dense = reinterpret_cast<const T *>(record + sizeof(uint32_t));
+            return false;
+        }
+
+        row.count = count;
+        row.indices = reinterpret_cast<const uint16_t *>(record + sizeof(uint32_t));
+        row.values = reinterpret_cast<const T *>(record + sparseValuesOffset(count, sizeof(T)));
+        return true;
+    }
+
+    /*
+        Copies the features of a row as floats, dequantizing quantized rows
+
+        Parameters:
+            i: row index within the chunk
+            out: output, dim() values
+    */
+    void copyRow(size_t i, float *out) const;
+
+private:
+    friend class FeatureStoreStream;
+
+    std::vector<char> data;         // matrix bytes of the rows
+    std::vector<uint64_t> offsets;  // record offsets of a sparse chunk, size() + 1
+    std::vector<float> rowNorms;    // norms of a dense float32 chunk
+    ImageId first = 0;
+    size_t numRows = 0;
+    size_t rowBytes = 0;
+    int numDims = 0;
+    int rowStride = 0;
+    int elementType = FEATURE_STORE_FLOAT32;
+    uint32_t total = 0;
+};
+
+/*
+    Reads a binary feature store chunk by chunk with one chunk of read-ahead
+*/
+class FeatureStoreStream {
+public:
+    FeatureStoreStream() = default;
+    ~FeatureStoreStream();
+
+    FeatureStoreStream(const FeatureStoreStream &) = delete;
+    FeatureStoreStream &operator=(const FeatureStoreStream &) = delete;
+
+    /*
+        Opens a binary feature store and validates its header
+
+        Parameters:
+            path: store path
+            chunkBytes: largest number of matrix bytes read at once, at least one row is read
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int open(const std::string &path, size_t chunkBytes);
+
+    size_t rows() const { return static_cast<size_t>(header.rows); }
+    int dim() const { return static_cast<int>(header.dim); }
+    int dtype() const { return static_cast<int>(header.dtype); }
+    uint32_t quantTotal() const { return header.quantTotal; }
+    bool sparse() const { return header.layout == FEATURE_STORE_SPARSE; }
+    int decodeScale() const { return header.decodeScale; }
+
+    // Segments the rows are compared by, empty if the store does not keep them
+    const FeatureLayout &featureLayout() const { return layout; }
+
+    // Read the row norms of a dense float32 store with each chunk, or compute
+    // them if the store has none, for cosine scans
+    void readNorms(bool enable) { withNorms = enable; }
+
+    /*
+        Waits for the next chunk and starts reading the one after it. The
+        chunk stays valid until the following call.
+
+        Parameters:
+            chunk: output chunk
+
+        Returns:
+            number of rows in the chunk, 0 after the last chunk
+            -1 on error
+    */
+    long next(const FeatureChunk *&chunk);
+
+    /*
+        Reads the name of an image
+
+        Parameters:
+            id: image ID
+            name: output name
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int readName(ImageId id, std::string &name);
+
+    /*
+        Finds an image by name or file name, see lookupNameIndex. Reads the slots
+        of the name index and the ends of the names they point to, without
+        allocating, or the whole name table in order for stores without an index.
+
+        Parameters:
+            key: image name or file name
+            length: length of the key
+            id: output image ID
+
+        Returns:
+            0 if the image was found
+            -1 otherwise
+    */
+    int findName(const char *key, size_t length, ImageId &id);
+
+    /*
+        Reads the features of one image as floats, dequantizing quantized rows
+
+        Parameters:
+            id: image ID
+            features: output dim() features
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int readRow(ImageId id, std::vector<float> &features);
+
+private:
+    FILE *fp = nullptr;
+    std::string path;
+    std::mutex fileMutex;   // serializes reads where pread is not available
+    FeatureStoreHeader header{};
+    FeatureLayout layout;
+    size_t chunkRows = 0;
+    size_t nextRow = 0;
+    FeatureChunk chunks[2];
+    int current = 0;
+    bool withNorms = false;
+    std::future<long> pending;
+
+    int readAt(uint64_t offset, void *buffer, size_t bytes);
+    int matchNameAt(ImageId id, const char *key, size_t length);
+    long readChunk(FeatureChunk &chunk, size_t firstRow);
+    long readRows(FeatureChunk &chunk, size_t firstRow, size_t count);
+};
+
+#endif
@@ -0,0 +1,380 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Image loading helpers shared by buildFeatures and matchImage.
+*/
+
+#include "imageIO.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+
+// Define filesystem
+namespace fs = std::filesystem;
+
+// Paths buffered between the walker thread and the consumer
+#define ENUMERATOR_QUEUE_SIZE 4096
+
+/*
+    Check if a decode scale is supported (1, 2, 4 or 8)
+
+    Parameters:
+        scale: decode scale denominator
+
+    Returns:
+        true if the scale is supported
+*/
+bool validDecodeScale(int scale) {
+    return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+}
+
+/*
+    Check if a feature method may be extracted from a reduced resolution decode.
+
+    Parameters:
+        featureMethod: feature method name
+
+    Returns:
+        true if the method supports a decode scale other than 1
+*/
+bool methodSupportsDecodeScale(const std::string &featureMethod) {
+    return featureMethod == "chistogram" || featureMethod == "mhistogram" || featureMethod == "texture";
+}
+
+/*
+    OpenCV read flags of a decode scale
+
+    Parameters:
+        scale: 1, 2, 4 or 8
+        flags: output flags
+
+    Returns:
+        0 on success
+        -1 if the scale is not supported
+*/
+static int decodeFlags(int scale, int &flags) {
+    flags = cv::IMREAD_COLOR;
+
+    if (scale == 2) {
+        flags = cv::IMREAD_REDUCED_COLOR_2;
+    }
+    else if (scale == 4) {
+        flags = cv::IMREAD_REDUCED_COLOR_4;
+    }
+    else if (scale == 8) {
+        flags = cv::IMREAD_REDUCED_COLOR_8;
+    }
+    else if (scale != 1) {
+        printf("Error, decode scale must be 1, 2, 4 or 8!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Reads a color image, optionally at reduced resolution.
+
+    Parameters:
+        path: path to the image
+        image: output BGR image
+        scale: 1 for full resolution, or 2, 4, 8 for 1/2, 1/4, 1/8 resolution
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int readImage(const std::string &path, cv::Mat &image, int scale) {
+    int flags;
+    if (decodeFlags(scale, flags) != 0) {
+        return -1;
+    }
+
+    image = cv::imread(path, flags);
+    if (image.empty()) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Reads the bytes of an image file, to be hashed and decoded without reading it again
+
+    Parameters:
+        path: path to the image
+        bytes: output file contents
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int readImageBytes(const std::string &path, std::vector<unsigned char> &bytes) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return -1;
+    }
+
+    bytes.clear();
+    unsigned char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + n);
+    }
+
+    int error = ferror(fp);
+    fclose(fp);
+    return error ? -1 : 0;
+}
+
+/*
+    Decodes a color image from the bytes of its file, optionally at reduced resolution
+
+    Parameters:
+        bytes: file contents
+        image: output BGR image
+        scale: 1 for full resolution, or 2, 4, 8 for 1/2, 1/4, 1/8 resolution
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int decodeImage(const std::vector<unsigned char> &bytes, cv::Mat &image, int scale) {
+    int flags;
+    if (bytes.empty() || decodeFlags(scale, flags) != 0) {
+        return -1;
+    }
+
+    image = cv::imdecode(bytes, flags);
+    if (image.empty()) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Check if a file is an image by its extension, case-insensitive
+
+    Parameters:
+        path: file path
+
+    Returns:
+        true if the extension is a supported image format
+*/
+bool isImageFile(const fs::path &path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    return ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".ppm" ||
+           ext == ".tif" || ext == ".tiff";
+}
+
+/*
+    Hash of a path used to assign images to shards (64-bit FNV-1a)
+
+    Parameters:
+        path: path relative to the enumeration source, with '/' separators
+
+    Returns:
+        hash value
+*/
+uint64_t hashPath(const std::string &path) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : path) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+    Restricts the enumeration to one shard, call before start()
+
+    Parameters:
+        index: shard to keep, 0 <= index < count
+        count: number of shards
+*/
+void ImageEnumerator::setShard(int index, int count) {
+    shardIndex = index;
+    shardCount = count;
+}
+
+/*
+    Check if an image belongs to the enumerated shard
+
+    Parameters:
+        key: path relative to the source directory, or as listed
+
+    Returns:
+        true if the image is in the shard
+*/
+bool ImageEnumerator::inShard(const std::string &key) const {
+    return shardCount <= 1 || hashPath(key) % static_cast<uint64_t>(shardCount) == static_cast<uint64_t>(shardIndex);
+}
+
+/*
+    Stops the walker if the consumer quit early, and waits for it to finish.
+*/
+ImageEnumerator::~ImageEnumerator() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        cancelled = true;
+    }
+    queueChanged.notify_all();
+
+    if (walker.joinable()) {
+        walker.join();
+    }
+}
+
+/*
+    Starts enumerating a source
+
+    Parameters:
+        source: directory, file list, or "-" for a file list on stdin
+        recursive: walk subdirectories of a directory source
+
+    Returns:
+        0 on success
+        -1 if the source does not exist
+*/
+int ImageEnumerator::start(const std::string &source, bool recursive) {
+    bool isList = source == "-" || fs::is_regular_file(source);
+
+    if (!isList && !fs::is_directory(source)) {
+        printf("Error! Directory does not exist!\n");
+        return -1;
+    }
+
+    root = source;
+    walker = std::thread([this, source, recursive, isList] {
+        if (isList) {
+            readFileList(source);
+        }
+        else {
+            walkDirectory(source, recursive);
+        }
+
+        std::lock_guard<std::mutex> lock(queueMutex);
+        finished = true;
+        queueChanged.notify_all();
+    });
+
+    return 0;
+}
+
+/*
+    Waits for the next image path
+
+    Parameters:
+        path: output image path
+
+    Returns:
+        true if a path was returned, false once the enumeration is finished
+*/
+bool ImageEnumerator::next(std::string &path) {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueChanged.wait(lock, [this] { return !queue.empty() || finished; });
+
+    if (queue.empty()) {
+        return false;
+    }
+
+    path = std::move(queue.front());
+    queue.pop_front();
+    returned++;
+    queueChanged.notify_all();
+
+    return true;
+}
+
+/*
+    Check if next() would return without waiting for the walk
+
+    Returns:
+        true if a path is queued or the enumeration is finished
+*/
+bool ImageEnumerator::ready() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return !queue.empty() || finished;
+}
+
+/*
+    Hands one path to the consumer, waiting while the queue is full.
+
+    Parameters:
+        path: image path
+*/
+void ImageEnumerator::push(std::string path) {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queueChanged.wait(lock, [this] { return queue.size() < ENUMERATOR_QUEUE_SIZE || cancelled; });
+
+    queue.push_back(std::move(path));
+    queueChanged.notify_all();
+}
+
+/*
+    Walks a directory in sorted order. Each directory is listed and sorted on its
+    own, so the walk streams while still producing a deterministic order.
+    Symlinked directories are not followed to avoid cycles.
+
+    Parameters:
+        directory: directory to walk
+        recursive: descend into subdirectories
+*/
+void ImageEnumerator::walkDirectory(const fs::path &directory, bool recursive) {
+    std::error_code ec;
+    std::vector<fs::directory_entry> entries;
+
+    for (fs::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        entries.push_back(*it);
+    }
+    if (ec) {
+        printf("Warning: unable to list %s\n", directory.string().c_str());
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const fs::directory_entry &a, const fs::directory_entry &b) { return a.path() < b.path(); });
+
+    for (const auto &entry : entries) {
+        if (cancelled) {
+            return;
+        }
+
+        if (entry.is_directory(ec)) {
+            if (recursive && !entry.is_symlink(ec)) {
+                walkDirectory(entry.path(), recursive);
+            }
+        }
+        else if (entry.is_regular_file(ec) && isImageFile(entry.path()) &&
+                 inShard(entry.path().lexically_relative(root).generic_string())) {
+            push(entry.path().string());
+        }
+    }
+}
+
+/*
+    Reads a newline-delimited list of image paths, skipping blank lines.
+
+    Parameters:
+        listFile: path of the list, or "-" for stdin
+*/
+void ImageEnumerator::readFileList(const std::string &listFile) {
+    std::ifstream file;
+    if (listFile != "-") {
+        file.open(listFile);
+    }
+    std::istream &in = listFile == "-" ? std::cin : file;
+
+    std::string line;
+    while (!cancelled && std::getline(in, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+            line.pop_back();
+        }
+        if (!line.empty() && inShard(line)) {
+            push(line);
+        }
+    }
+}
@@ -0,0 +1,190 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for image loading helpers shared by buildFeatures and matchImage.
+*/
+
+#ifndef IMAGEIO_H
+#define IMAGEIO_H
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+/*
+    Check if a decode scale is supported (1, 2, 4 or 8)
+
+    Parameters:
+        scale: decode scale denominator
+
+    Returns:
+        true if the scale is supported
+*/
+bool validDecodeScale(int scale);
+
+/*
+    Check if a feature method may be extracted from a reduced resolution decode.
+    Only the normalized histogram methods qualify, baseline reads raw pixels and
+    face detection needs the full resolution image.
+
+    Parameters:
+        featureMethod: feature method name
+
+    Returns:
+        true if the method supports a decode scale other than 1
+*/
+bool methodSupportsDecodeScale(const std::string &featureMethod);
+
+/*
+    Reads a color image, optionally at reduced resolution. For JPEGs a reduced
+    decode is done by the decoder in the DCT domain (IMREAD_REDUCED_COLOR_*),
+    which is much cheaper than decoding at full size and resizing.
+
+    Parameters:
+        path: path to the image
+        image: output BGR image
+        scale: 1 for full resolution, or 2, 4, 8 for 1/2, 1/4, 1/8 resolution
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int readImage(const std::string &path, cv::Mat &image, int scale = 1);
+
+/*
+    Reads the bytes of an image file, to be hashed and decoded without reading it again
+
+    Parameters:
+        path: path to the image
+        bytes: output file contents
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int readImageBytes(const std::string &path, std::vector<unsigned char> &bytes);
+
+/*
+    Decodes a color image from the bytes of its file, optionally at reduced resolution
+
+    Parameters:
+        bytes: file contents
+        image: output BGR image
+        scale: 1 for full resolution, or 2, 4, 8 for 1/2, 1/4, 1/8 resolution
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int decodeImage(const std::vector<unsigned char> &bytes, cv::Mat &image, int scale = 1);
+
+/*
+    Check if a file is an image by its extension, case-insensitive
+    (.jpg, .jpeg, .png, .ppm, .tif, .tiff)
+
+    Parameters:
+        path: file path
+
+    Returns:
+        true if the extension is a supported image format
+*/
+bool isImageFile(const std::filesystem::path &path);
+
+/*
+    Hash of a path used to assign images to shards (64-bit FNV-1a)
+
+    Parameters:
+        path: path relative to the enumeration source, with '/' separators
+
+    Returns:
+        hash value
+*/
+uint64_t hashPath(const std::string &path);
+
+/*
+    Streams image paths to the caller while they are still being enumerated.
+
+    The source is either a directory, walked on a background thread in sorted
+    path order (optionally recursing into subdirectories), or a newline-delimited
+    file list ("-" reads the list from stdin) used in the order given. Paths are
+    handed over through a bounded queue, so extraction can start on the first
+    images while the walk is still running and memory stays bounded for very
+    large collections.
+
+    With a shard set, only the images whose path (relative to the source
+    directory, or as listed) hashes to the shard are returned, so N processes
+    given the same source split it into N disjoint, deterministic slices.
+*/
+class ImageEnumerator {
+public:
+    ImageEnumerator() = default;
+    ~ImageEnumerator();
+
+    ImageEnumerator(const ImageEnumerator &) = delete;
+    ImageEnumerator &operator=(const ImageEnumerator &) = delete;
+
+    /*
+        Restricts the enumeration to one shard, call before start()
+
+        Parameters:
+            index: shard to keep, 0 <= index < count
+            count: number of shards
+    */
+    void setShard(int index, int count);
+
+    /*
+        Starts enumerating a source
+
+        Parameters:
+            source: directory, file list, or "-" for a file list on stdin
+            recursive: walk subdirectories of a directory source
+
+        Returns:
+            0 on success
+            -1 if the source does not exist
+    */
+    int start(const std::string &source, bool recursive);
+
+    /*
+        Waits for the next image path
+
+        Parameters:
+            path: output image path
+
+        Returns:
+            true if a path was returned, false once the enumeration is finished
+    */
+    bool next(std::string &path);
+
+    // True if next() would return without waiting for the walk
+    bool ready();
+
+    // Number of paths returned by next() so far
+    size_t count() const { return returned; }
+
+private:
+    std::thread walker;
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<std::string> queue;
+    bool finished = false;
+    std::atomic<bool> cancelled{false};
+    size_t returned = 0;
+    int shardIndex = 0;
+    int shardCount = 1;
+    std::filesystem::path root;
+
+    bool inShard(const std::string &key) const;
+    void push(std::string path);
+    void walkDirectory(const std::filesystem::path &directory, bool recursive);
+    void readFileList(const std::string &listFile);
+};
+
+#endif
@@ -0,0 +1,326 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Reading and writing the image manifest used for incremental builds.
+*/
+
+#include "manifest.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+// Define filesystem
+namespace fs = std::filesystem;
+
+// FNV-1a offset basis and prime
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/*
+    Manifest file name for a feature file
+
+    Parameters:
+        featureFile: path to the feature file
+
+    Returns:
+        path of the manifest (featureFile + ".manifest")
+*/
+std::string manifestPath(const std::string &featureFile) {
+    return featureFile + ".manifest";
+}
+
+/*
+    Parses one manifest line, header lines are handled by the caller
+
+    Parameters:
+        line: line without its end of line characters
+        entry: output entry
+
+    Returns:
+        0 on success
+        -1 if the line is malformed
+*/
+static int parseManifestLine(const char *line, ManifestEntry &entry) {
+    int pathStart = 0;
+    if (sscanf(line, "%" SCNx64 ",%" SCNu64 ",%" SCNd64 ",%n", &entry.hash, &entry.size, &entry.mtime, &pathStart) != 3 ||
+        pathStart == 0) {
+        return -1;
+    }
+
+    entry.path = line + pathStart;
+    return 0;
+}
+
+/*
+    Reads the next manifest line, without its end of line characters
+
+    Parameters:
+        fp: open manifest
+        line: output buffer
+        size: size of the buffer
+
+    Returns:
+        true if a line was read
+*/
+static bool readManifestLine(FILE *fp, char *line, int size) {
+    if (!fgets(line, size, fp)) {
+        return false;
+    }
+
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        line[--len] = '\0';
+    }
+    return true;
+}
+
+/*
+    Reads a manifest into a map from image path to entry
+
+    Parameters:
+        filename: manifest path
+        entries: output map, keyed by image path
+        decodeScale: optional output decode scale (1 if the manifest does not record one)
+
+    Returns:
+        0 on success
+        -1 if the file could not be opened
+*/
+int readManifest(const std::string &filename, std::unordered_map<std::string, ManifestEntry> &entries,
+                 int *decodeScale) {
+    entries.clear();
+    if (decodeScale) {
+        *decodeScale = 1;
+    }
+
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (!fp) {
+        return -1;
+    }
+
+    char line[4096];
+    while (readManifestLine(fp, line, sizeof(line))) {
+        // Header lines
+        if (line[0] == '#') {
+            int scale;
+            if (decodeScale && sscanf(line, "#decode_scale=%d", &scale) == 1) {
+                *decodeScale = scale;
+            }
+            continue;
+        }
+
+        ManifestEntry entry;
+        if (parseManifestLine(line, entry) != 0) {
+            printf("Warning: skipping malformed manifest line in %s\n", filename.c_str());
+            continue;
+        }
+
+        entries[entry.path] = entry;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/*
+    Reads manifest entries in file order
+
+    Parameters:
+        filename: manifest path
+        entries: output entries
+        decodeScale: optional output decode scale (1 if the manifest does not record one)
+
+    Returns:
+        0 on success
+        -1 if the file could not be opened or has a malformed line
+*/
+int readManifestEntries(const std::string &filename, std::vector<ManifestEntry> &entries, int *decodeScale) {
+    entries.clear();
+    if (decodeScale) {
+        *decodeScale = 1;
+    }
+
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (!fp) {
+        return -1;
+    }
+
+    char line[4096];
+    while (readManifestLine(fp, line, sizeof(line))) {
+        if (line[0] == '#') {
+            int scale;
+            if (decodeScale && sscanf(line, "#decode_scale=%d", &scale) == 1) {
+                *decodeScale = scale;
+            }
+            continue;
+        }
+
+        ManifestEntry entry;
+        if (parseManifestLine(line, entry) != 0) {
+            printf("Error, malformed manifest line in %s\n", filename.c_str());
+            fclose(fp);
+            return -1;
+        }
+        entries.push_back(entry);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/*
+    Writes one manifest line
+
+    Parameters:
+        fp: open manifest
+        entry: entry to write
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int writeManifestEntry(FILE *fp, const ManifestEntry &entry) {
+    int written = fprintf(fp, "%016" PRIx64 ",%" PRIu64 ",%" PRId64 ",%s\n", entry.hash, entry.size, entry.mtime,
+                          entry.path.c_str());
+    return written < 0 ? -1 : 0;
+}
+
+/*
+    Writes a manifest, replacing the old one only once the new one is complete
+
+    Parameters:
+        filename: manifest path
+        entries: entries to write, in output order
+        decodeScale: decode scale the features were extracted at
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int writeManifest(const std::string &filename, const std::vector<ManifestEntry> &entries, int decodeScale) {
+    std::string tmpName = filename + ".tmp";
+
+    FILE *fp = fopen(tmpName.c_str(), "w");
+    if (!fp) {
+        printf("Unable to open manifest file %s\n", tmpName.c_str());
+        return -1;
+    }
+
+    fprintf(fp, "#decode_scale=%d\n", decodeScale);
+    for (const auto &entry : entries) {
+        writeManifestEntry(fp, entry);
+    }
+
+    if (fclose(fp) != 0) {
+        printf("Error writing manifest file %s\n", tmpName.c_str());
+        return -1;
+    }
+
+    std::error_code ec;
+    fs::rename(tmpName, filename, ec);
+    if (ec) {
+        printf("Unable to replace manifest file %s\n", filename.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Reads the size and modification time of a file
+
+    Parameters:
+        path: file path
+        entry: output size and mtime (path is also set)
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int statImageFile(const std::string &path, ManifestEntry &entry) {
+    std::error_code ec;
+
+    entry.path = path;
+    entry.size = fs::file_size(path, ec);
+    if (ec) {
+        return -1;
+    }
+
+    fs::file_time_type mtime = fs::last_write_time(path, ec);
+    if (ec) {
+        return -1;
+    }
+    entry.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+
+    return 0;
+}
+
+/*
+    Adds bytes to a 64-bit FNV-1a hash
+
+    Parameters:
+        h: hash of the bytes before
+        data: bytes
+        size: number of bytes
+
+    Returns:
+        hash including the bytes
+*/
+static uint64_t fnvUpdate(uint64_t h, const unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/*
+    Computes a 64-bit FNV-1a hash of the contents of a file
+
+    Parameters:
+        path: file path
+        hash: output hash
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int hashFile(const std::string &path, uint64_t &hash) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return -1;
+    }
+
+    uint64_t h = FNV_OFFSET_BASIS;
+    unsigned char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        h = fnvUpdate(h, buffer, n);
+    }
+
+    int error = ferror(fp);
+    fclose(fp);
+    if (error) {
+        return -1;
+    }
+
+    hash = h;
+    return 0;
+}
+
+/*
+    Computes the 64-bit FNV-1a hash of bytes already read, the same as
+    hashFile of a file holding them
+
+    Parameters:
+        data: bytes
+        size: number of bytes
+
+    Returns:
+        hash
+*/
+uint64_t hashBytes(const unsigned char *data, size_t size) {
+    return fnvUpdate(FNV_OFFSET_BASIS, data, size);
+}
@@ -0,0 +1,139 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for the image manifest kept next to each feature file.
+
+    The manifest has one line per image that was processed for the feature file:
+        hash,size,mtime,path
+    hash is a 64-bit FNV-1a hash of the file contents in hex, size is in bytes
+    and mtime is the file system modification time tick count. The path is the
+    last column so it may contain commas.
+
+    A header line "#decode_scale=N" records the decode scale the features were
+    extracted at, so matching and incremental builds can use the same scale.
+*/
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// One image recorded in a manifest
+struct ManifestEntry {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+};
+
+/*
+    Manifest file name for a feature file
+
+    Parameters:
+        featureFile: path to the feature file
+
+    Returns:
+        path of the manifest (featureFile + ".manifest")
+*/
+std::string manifestPath(const std::string &featureFile);
+
+/*
+    Reads a manifest into a map from image path to entry
+
+    Parameters:
+        filename: manifest path
+        entries: output map, keyed by image path
+        decodeScale: optional output decode scale (1 if the manifest does not record one)
+
+    Returns:
+        0 on success
+        -1 if the file could not be opened
+*/
+int readManifest(const std::string &filename, std::unordered_map<std::string, ManifestEntry> &entries,
+                 int *decodeScale = nullptr);
+
+/*
+    Reads manifest entries in file order
+
+    Parameters:
+        filename: manifest path
+        entries: output entries
+        decodeScale: optional output decode scale (1 if the manifest does not record one)
+
+    Returns:
+        0 on success
+        -1 if the file could not be opened or has a malformed line
+*/
+int readManifestEntries(const std::string &filename, std::vector<ManifestEntry> &entries, int *decodeScale = nullptr);
+
+/*
+    Writes one manifest line
+
+    Parameters:
+        fp: open manifest
+        entry: entry to write
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int writeManifestEntry(FILE *fp, const ManifestEntry &entry);
+
+/*
+    Writes a manifest, replacing the old one only once the new one is complete
+
+    Parameters:
+        filename: manifest path
+        entries: entries to write, in output order
+        decodeScale: decode scale the features were extracted at
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int writeManifest(const std::string &filename, const std::vector<ManifestEntry> &entries, int decodeScale = 1);
+
+/*
+    Reads the size and modification time of a file
+
+    Parameters:
+        path: file path
+        entry: output size and mtime (path is also set)
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int statImageFile(const std::string &path, ManifestEntry &entry);
+
+/*
+    Computes a 64-bit FNV-1a hash of the contents of a file
+
+    Parameters:
+        path: file path
+        hash: output hash
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int hashFile(const std::string &path, uint64_t &hash);
+
+/*
+    Computes the 64-bit FNV-1a hash of bytes already read, the same as
+    hashFile of a file holding them
+
+    Parameters:
+        data: bytes
+        size: number of bytes
+
+    Returns:
+        hash
+*/
+uint64_t hashBytes(const unsigned char *data, size_t size);
+
+#endif
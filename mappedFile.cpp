@@ -0,0 +1,122 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Read-only memory mapped files (mmap, or MapViewOfFile on Windows).
+*/
+
+#include "mappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+/*
+    Maps a file
+
+    Parameters:
+        path: file to map
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int MappedFile::open(const std::string &path) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        return -1;
+    }
+    fileHandle = file;
+    length = static_cast<size_t>(fileSize.QuadPart);
+
+    // An empty file cannot be mapped, it is simply an empty range
+    if (length == 0) {
+        return 0;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        close();
+        return -1;
+    }
+    mappingHandle = mapping;
+
+    base = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (base == nullptr) {
+        close();
+        return -1;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    length = static_cast<size_t>(st.st_size);
+
+    // An empty file cannot be mapped, it is simply an empty range
+    if (length > 0) {
+        void *mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            length = 0;
+            return -1;
+        }
+        base = static_cast<const char *>(mapped);
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+#endif
+
+    return 0;
+}
+
+/*
+    Unmaps the file
+*/
+void MappedFile::close() {
+#ifdef _WIN32
+    if (base) {
+        UnmapViewOfFile(base);
+    }
+    if (mappingHandle) {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle) {
+        CloseHandle(fileHandle);
+    }
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    if (base) {
+        munmap(const_cast<char *>(base), length);
+    }
+#endif
+
+    base = nullptr;
+    length = 0;
+}
@@ -0,0 +1,53 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for read-only memory mapped files.
+*/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+/*
+    Read-only memory mapping of a whole file. Opening is constant time, pages
+    are loaded on first touch and shared between every process mapping the
+    same file.
+*/
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /*
+        Maps a file
+
+        Parameters:
+            path: file to map
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int open(const std::string &path);
+
+    // Unmaps the file
+    void close();
+
+    const char *data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    const char *base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#endif
+};
+
+#endif
@@ -7,215 +7,1719 @@
     and identifies the top N matches.
 */	
 
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
-#include "csv_util.h"
+#include <type_traits>
 #include "featureMethods.h"
 #include "distanceFunctions.h"
+#include "imageIO.h"
+#include "manifest.h"
+#include "featureDatabase.h"
+#include "quantize.h"
+#include "featureStream.h"
+#include "topN.h"
+#include "prunedDistance.h"
+#include "threadPool.h"
+#include "queryServer.h"
 
-// Computes top N matches from image DB to target image using euclidean distance
-int main(int argc, char* argv[]) {
-    
-    // Parse arguments
-    char* targetImagePath = argv[1];
-    std::string featureMethod = argv[2];
-    char* featureCSV = argv[3];
-    int N = std::atoi(argv[4]);
+// Float rows compared per batch distance call
+#define SCAN_BATCH_ROWS 256
+
+// How the rows are compared
+struct ScanOptions {
+    std::string metric = "euclidean";   // "cosine" compares float rows by cosine distance
+    bool earlyAbandon = false;          // stop comparing a float row once it cannot make the top N
+    bool varianceOrder = false;         // with earlyAbandon, compare the most telling blocks first
+    int threads = 1;                    // threads scanning parts of the rows, each into its own top N
+};
+
+// Target features prepared for the element type and layout of the rows being scanned
+template <typename T>
+struct ScanTarget {
+    std::vector<T> dense;           // target in the element type of the rows
+    std::vector<uint16_t> indices;  // nonzero bins of dense, for sparse rows
+    std::vector<T> values;
+    SparseHistogram<T> sparse;
+    FeatureLayout layout;           // segments dense float rows are compared by
+    std::vector<int> ends;          // end bin of each histogram, for quantized and sparse rows
+    std::vector<float> weights;     // weight of each histogram
+    uint32_t total = 1;             // histogram total, 1 for float rows
+    bool cosine = false;            // a cosine segment covers the rows, so use their norms
+    std::vector<float> distances;   // distances of a batch of dense rows
+
+    // Distances to a batch of dense rows, resolved once per scan by resolveDistances
+    int (*batchDistances)(const ScanTarget &target, const T *rows, const float *norms, size_t count,
+                          size_t stride, int dim, float *out) = nullptr;
+    bool earlyAbandon = false;      // compare dense float rows with pruned instead of in batches
+    bool orderBlocks = false;       // order the blocks of pruned on the first rows scanned
+    PrunedDistance pruned;
+};
+
+/*
+    Number of bins of each histogram
+
+    Parameters:
+        ends: end bin of each histogram
 
-    if (argc < 4 || (featureMethod != "custom" && argc < 5)) {
-    printf("Usage: %s <target_image> <feature_method> <csv_file> <N>\n", argv[0]);
-    printf("   or: %s <target_image> custom <N>\n", argv[0]);
-    return -1;
+    Returns:
+        histogram sizes, in order
+*/
+std::vector<int> histogramSizes(const std::vector<int> &ends) {
+    std::vector<int> sizes;
+    for (size_t h = 0; h < ends.size(); h++) {
+        sizes.push_back(ends[h] - (h == 0 ? 0 : ends[h - 1]));
+    }
+    return sizes;
 }
 
-    // Read feature CSV
-    std::vector<char*> filenames;
-    std::vector<std::vector<float>> data;
-    read_image_data_csv(featureCSV, filenames, data, 0);
+/*
+    Quantize and sparsify the target features to match the rows of a store
+
+    Parameters:
+        features: target features
+        layout: segments the rows are compared by, histograms for quantized and sparse rows
+        total: quantization total, 0 for float rows
+        sparseRows: true if the rows are sparse records
+        target: output target
+*/
+template <typename T>
+void prepareTarget(const std::vector<float> &features, const FeatureLayout &layout, uint32_t total,
+                   bool sparseRows, ScanTarget<T> &target) {
+    target.layout = layout;
+    for (const FeatureSegment &segment : layout) {
+        target.cosine = target.cosine || (segment.metric == SEGMENT_COSINE && segment.offset == 0 &&
+                                          segment.length == features.size());
+    }
+    histogramLayout(layout, target.ends, target.weights);
 
-    // Load target image
-    cv::Mat targetImage = cv::imread(targetImagePath);
-    if (targetImage.empty()){
-        printf("Error loading target image!\n");
+    target.dense.resize(features.size());
+    if constexpr (std::is_same<T, float>::value) {
+        target.dense = features;
+    }
+    else {
+        quantizeHistograms(features.data(), histogramSizes(target.ends), total, target.dense.data());
+        target.total = total;
+    }
+
+    if (sparseRows) {
+        target.sparse = sparsify(target.dense.data(), static_cast<int>(target.dense.size()), target.indices,
+                                 target.values);
+    }
+}
+
+// Batch distances of dense float rows, every segment of the layout in one pass over each tile of rows
+int layoutBatch(const ScanTarget<float> &target, const float *rows, const float *norms, size_t count,
+                size_t stride, int dim, float *out) {
+    return layoutDistances(target.dense.data(), rows, count, stride, dim, target.layout, out, norms);
+}
+
+/*
+    Sum of the bin minimums of two quantized histograms
+
+    Parameters:
+        a: quantized histogram 1
+        b: quantized histogram 2
+        size: number of bins, used when Size is 0
+
+    Returns:
+        integer intersection
+*/
+template <int Size, typename T>
+inline uint32_t quantizedMinSum(const T *a, const T *b, int size) {
+    // A constant bin count lets the compiler unroll and vectorize the loop
+    int bins = Size > 0 ? Size : size;
+    uint32_t sum = 0;
+    for (int i = 0; i < bins; i++) {
+        sum += std::min(a[i], b[i]);
+    }
+    return sum;
+}
+
+/*
+    Weighted intersection distance of one quantized histogram, computed as the
+    quantized distances of distanceFunctions do
+
+    Parameters:
+        a: quantized histogram 1
+        b: quantized histogram 2
+        size: number of bins, used when Size is 0
+        weight: weight of the histogram
+        total: quantization total
+
+    Returns:
+        weight * (1 - intersection)
+*/
+template <int Size, typename T>
+inline float quantizedTerm(const T *a, const T *b, int size, float weight, uint32_t total) {
+    return weight * (1.0f - static_cast<float>(quantizedMinSum<Size>(a, b, size)) / total);
+}
+
+/*
+    Distances from quantized target features to a batch of rows. First, Second
+    and Third are the bins of up to three histograms, fixed at compile time for
+    the histogram layouts matchImage builds; all 0 reads the layout from the
+    target instead, for any other dimension.
+
+    Parameters:
+        target: target prepared for the rows, with the histogram ends and weights
+        rows: first row
+        norms: unused
+        count: number of rows
+        stride: distance between rows in elements
+        dim: unused, the bins are given by the histogram ends
+        out: output distance of each row
+
+    Returns:
+        0
+*/
+template <typename T, int First, int Second, int Third>
+int quantizedBatch(const ScanTarget<T> &target, const T *rows, const float *, size_t count, size_t stride, int,
+                   float *out) {
+    constexpr bool fixed = First > 0;
+    int histograms = fixed ? 1 + (Second > 0) + (Third > 0) : static_cast<int>(target.ends.size());
+    int end0 = fixed ? First : target.ends[0];
+    int end1 = fixed ? First + Second : histograms > 1 ? target.ends[1] : end0;
+    int end2 = fixed ? First + Second + Third : histograms > 2 ? target.ends[2] : end1;
+    const T *query = target.dense.data();
+    const float *weights = target.weights.data();
+
+    for (size_t r = 0; r < count; r++) {
+        const T *row = rows + r * stride;
+        float dist = quantizedTerm<First>(query, row, end0, weights[0], target.total);
+        if (histograms > 1) {
+            dist = dist + quantizedTerm<Second>(query + end0, row + end0, end1 - end0, weights[1], target.total);
+        }
+        if (histograms > 2) {
+            dist = dist + quantizedTerm<Third>(query + end1, row + end1, end2 - end1, weights[2], target.total);
+        }
+        out[r] = dist;
+    }
+    return 0;
+}
+
+/*
+    Pick the batch distance of a scan once: the layout distance for float
+    rows and, for quantized rows, a kernel specialized to the histograms
+
+    Parameters:
+        featureMethod: feature method, for error messages
+        target: target prepared for the rows, batchDistances is set
+
+    Returns:
+        0 on success
+        -1 if the method has no distance for these rows
+*/
+template <typename T>
+int resolveDistances(const std::string &featureMethod, ScanTarget<T> &target) {
+    if constexpr (std::is_same<T, float>::value) {
+        target.batchDistances = layoutBatch;
+    }
+    else if (!target.ends.empty() && target.ends.size() <= 3 && target.ends.size() == target.weights.size()) {
+        // 16 x 16 bin histograms: chistogram, mhistogram, texture and face
+        const std::vector<int> &ends = target.ends;
+        if (ends == std::vector<int>{256}) {
+            target.batchDistances = quantizedBatch<T, 256, 0, 0>;
+        }
+        else if (ends == std::vector<int>{256, 512}) {
+            target.batchDistances = quantizedBatch<T, 256, 256, 0>;
+        }
+        else if (ends == std::vector<int>{256, 272}) {
+            target.batchDistances = quantizedBatch<T, 256, 16, 0>;
+        }
+        else if (ends == std::vector<int>{256, 512, 768}) {
+            target.batchDistances = quantizedBatch<T, 256, 256, 256>;
+        }
+        else {
+            target.batchDistances = quantizedBatch<T, 0, 0, 0>;
+        }
+    }
+
+    if (!target.batchDistances) {
+        printf("Error, no distance for %s features!\n", featureMethod.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Dense row of a feature database or streamed chunk in the element type T
+
+    Parameters:
+        rows: FeatureDatabase or FeatureChunk
+        i: row index
+
+    Returns:
+        the row
+*/
+template <typename T, typename Rows>
+const T *denseRow(const Rows &rows, size_t i) {
+    if constexpr (std::is_same<T, uint8_t>::value) {
+        return rows.rowU8(i);
+    }
+    else if constexpr (std::is_same<T, uint16_t>::value) {
+        return rows.rowU16(i);
+    }
+    else {
+        return rows.row(i);
+    }
+}
+
+/*
+    Set up early abandoning of dense float rows compared by one euclidean
+    distance or by weighted histogram intersections
+
+    Parameters:
+        featureMethod: feature method, for error messages
+        features: target features
+        layout: segments the rows are compared by
+        options: scan options
+        target: output target
+
+    Returns:
+        0 on success
+        -1 if the layout cannot be compared early abandoning
+*/
+int preparePruning(const std::string &featureMethod, const std::vector<float> &features, const FeatureLayout &layout,
+                   const ScanOptions &options, ScanTarget<float> &target) {
+    target.earlyAbandon = true;
+    target.orderBlocks = options.varianceOrder;
+    int dim = static_cast<int>(features.size());
+    if (layout.size() == 1 && layout[0].metric == SEGMENT_L2 && layout[0].offset == 0 &&
+        layout[0].length == static_cast<uint32_t>(dim) && layout[0].weight == 1.0f) {
+        return target.pruned.initEuclidean(features.data(), dim);
+    }
+
+    std::vector<int> ends;
+    std::vector<float> weights;
+    if (!histogramLayout(layout, ends, weights) || ends.back() != dim) {
+        printf("Error, %s features cannot be compared early abandoning!\n", featureMethod.c_str());
         return -1;
     }
 
-    // Target features
-    std::vector<float> targetFeatures;
-    int status = -1;
+    return target.pruned.initIntersection(features.data(), histogramSizes(ends), weights);
+}
 
-    // For custom method
-    std::vector<std::pair<float, std::string>> results;
+/*
+    Offer the distance from a target to every row of a feature database or of a
+    streamed chunk. Sparse rows are merged with the sparse target, dense rows of
+    a sparse store are looked up from it. Dense rows use the batch distance
+    resolved for the scan, so no per-row work depends on the method name.
 
-    if (featureMethod == "resnet") {
-        // Lookup from CSV for ResNet
-        std::string targetName = targetImagePath;
-        
-        // Extract filename only (remove path)
-        size_t pos = targetName.find_last_of("/\\");
-        if (pos != std::string::npos) {
-            targetName = targetName.substr(pos + 1);
+    Parameters:
+        rows: FeatureDatabase or FeatureChunk with element type T
+        target: target prepared for the rows
+        firstId: image ID of the first row
+        top: best matches so far
+*/
+template <typename T, typename Rows>
+void scanRows(const Rows &rows, ScanTarget<T> &target, ImageId firstId, TopN &top) {
+    int dim = rows.dim();
+    if (rows.sparse()) {
+        SparseHistogram<T> sparseRow;
+        const T *dense = nullptr;
+        for (size_t i = 0; i < rows.size(); i++) {
+            float dist = rows.sparseRow(i, sparseRow, dense)
+                             ? sparseHistogramDistance(target.sparse, sparseRow, target.ends, target.weights,
+                                                       target.total)
+                             : sparseHistogramDistance(target.sparse, dense, target.ends, target.weights,
+                                                       target.total);
+            top.push(dist, firstId + static_cast<ImageId>(i));
         }
-        
-        // Find in CSV
-        for (size_t i = 0; i < filenames.size(); i++) {
-            if (std::string(filenames[i]) == targetName) {
-                targetFeatures = data[i];
-                status = 0;
-                break;
+        return;
+    }
+
+    // Float rows may instead be compared one at a time against the Nth best so far
+    if constexpr (std::is_same<T, float>::value) {
+        if (target.earlyAbandon) {
+            if (target.orderBlocks) {
+                target.pruned.orderBlocks(rows.row(0), rows.size(), rows.stride());
+                target.orderBlocks = false;
             }
+            target.pruned.scan(rows.row(0), rows.size(), rows.stride(), firstId, top);
+            return;
         }
-        
-        if (status != 0) {
-            printf("Error: Target image not found in ResNet CSV!\n");
-            return -1;
-        }
-    }
-    else if (featureMethod == "custom") {
-        // Load ResNet CSV
-        std::vector<char*> resnetFilenames;
-        std::vector<std::vector<float>> resnetData;
-        char resnetCSV[] = "ResNet18_olym.csv";
-        read_image_data_csv(resnetCSV, resnetFilenames, resnetData, 0);
-        
-        // Load Color histogram CSV
-        std::vector<char*> colorFilenames;
-        std::vector<std::vector<float>> colorData;
-        char colorCSV[] = "histogram.csv";
-        read_image_data_csv(colorCSV, colorFilenames, colorData, 0);
-        
-        // Extract target filename
-        std::string targetName = targetImagePath;
-        size_t pos = targetName.find_last_of("/\\");
-        if (pos != std::string::npos) {
-            targetName = targetName.substr(pos + 1);
-        }
-        
-        // Find target features in both CSVs
-        std::vector<float> targetResnet, targetColor;
-        for (size_t i = 0; i < resnetFilenames.size(); i++) {
-            std::string fname = resnetFilenames[i];
-            size_t p = fname.find_last_of("/\\");
-            if (p != std::string::npos) fname = fname.substr(p + 1);
-            
-            if (fname == targetName) {
-                targetResnet = resnetData[i];
-                break;
-            }
+    }
+
+    // Dense rows are compared a batch at a time
+    target.distances.resize(SCAN_BATCH_ROWS);
+    for (size_t first = 0; first < rows.size(); first += SCAN_BATCH_ROWS) {
+        size_t count = std::min<size_t>(SCAN_BATCH_ROWS, rows.size() - first);
+        const float *norms = target.cosine ? rows.norms() + first : nullptr;
+        if (target.batchDistances(target, denseRow<T>(rows, first), norms, count, rows.stride(), dim,
+                                  target.distances.data()) != 0) {
+            return;
         }
-        for (size_t i = 0; i < colorFilenames.size(); i++) {
-            std::string fname = colorFilenames[i];
-            size_t p = fname.find_last_of("/\\");
-            if (p != std::string::npos) fname = fname.substr(p + 1);
-            
-            if (fname == targetName) {
-                targetColor = colorData[i];
-                break;
-            }
+        for (size_t i = 0; i < count; i++) {
+            top.push(target.distances[i], firstId + static_cast<ImageId>(first + i));
         }
-        
-        // Compute combined distances
-        for (size_t i = 0; i < resnetData.size(); i++) {
-            float resnetDist = euclideanDistance(targetResnet, resnetData[i]);
-            float colorDist = histogramIntersection(targetColor, colorData[i]);
-            
-            // Normalize resnet (typical range 0-50) to match color (0-1)
-            resnetDist = resnetDist / 50.0f;
-            
-            // Combine
-            float dist = 0.5f * resnetDist + 0.5f * colorDist;
-            
-            results.emplace_back(dist, resnetFilenames[i]);
-        }
-        
-        // Skip the normal distance loop
-        status = 0;
-    }
-    else if (featureMethod == "face") {
-        status = faceDetectHistogram(targetImage, targetFeatures, 16);
-        if (status == -2) {
-            printf("Error, no face detected in target image\n");
+    }
+}
+
+/*
+    Rows [begin, begin + count) of a feature database or streamed chunk, the
+    part of the rows one thread of a parallel scan compares
+*/
+template <typename Rows>
+struct RowRange {
+    const Rows &rows;
+    size_t begin;
+    size_t count;
+
+    size_t size() const { return count; }
+    int dim() const { return rows.dim(); }
+    int stride() const { return rows.stride(); }
+    bool sparse() const { return rows.sparse(); }
+    const float *row(size_t i) const { return rows.row(begin + i); }
+    const uint8_t *rowU8(size_t i) const { return rows.rowU8(begin + i); }
+    const uint16_t *rowU16(size_t i) const { return rows.rowU16(begin + i); }
+    const float *norms() const { return rows.norms() + begin; }
+
+    template <typename T>
+    bool sparseRow(size_t i, SparseHistogram<T> &row, const T *&dense) const {
+        return rows.sparseRow(begin + i, row, dense);
+    }
+};
+
+/*
+    Offer the distance from a target to every row of a feature database or of
+    a streamed chunk, split into one part per thread. Each thread compares its
+    part with its own copy of the target into its own top N, so the threads
+    share nothing but the rows; the heaps are merged once the scan is done.
+
+    Parameters:
+        rows: FeatureDatabase or FeatureChunk with element type T
+        target: target prepared for the rows
+        firstId: image ID of the first row
+        workers: target of each thread, copied from target on the first call
+        tops: best matches of each thread so far
+        pool: threads, one per entry of tops
+*/
+template <typename T, typename Rows>
+void scanParallel(const Rows &rows, ScanTarget<T> &target, ImageId firstId, std::vector<ScanTarget<T>> &workers,
+                  std::vector<TopN> &tops, ThreadPool &pool) {
+    if (rows.size() == 0) {
+        return;
+    }
+
+    // Blocks are ordered once, on the first rows, and every thread visits them in that order
+    if constexpr (std::is_same<T, float>::value) {
+        if (target.earlyAbandon && target.orderBlocks) {
+            target.pruned.orderBlocks(rows.row(0), rows.size(), rows.stride());
+            target.orderBlocks = false;
+        }
+    }
+
+    // The copies share the sparse target of the original, which is only read
+    if (workers.empty()) {
+        workers.assign(tops.size(), target);
+    }
+
+    // Norms a database computes on first use are computed before the threads read them
+    if (target.cosine) {
+        rows.norms();
+    }
+
+    size_t part = (rows.size() + tops.size() - 1) / tops.size();
+    pool.runAll(static_cast<int>(tops.size()), [&](int t) {
+        size_t begin = std::min(rows.size(), t * part);
+        size_t count = std::min(part, rows.size() - begin);
+        if (count > 0) {
+            scanRows(RowRange<Rows>{rows, begin, count}, workers[t], firstId + static_cast<ImageId>(begin), tops[t]);
+        }
+    });
+}
+
+/*
+    Scan a loaded feature database or a streamed store for the best matches
+
+    Parameters:
+        featureMethod: feature method
+        options: metric and pruning of the scan
+        features: target features
+        layout: segments the rows are compared by
+        database: loaded database, used when stream is nullptr
+        stream: open store stream
+        top: best matches
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+template <typename T>
+int scanFeatures(const std::string &featureMethod, const ScanOptions &options, const std::vector<float> &features,
+                 const FeatureLayout &layout, const FeatureDatabase &database, FeatureStoreStream *stream,
+                 TopN &top) {
+    ScanTarget<T> target;
+    if constexpr (std::is_same<T, float>::value) {
+        if (options.earlyAbandon && preparePruning(featureMethod, features, layout, options, target) != 0) {
+            return -1;
+        }
+    }
+
+    // Parallel scans keep a target and a top N per thread and merge the heaps at the end
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<ScanTarget<T>> workers;
+    std::vector<TopN> tops;
+    if (options.threads > 1) {
+        pool = std::make_unique<ThreadPool>(options.threads);
+        tops.assign(options.threads, top);
+    }
+
+    int status = 0;
+    if (stream) {
+        prepareTarget(features, layout, stream->quantTotal(), stream->sparse(), target);
+        if (resolveDistances(featureMethod, target) != 0) {
             return -1;
         }
+        stream->readNorms(target.cosine);
+
+        const FeatureChunk *chunk = nullptr;
+        long count;
+        while ((count = stream->next(chunk)) > 0) {
+            if (pool) {
+                scanParallel(*chunk, target, chunk->firstId(), workers, tops, *pool);
+            }
+            else {
+                scanRows(*chunk, target, chunk->firstId(), top);
+            }
+        }
+        status = count < 0 ? -1 : 0;
     }
     else {
-        // Compute features for tasks 1-4
-        cv::Mat targetImage = cv::imread(targetImagePath);
-        if (targetImage.empty()) {
-            printf("Error loading target image!\n");
+        prepareTarget(features, layout, database.quantTotal(), database.sparse(), target);
+        if (resolveDistances(featureMethod, target) != 0) {
             return -1;
         }
+        if (pool) {
+            scanParallel(database, target, 0, workers, tops, *pool);
+        }
+        else {
+            scanRows(database, target, 0, top);
+        }
+    }
+
+    for (const TopN &threadTop : tops) {
+        top.merge(threadTop);
+    }
+    return status;
+}
+
+// Targets compared with each batch of rows at once by a batch scan
+#define BATCH_TARGETS 64
+
+// Rows compared with every target before the next ones when a batch scan uses the single target kernels
+#define BATCH_BLOCK_ROWS 1024
+
+// Targets of a batch scan, one row of a matrix each
+struct BatchTargets {
+    std::vector<float> matrix;          // count targets of dim features
+    size_t count = 0;
+    int dim = 0;
+    FeatureLayout layout;               // segments the rows are compared by
+    bool cosine = false;                // a cosine segment covers the rows, so use their norms
+    bool expand = false;                // a single euclidean segment, found from dot products
+    std::vector<float> squaredNorms;    // squared L2 norm of each target, when expanding
+    float slack = 0;                    // rounding error of an expanded distance per unit of squared norm
+};
+
+// Best matches of one target found by one thread of a batch scan
+struct BatchMatches {
+    TopN top;       // distances as a single target scan computes them
+    TopN bounds;    // when expanding, upper bounds of the squared euclidean distance
+};
+
+/*
+    Offer the distances from a block of targets to every row of a feature
+    database or of a streamed chunk. The rows are compared SCAN_BATCH_ROWS at a
+    time with all the targets of the block, as one distance block, so each
+    batch is read from memory once per block instead of once per target.
 
-        if (featureMethod == "baseline") {
-            status = baseline7x7(targetImage, targetFeatures);
+    A single euclidean segment is expanded as |a|^2 + |b|^2 - 2ab from the row
+    norms and one dot product block. That value differs from the euclidean
+    distance of a single target scan by rounding, by at most slack times the
+    squared norms, so it only decides which rows are compared exactly: a row
+    whose lower bound is above the Nth smallest upper bound so far cannot make
+    the top N. The exact distances of the others are pushed, and the result
+    is the one of single target scans.
+
+    Parameters:
+        rows: FeatureDatabase, FeatureChunk or RowRange of dense float rows
+        targets: targets of the scan
+        first: first target of the block
+        count: number of targets in the block
+        firstId: image ID of the first row
+        matches: best matches of each target of the block
+        block: distance block, reused between calls
+
+    Returns:
+        0 on success
+        -1 if the layout does not fit the rows
+*/
+template <typename Rows>
+int batchRows(const Rows &rows, const BatchTargets &targets, size_t first, size_t count, ImageId firstId,
+               BatchMatches *matches, std::vector<float> &block) {
+    int dim = rows.dim();
+    const float *queries = targets.matrix.data() + first * dim;
+    block.resize(count * SCAN_BATCH_ROWS);
+
+    for (size_t begin = 0; begin < rows.size(); begin += SCAN_BATCH_ROWS) {
+        size_t batch = std::min<size_t>(SCAN_BATCH_ROWS, rows.size() - begin);
+        const float *tile = rows.row(begin);
+        ImageId id = firstId + static_cast<ImageId>(begin);
+
+        if (!targets.expand) {
+            const float *norms = targets.cosine ? rows.norms() + begin : nullptr;
+            if (layoutDistanceBlock(queries, count, dim, tile, batch, rows.stride(), dim, targets.layout,
+                                    block.data(), norms) != 0) {
+                return -1;
+            }
+            for (size_t q = 0; q < count; q++) {
+                for (size_t r = 0; r < batch; r++) {
+                    matches[q].top.push(block[q * batch + r], id + static_cast<ImageId>(r));
+                }
+            }
+            continue;
         }
-        else if (featureMethod == "chistogram") {
-            status = colorHistogram(targetImage, targetFeatures, 16);
+
+        dotProductBlock(queries, count, dim, tile, batch, rows.stride(), dim, block.data());
+        const float *norms = rows.norms() + begin;
+        for (size_t q = 0; q < count; q++) {
+            const float *query = queries + q * dim;
+            float targetSquared = targets.squaredNorms[first + q];
+            BatchMatches &match = matches[q];
+            for (size_t r = 0; r < batch; r++) {
+                float rowSquared = norms[r] * norms[r];
+                float expanded = targetSquared + rowSquared - 2.0f * block[q * batch + r];
+                float error = targets.slack * (targetSquared + rowSquared);
+
+                // The margin keeps rows whose distance could round to that of the Nth match
+                float bound = match.bounds.bound();
+                if (expanded - error <= bound + bound * (16 * FLT_EPSILON)) {
+                    match.top.push(layoutDistance(query, tile + r * rows.stride(), targets.layout),
+                                   id + static_cast<ImageId>(r));
+                }
+                match.bounds.push(expanded + error, id + static_cast<ImageId>(r));
+            }
         }
-        else if (featureMethod == "texture") {
-            status = textureAndColor(targetImage, targetFeatures);
+    }
+    return 0;
+}
+
+/*
+    Offer the distances from every target to the rows of a feature database or
+    of a streamed chunk, block of targets by block of targets. The rows are
+    split into one part per thread as in scanParallel.
+
+    Parameters:
+        rows: FeatureDatabase or FeatureChunk of dense float rows
+        targets: targets of the scan
+        firstId: image ID of the first row
+        matches: best matches of each thread, count entries per thread
+        blocks: distance block of each thread
+        pool: threads, one per block, nullptr to scan on this thread
+
+    Returns:
+        0 on success
+        -1 if a block of rows could not be compared
+*/
+template <typename Rows>
+int batchScan(const Rows &rows, const BatchTargets &targets, ImageId firstId,
+              std::vector<std::vector<BatchMatches>> &matches, std::vector<std::vector<float>> &blocks,
+              ThreadPool *pool) {
+    if (rows.size() == 0) {
+        return 0;
+    }
+
+    // Norms a database computes on first use are computed before the threads read them
+    if (targets.cosine || targets.expand) {
+        rows.norms();
+    }
+
+    size_t threads = matches.size();
+    size_t part = (rows.size() + threads - 1) / threads;
+    std::vector<int> status(threads, 0);
+    for (size_t first = 0; first < targets.count; first += BATCH_TARGETS) {
+        size_t count = std::min<size_t>(BATCH_TARGETS, targets.count - first);
+        auto scanPart = [&](int t) {
+            size_t begin = std::min(rows.size(), t * part);
+            size_t size = std::min(part, rows.size() - begin);
+            if (size > 0) {
+                status[t] = batchRows(RowRange<Rows>{rows, begin, size}, targets, first, count,
+                                      firstId + static_cast<ImageId>(begin), matches[t].data() + first, blocks[t]);
+            }
+        };
+
+        if (pool) {
+            pool->runAll(static_cast<int>(threads), scanPart);
         }
         else {
-            printf("Feature method not valid!\n");
-            return -1;
+            scanPart(0);
         }
 
-        if (status != 0) {
-            printf("Error: Feature extraction failed!\n");
+        if (std::find(status.begin(), status.end(), -1) != status.end()) {
             return -1;
         }
     }
+    return 0;
+}
 
+/*
+    Scan dense float rows for the best matches of many targets at once
 
-    // Compute distances (skip for custom - already done)
-    if (featureMethod != "custom") {
-        for (size_t i = 0; i < data.size(); i++) {
-            float dist = -1.0f;
+    Parameters:
+        options: threads of the scan
+        features: features of each target
+        layout: segments the rows are compared by
+        database: loaded database, used when stream is nullptr
+        stream: open store stream
+        tops: best matches of each target
 
-            // Compute distance using appropriate distance metric
-            if (featureMethod == "baseline") {
-                dist = euclideanDistance(targetFeatures, data[i]);
-            }
-            else if (featureMethod == "chistogram") {
-                dist = histogramIntersection(targetFeatures, data[i]);
-            }
-            else if (featureMethod == "mhistogram") {
-                dist = multiHistogramDistance(targetFeatures, data[i], 0.5f);
+    Returns:
+        0 on success
+        -1 on error
+*/
+int scanBatch(const ScanOptions &options, const std::vector<std::vector<float>> &features,
+              const FeatureLayout &layout, const FeatureDatabase &database, FeatureStoreStream *stream,
+              std::vector<TopN> &tops) {
+    BatchTargets targets;
+    targets.count = features.size();
+    targets.dim = stream ? stream->dim() : database.dim();
+    targets.layout = layout;
+    targets.matrix.reserve(targets.count * targets.dim);
+    for (const std::vector<float> &target : features) {
+        targets.matrix.insert(targets.matrix.end(), target.begin(), target.end());
+    }
+    for (const FeatureSegment &segment : layout) {
+        targets.cosine = targets.cosine || (segment.metric == SEGMENT_COSINE && segment.offset == 0 &&
+                                            segment.length == static_cast<uint32_t>(targets.dim));
+    }
+
+    // Errors of the dot products and norms, summed in KERNEL_LANES lanes, and of the
+    // euclidean distance they stand in for, with a factor of two to spare
+    targets.expand = layout.size() == 1 && layout[0].metric == SEGMENT_L2 && layout[0].offset == 0 &&
+                     layout[0].length == static_cast<uint32_t>(targets.dim) && layout[0].weight > 0;
+    if (targets.expand) {
+        targets.slack = (targets.dim / 8 + 32) * FLT_EPSILON;
+        for (size_t q = 0; q < targets.count; q++) {
+            float norm = l2Norm(targets.matrix.data() + q * targets.dim, targets.dim);
+            targets.squaredNorms.push_back(norm * norm);
+        }
+    }
+
+    std::unique_ptr<ThreadPool> pool;
+    if (options.threads > 1) {
+        pool = std::make_unique<ThreadPool>(options.threads);
+    }
+    std::vector<std::vector<BatchMatches>> matches(options.threads);
+    for (std::vector<BatchMatches> &threadMatches : matches) {
+        for (const TopN &top : tops) {
+            threadMatches.push_back({top, top});
+        }
+    }
+    std::vector<std::vector<float>> blocks(options.threads);
+
+    int status = 0;
+    if (stream) {
+        stream->readNorms(targets.cosine || targets.expand);
+
+        const FeatureChunk *chunk = nullptr;
+        long count;
+        while ((count = stream->next(chunk)) > 0) {
+            if (batchScan(*chunk, targets, chunk->firstId(), matches, blocks, pool.get()) != 0) {
+                return -1;
             }
-            else if (featureMethod == "texture") {
-                dist = textureColorDistance(targetFeatures, data[i], 0.4f);
+        }
+        status = count < 0 ? -1 : 0;
+    }
+    else {
+        status = batchScan(database, targets, 0, matches, blocks, pool.get());
+    }
+
+    for (const std::vector<BatchMatches> &threadMatches : matches) {
+        for (size_t q = 0; q < tops.size(); q++) {
+            tops[q].merge(threadMatches[q].top);
+        }
+    }
+    return status;
+}
+
+/*
+    Offer the distances from many targets to the rows of a feature database or
+    of a streamed chunk with the kernels of a single target scan, for rows that
+    scanBatch does not take. The rows are split into one part per thread and
+    each part is compared BATCH_BLOCK_ROWS rows at a time with every target,
+    so a block is read from memory once for all of them.
+
+    Parameters:
+        rows: FeatureDatabase or FeatureChunk with element type T
+        target: target of each target prepared for the rows
+        firstId: image ID of the first row
+        workers: targets of each thread, copied from target on the first call
+        tops: best matches of each thread, one per target
+        pool: threads, one per entry of tops, nullptr to scan on this thread
+*/
+template <typename T, typename Rows>
+void scanTargetBlocks(const Rows &rows, std::vector<ScanTarget<T>> &target, ImageId firstId,
+                      std::vector<std::vector<ScanTarget<T>>> &workers, std::vector<std::vector<TopN>> &tops,
+                      ThreadPool *pool) {
+    if (rows.size() == 0) {
+        return;
+    }
+
+    // Blocks are ordered once, on the first rows, and every thread visits them in that order
+    if constexpr (std::is_same<T, float>::value) {
+        for (ScanTarget<T> &scanTarget : target) {
+            if (scanTarget.earlyAbandon && scanTarget.orderBlocks) {
+                scanTarget.pruned.orderBlocks(rows.row(0), rows.size(), rows.stride());
+                scanTarget.orderBlocks = false;
             }
-            else if (featureMethod == "resnet") {
-                dist = euclideanDistance(targetFeatures, data[i]);
+        }
+    }
+
+    if (workers.empty()) {
+        workers.assign(tops.size(), target);
+    }
+
+    size_t part = (rows.size() + tops.size() - 1) / tops.size();
+    auto scanPart = [&](int t) {
+        size_t end = std::min(rows.size(), (t + 1) * part);
+        for (size_t begin = t * part; begin < end; begin += BATCH_BLOCK_ROWS) {
+            size_t count = std::min<size_t>(BATCH_BLOCK_ROWS, end - begin);
+            for (size_t k = 0; k < target.size(); k++) {
+                scanRows(RowRange<Rows>{rows, begin, count}, workers[t][k], firstId + static_cast<ImageId>(begin),
+                         tops[t][k]);
             }
-            else if (featureMethod == "face") {
-                dist = faceDetectDistance(targetFeatures, data[i], 0.2f, 0.6f, 0.2f);
+        }
+    };
+
+    if (pool) {
+        pool->runAll(static_cast<int>(tops.size()), scanPart);
+    }
+    else {
+        scanPart(0);
+    }
+}
+
+/*
+    Scan a loaded feature database or a streamed store for the best matches of
+    many targets at once, with the kernels of a single target scan
+
+    Parameters:
+        featureMethod: feature method
+        options: metric, pruning and threads of the scan
+        features: features of each target
+        layout: segments the rows are compared by
+        database: loaded database, used when stream is nullptr
+        stream: open store stream
+        tops: best matches of each target
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+template <typename T>
+int scanTargets(const std::string &featureMethod, const ScanOptions &options,
+                const std::vector<std::vector<float>> &features, const FeatureLayout &layout,
+                const FeatureDatabase &database, FeatureStoreStream *stream, std::vector<TopN> &tops) {
+    uint32_t total = stream ? stream->quantTotal() : database.quantTotal();
+    bool sparseRows = stream ? stream->sparse() : database.sparse();
+
+    std::vector<ScanTarget<T>> target(features.size());
+    bool cosine = false;
+    for (size_t k = 0; k < features.size(); k++) {
+        if constexpr (std::is_same<T, float>::value) {
+            if (options.earlyAbandon && preparePruning(featureMethod, features[k], layout, options, target[k]) != 0) {
+                return -1;
             }
+        }
+        prepareTarget(features[k], layout, total, sparseRows, target[k]);
+        if (resolveDistances(featureMethod, target[k]) != 0) {
+            return -1;
+        }
+        cosine = cosine || target[k].cosine;
+    }
+
+    std::unique_ptr<ThreadPool> pool;
+    if (options.threads > 1) {
+        pool = std::make_unique<ThreadPool>(options.threads);
+    }
+    std::vector<std::vector<ScanTarget<T>>> workers;
+    std::vector<std::vector<TopN>> threadTops(options.threads, tops);
+
+    int status = 0;
+    if (stream) {
+        stream->readNorms(cosine);
+
+        const FeatureChunk *chunk = nullptr;
+        long count;
+        while ((count = stream->next(chunk)) > 0) {
+            scanTargetBlocks(*chunk, target, chunk->firstId(), workers, threadTops, pool.get());
+        }
+        status = count < 0 ? -1 : 0;
+    }
+    else {
+        // Norms a database computes on first use are computed before the threads read them
+        if (cosine) {
+            database.norms();
+        }
+        scanTargetBlocks(database, target, 0, workers, threadTops, pool.get());
+    }
+
+    for (const std::vector<TopN> &threadTop : threadTops) {
+        for (size_t k = 0; k < tops.size(); k++) {
+            tops[k].merge(threadTop[k]);
+        }
+    }
+    return status;
+}
+
+// Feature file queries run against, and the scale its targets are decoded at
+struct QuerySource {
+    std::string featureMethod;
+    std::string featureFile;                        // as given, for messages
+    FeatureDatabase database;                       // loaded rows, empty when streaming
+    std::unique_ptr<FeatureStoreStream> stream;     // open store when streaming
+    int decodeScale = 1;
+};
+
+/*
+    Loads the ResNet and color histogram files of the custom method and joins them
+    into one database compared by a fused layout
+
+    Parameters:
+        database: output database
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int loadCustomFeatures(FeatureDatabase &database) {
+    FeatureDatabase resnetDatabase;
+    FeatureDatabase colorDatabase;
+    if (resnetDatabase.load("ResNet18_olym.csv") != 0 || colorDatabase.load("histogram.csv") != 0) {
+        printf("Error reading the custom feature files ResNet18_olym.csv and histogram.csv\n");
+        return -1;
+    }
 
-            // Store results
-            if (dist >= 0) {
-                results.emplace_back(dist, filenames[i]);
+    // Rows are joined by image file name, images missing from histogram.csv are skipped.
+    // Resnet distances (typical range 0-50) are scaled to match color (0-1), then weighted 0.5 each
+    int resnetDim = resnetDatabase.dim();
+    int colorDim = colorDatabase.dim();
+    std::vector<float> joined(resnetDim + colorDim);
+    database.reserve(resnetDatabase.size(), resnetDim + colorDim);
+    size_t missing = 0;
+    for (ImageId id = 0; id < resnetDatabase.size(); id++) {
+        const char *name = resnetDatabase.name(id);
+        size_t length = strlen(name);
+        size_t base = baseNameOffset(name, length);
+        ImageId colorId;
+        if (colorDatabase.findName(name + base, length - base, colorId) != 0) {
+            if (missing == 0) {
+                printf("Warning: %s is not in histogram.csv, skipping it\n", name);
             }
+            missing++;
+            continue;
         }
+
+        std::copy(resnetDatabase.row(id), resnetDatabase.row(id) + resnetDim, joined.begin());
+        std::copy(colorDatabase.row(colorId), colorDatabase.row(colorId) + colorDim, joined.begin() + resnetDim);
+        database.addRow(name, length, joined.data(), joined.size());
+    }
+    if (missing > 0) {
+        printf("Warning: skipped %zu images of ResNet18_olym.csv that are not in histogram.csv\n", missing);
+    }
+    if (database.size() == 0) {
+        printf("Error, no image of ResNet18_olym.csv is in histogram.csv\n");
+        return -1;
     }
+    database.setLayout({{0, static_cast<uint32_t>(resnetDim), SEGMENT_L2, 0.5f / 50.0f},
+                        {static_cast<uint32_t>(resnetDim), static_cast<uint32_t>(colorDim),
+                         SEGMENT_INTERSECTION, 0.5f}});
+    database.indexNames();
+
+    return 0;
+}
+
+/*
+    Loads a feature file, or only opens it when streaming, and resolves the scale
+    targets are decoded at
+
+    Parameters:
+        featureMethod: feature method of the file
+        featureFile: feature CSV or binary store, unused for custom
+        streaming: read a binary store in chunks instead of loading it
+        chunkMB: chunk size when streaming
+        decodeScale: requested scale, 0 to use the one the file was built with
+        source: output source
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int openSource(const std::string &featureMethod, const std::string &featureFile, bool streaming, int chunkMB,
+               int decodeScale, QuerySource &source) {
+    source.featureMethod = featureMethod;
+    source.featureFile = featureFile;
 
-    // Sort by ascending distance
-    std::sort(results.begin(), results.end(),
-                [](const auto &a, const auto &b) {
-                    return a.first < b.first;
-                });
-    
-    // Output top N image matches
-    printf("The top %d image matches:\n", N);
+    // Read feature file, or only its header when streaming
+    if (featureMethod == "custom") {
+        source.featureFile = "ResNet18_olym.csv";
+        if (loadCustomFeatures(source.database) != 0) {
+            return -1;
+        }
+    }
+    else if (streaming) {
+        if (!isFeatureStoreFile(featureFile)) {
+            printf("Error, --stream needs a binary feature store, convert %s with convertFeatures\n",
+                   featureFile.c_str());
+            return -1;
+        }
+        source.stream = std::make_unique<FeatureStoreStream>();
+        if (source.stream->open(featureFile, static_cast<size_t>(chunkMB) << 20) != 0) {
+            return -1;
+        }
+    }
+    else if (source.database.load(featureFile) != 0) {
+        printf("Error reading feature file %s\n", featureFile.c_str());
+        return -1;
+    }
 
-    for (int i = 0; i < std::min(N, (int)results.size()); i++) {
-        printf("%d: %s  (distance = %.5f)\n", i + 1,results[i].second.c_str(), results[i].first);
+    // Decode the target at the scale the database was built with, as recorded in
+    // the binary store header or in the manifest of a CSV
+    if (!methodSupportsDecodeScale(featureMethod)) {
+        decodeScale = 1;
+    }
+    else if (decodeScale == 0) {
+        std::unordered_map<std::string, ManifestEntry> manifest;
+        decodeScale = source.stream ? source.stream->decodeScale() : source.database.decodeScale();
+        if (decodeScale == 0 && readManifest(manifestPath(featureFile), manifest, &decodeScale) != 0) {
+            decodeScale = 1;
+        }
     }
 
-    // Cleanup
-    for (char* f : filenames) {
-        delete[] f;
+    if (!validDecodeScale(decodeScale)) {
+        printf("Error, decode scale must be 1, 2, 4 or 8!\n");
+        return -1;
     }
+    source.decodeScale = decodeScale;
 
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+    Finds the row of a target image with the name index, by its path or else
+    by its file name
+
+    Parameters:
+        source: feature file queried
+        target: image path
+        id: output image ID
+
+    Returns:
+        0 if the image was found
+        -1 otherwise
+*/
+int findTarget(const QuerySource &source, const std::string &target, ImageId &id) {
+    auto find = [&](const char *key, size_t length) {
+        return source.stream ? source.stream->findName(key, length, id) : source.database.findName(key, length, id);
+    };
+
+    size_t base = baseNameOffset(target.data(), target.size());
+    if (find(target.data(), target.size()) == 0) {
+        return 0;
+    }
+    return base > 0 ? find(target.data() + base, target.size() - base) : -1;
+}
+
+/*
+    Features of a target: a row of the feature file for "#<id>", the stored row of
+    the image for resnet and custom, and otherwise extracted from the image
+
+    Parameters:
+        source: feature file queried
+        target: image path or "#<id>"
+        features: output features
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int targetFeatures(const QuerySource &source, const std::string &target, std::vector<float> &features) {
+    const std::string &featureMethod = source.featureMethod;
+    const FeatureDatabase &database = source.database;
+    FeatureStoreStream *stream = source.stream.get();
+
+    if (target.size() > 1 && target[0] == '#') {
+        char *end;
+        unsigned long long id = strtoull(target.c_str() + 1, &end, 10);
+        if (*end != '\0' || id >= (stream ? stream->rows() : database.size())) {
+            printf("Error, %s is not an image ID of %s\n", target.c_str(), source.featureFile.c_str());
+            return -1;
+        }
+        if (stream) {
+            return stream->readRow(static_cast<ImageId>(id), features);
+        }
+        features.resize(database.dim());
+        database.copyRow(static_cast<ImageId>(id), features.data());
+        return 0;
+    }
+
+    // Resnet and custom features are looked up by image name
+    if (featureMethod == "resnet" || featureMethod == "custom") {
+        ImageId targetId;
+        if (findTarget(source, target, targetId) != 0) {
+            printf(featureMethod == "resnet" ? "Error: Target image not found in ResNet CSV!\n"
+                                             : "Error: Target image not found in the custom feature files!\n");
+            return -1;
+        }
+        if (stream) {
+            return stream->readRow(targetId, features);
+        }
+        features.resize(database.dim());
+        database.copyRow(targetId, features.data());
+        return 0;
+    }
+
+    // Load target image
+    cv::Mat targetImage;
+    if (readImage(target, targetImage, source.decodeScale) != 0) {
+        printf("Error loading target image!\n");
+        return -1;
+    }
+
+    int status;
+    if (featureMethod == "face") {
+        status = faceDetectHistogram(targetImage, features, 16);
+        if (status == -2) {
+            printf("Error, no face detected in target image\n");
+            return -1;
+        }
+        return status;
+    }
+
+    // Compute features for tasks 1-4
+    if (featureMethod == "baseline") {
+        status = baseline7x7(targetImage, features);
+    }
+    else if (featureMethod == "chistogram") {
+        status = colorHistogram(targetImage, features, 16);
+    }
+    else if (featureMethod == "mhistogram") {
+        status = multiHistogram(targetImage, features, 16);
+    }
+    else if (featureMethod == "texture") {
+        status = textureAndColor(targetImage, features);
+    }
+    else {
+        printf("Feature method not valid!\n");
+        return -1;
+    }
+
+    if (status != 0) {
+        printf("Error: Feature extraction failed!\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Layout the rows of a feature file are compared by: the one recorded in a binary
+    store, or else the layout of the method, or a single cosine segment for the
+    cosine metric. Checks that the rows can be scanned that way.
+
+    Parameters:
+        source: feature file queried
+        options: how rows are compared
+        layout: output segments
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int scanLayout(const QuerySource &source, const ScanOptions &options, FeatureLayout &layout) {
+    const std::string &featureMethod = source.featureMethod;
+    const char *featureFile = source.featureFile.c_str();
+    const FeatureStoreStream *stream = source.stream.get();
+
+    int dtype = stream ? stream->dtype() : source.database.dtype();
+    bool sparseRows = stream ? stream->sparse() : source.database.sparse();
+    int dim = stream ? stream->dim() : source.database.dim();
+    layout = stream ? stream->featureLayout() : source.database.featureLayout();
+    if (options.metric == "cosine") {
+        layout = {{0, static_cast<uint32_t>(dim), SEGMENT_COSINE, 1.0f}};
+    }
+    else if (layout.empty() && methodLayout(featureMethod, dim, layout) != 0) {
+        printf("Error, %s does not hold %s features!\n", featureFile, featureMethod.c_str());
+        return -1;
+    }
+
+    // Quantized and sparse stores are scanned with their own kernels against the
+    // target quantized the same way, histogram by histogram
+    std::vector<int> ends;
+    std::vector<float> weights;
+    if ((dtype != FEATURE_STORE_FLOAT32 || sparseRows) && (!histogramLayout(layout, ends, weights) || ends.back() != dim)) {
+        printf("Error, %s is quantized or sparse but does not hold %s histograms!\n", featureFile,
+               featureMethod.c_str());
+        return -1;
+    }
+
+    if (options.earlyAbandon && (dtype != FEATURE_STORE_FLOAT32 || sparseRows)) {
+        printf("Error, early abandoning needs dense float features, %s is quantized or sparse\n", featureFile);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Checks that target features fit the rows of a feature file
+
+    Parameters:
+        source: feature file queried
+        features: target features
+
+    Returns:
+        0 if they have as many features as the rows
+        -1 otherwise
+*/
+int checkTarget(const QuerySource &source, const std::vector<float> &features) {
+    int dim = source.stream ? source.stream->dim() : source.database.dim();
+    if (features.size() != static_cast<size_t>(dim)) {
+        printf("Error, the target has %zu features, %s holds %d\n", features.size(), source.featureFile.c_str(),
+               dim);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Scans a feature file for the best matches of one target
+
+    Parameters:
+        source: feature file queried
+        options: how rows are compared
+        layout: segments the rows are compared by, from scanLayout
+        features: target features, checked by checkTarget
+        top: best matches, IDs refer to the database or to the streamed store
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int findMatches(const QuerySource &source, const ScanOptions &options, const FeatureLayout &layout,
+                const std::vector<float> &features, TopN &top) {
+    const std::string &featureMethod = source.featureMethod;
+    const FeatureDatabase &database = source.database;
+    FeatureStoreStream *stream = source.stream.get();
+
+    int dtype = stream ? stream->dtype() : database.dtype();
+    int status;
+    if (dtype == FEATURE_STORE_UINT8) {
+        status = scanFeatures<uint8_t>(featureMethod, options, features, layout, database, stream, top);
+    }
+    else if (dtype == FEATURE_STORE_UINT16) {
+        status = scanFeatures<uint16_t>(featureMethod, options, features, layout, database, stream, top);
+    }
+    else {
+        status = scanFeatures<float>(featureMethod, options, features, layout, database, stream, top);
+    }
+
+    if (status != 0) {
+        printf("Error scanning feature file %s\n", source.featureFile.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Formats the best matches, one line per match in ascending distance
+
+    Parameters:
+        source: feature file queried
+        top: best matches
+        N: number of matches asked for
+        reply: output, the formatted matches are appended
+*/
+void formatMatches(const QuerySource &source, const TopN &top, int N, std::string &reply) {
+    FeatureStoreStream *stream = source.stream.get();
+    std::vector<Match> matches = top.sorted();
+    char line[128];
+    snprintf(line, sizeof(line), "The top %d image matches:\n", N);
+    reply += line;
+
+    std::string name;
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (stream && stream->readName(matches[i].second, name) != 0) {
+            name = "?";
+        }
+        snprintf(line, sizeof(line), "%d: ", static_cast<int>(i) + 1);
+        reply += line;
+        reply += stream ? name.c_str() : source.database.name(matches[i].second);
+        snprintf(line, sizeof(line), "  (distance = %.5f)\n", matches[i].first);
+        reply += line;
+    }
+}
+
+/*
+    Finds the top N matches of a target and formats them, one line per match
+
+    Parameters:
+        source: feature file queried
+        target: image path or "#<id>"
+        N: number of matches
+        options: how rows are compared
+        reply: output, the formatted matches are appended
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int matchTarget(const QuerySource &source, const std::string &target, int N, const ScanOptions &options,
+                std::string &reply) {
+    std::vector<float> features;
+    FeatureLayout layout;
+    if (targetFeatures(source, target, features) != 0 || scanLayout(source, options, layout) != 0 ||
+        checkTarget(source, features) != 0) {
+        return -1;
+    }
+
+    TopN top(N);
+    if (findMatches(source, options, layout, features, top) != 0) {
+        return -1;
+    }
+
+    formatMatches(source, top, N, reply);
+    return 0;
+}
+
+/*
+    Batch mode: finds the top N matches of every target listed in a file and
+    prints them target by target. Dense float rows are scanned once for blocks
+    of targets by scanBatch, quantized and sparse rows and early abandoning
+    by scanTargets.
+
+    Parameters:
+        source: feature file queried
+        targetList: file with one image path or "#<id>" per line, "-" for stdin
+        N: number of matches per target
+        options: how rows are compared
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int matchBatch(const QuerySource &source, const std::string &targetList, int N, const ScanOptions &options) {
+    FILE *fp = targetList == "-" ? stdin : fopen(targetList.c_str(), "r");
+    if (!fp) {
+        printf("Unable to open target list %s\n", targetList.c_str());
+        return -1;
+    }
+
+    std::vector<std::string> targets;
+    char buffer[4096];
+    while (fgets(buffer, sizeof(buffer), fp)) {
+        std::string line = buffer;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            targets.push_back(line);
+        }
+    }
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    FeatureLayout layout;
+    if (scanLayout(source, options, layout) != 0) {
+        return -1;
+    }
+
+    // Targets are decoded and extracted on the scan threads, a failed target is skipped
+    std::vector<std::vector<float>> features(targets.size());
+    std::vector<int> status(targets.size());
+    auto extract = [&](int i) {
+        status[i] = targetFeatures(source, targets[i], features[i]) != 0 || checkTarget(source, features[i]) != 0
+                        ? -1
+                        : 0;
+    };
+    if (options.threads > 1) {
+        ThreadPool pool(options.threads);
+        pool.runAll(static_cast<int>(targets.size()), extract);
+    }
+    else {
+        for (size_t i = 0; i < targets.size(); i++) {
+            extract(static_cast<int>(i));
+        }
+    }
+
+    std::vector<size_t> found;
+    std::vector<std::vector<float>> foundFeatures;
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (status[i] != 0) {
+            printf("Error, skipping target %s\n", targets[i].c_str());
+            continue;
+        }
+        found.push_back(i);
+        foundFeatures.push_back(std::move(features[i]));
+    }
+
+    int dtype = source.stream ? source.stream->dtype() : source.database.dtype();
+    bool sparseRows = source.stream ? source.stream->sparse() : source.database.sparse();
+    std::vector<TopN> tops(found.size(), TopN(N));
+    if (found.empty()) {
+        return 0;
+    }
+    if (dtype == FEATURE_STORE_FLOAT32 && !sparseRows && !options.earlyAbandon) {
+        if (scanBatch(options, foundFeatures, layout, source.database, source.stream.get(), tops) != 0) {
+            printf("Error scanning feature file %s\n", source.featureFile.c_str());
+            return -1;
+        }
+    }
+    else {
+        int status;
+        if (dtype == FEATURE_STORE_UINT8) {
+            status = scanTargets<uint8_t>(source.featureMethod, options, foundFeatures, layout, source.database,
+                                          source.stream.get(), tops);
+        }
+        else if (dtype == FEATURE_STORE_UINT16) {
+            status = scanTargets<uint16_t>(source.featureMethod, options, foundFeatures, layout, source.database,
+                                           source.stream.get(), tops);
+        }
+        else {
+            status = scanTargets<float>(source.featureMethod, options, foundFeatures, layout, source.database,
+                                        source.stream.get(), tops);
+        }
+        if (status != 0) {
+            printf("Error scanning feature file %s\n", source.featureFile.c_str());
+            return -1;
+        }
+    }
+
+    for (size_t k = 0; k < found.size(); k++) {
+        std::string reply = "Target: " + targets[found[k]] + "\n";
+        formatMatches(source, tops[k], N, reply);
+        printf("%s\n", reply.c_str());
+    }
+
+    return 0;
+}
+
+/*
+    Parses one scan option, shared by the command line and server requests
+
+    Parameters:
+        args: arguments
+        i: index of the option, advanced past its value
+        options: output options
+
+    Returns:
+        true if the option was recognized
+*/
+bool parseScanOption(const std::vector<std::string> &args, size_t &i, ScanOptions &options) {
+    const std::string &option = args[i];
+    if (option == "--metric" && i + 1 < args.size()) {
+        options.metric = args[++i];
+    }
+    else if (option == "--early-abandon") {
+        options.earlyAbandon = true;
+    }
+    else if (option == "--variance-order") {
+        options.earlyAbandon = true;
+        options.varianceOrder = true;
+    }
+    else if (option == "--threads" && i + 1 < args.size()) {
+        options.threads = std::atoi(args[++i].c_str());
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Checks the scan options of a query
+
+    Parameters:
+        featureMethod: feature method queried
+        options: scan options
+
+    Returns:
+        empty if the options are valid
+        the error message otherwise
+*/
+std::string scanOptionsError(const std::string &featureMethod, const ScanOptions &options) {
+    if (options.threads < 1) {
+        return "Error, the number of threads must be at least 1!";
+    }
+
+    if (options.metric != "euclidean" && (options.metric != "cosine" || featureMethod != "resnet")) {
+        return "Error, metric " + options.metric + " is not supported for " + featureMethod +
+               ", resnet takes euclidean or cosine";
+    }
+
+    return "";
+}
+
+/*
+    Answers one server request, "<target> <method> <N> [options]"
+
+    Parameters:
+        sources: loaded feature files, one per method
+        maxThreads: most threads a request may scan on
+        request: request line
+        reply: output matches or error message
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int answerRequest(const std::vector<std::unique_ptr<QuerySource>> &sources, int maxThreads,
+                  const std::string &request, std::string &reply) {
+    std::vector<std::string> args;
+    size_t start = request.find_first_not_of(" \t");
+    while (start != std::string::npos) {
+        size_t end = request.find_first_of(" \t", start);
+        args.push_back(request.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        start = request.find_first_not_of(" \t", end);
+    }
+
+    if (args.size() < 3) {
+        reply = "Error, expected <target> <feature_method> <N> [options]\n";
+        return -1;
+    }
+
+    const QuerySource *source = nullptr;
+    for (const auto &candidate : sources) {
+        if (candidate->featureMethod == args[1]) {
+            source = candidate.get();
+        }
+    }
+    if (!source) {
+        reply = "Error, no feature file is loaded for " + args[1] + "\n";
+        return -1;
+    }
+
+    int N = std::atoi(args[2].c_str());
+    if (N < 1) {
+        reply = "Error, N must be at least 1\n";
+        return -1;
+    }
+
+    ScanOptions options;
+    for (size_t i = 3; i < args.size(); i++) {
+        if (!parseScanOption(args, i, options)) {
+            reply = "Error, unknown option " + args[i] + "\n";
+            return -1;
+        }
+    }
+
+    std::string error = scanOptionsError(source->featureMethod, options);
+    if (!error.empty()) {
+        reply = error + "\n";
+        return -1;
+    }
+
+    // Every request builds its own pool, so the server bounds its size
+    if (options.threads > maxThreads) {
+        reply = "Error, at most " + std::to_string(maxThreads) + " threads per query\n";
+        return -1;
+    }
+
+    // The reason of a failed query is printed to the server output, which is
+    // not the reply stream (see takeStdout)
+    if (matchTarget(*source, args[0], N, options, reply) != 0) {
+        reply = "Error, query " + request + " failed\n";
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Server mode: loads the feature files once, then answers requests on stdin or
+    on a Unix domain socket
+
+    Parameters:
+        argc: argument count
+        argv: "--serve" followed by <method>=<feature_file> or custom arguments and options
+
+    Returns:
+        0 at end of input
+        -1 on error
+*/
+int serve(int argc, char *argv[]) {
+    std::vector<std::unique_ptr<QuerySource>> sources;
+    std::string socketPath;
+    int threads = 1;
+    int decodeScale = 0;
+    std::vector<std::pair<std::string, std::string>> files;
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        }
+        else if (arg == "--decode-scale" && i + 1 < argc) {
+            decodeScale = std::atoi(argv[++i]);
+        }
+        else if (arg == "custom") {
+            files.emplace_back(arg, "");
+        }
+        else if (arg.compare(0, 2, "--") != 0 && equals != std::string::npos && equals > 0) {
+            files.emplace_back(arg.substr(0, equals), arg.substr(equals + 1));
+        }
+        else {
+            printf("Error, unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (files.empty()) {
+        printf("Error, the server needs at least one <feature_method>=<feature_file>\n");
+        return -1;
+    }
+
+    if (threads < 1) {
+        printf("Error, the number of threads must be at least 1!\n");
+        return -1;
+    }
+
+    for (const auto &file : files) {
+        for (const auto &source : sources) {
+            if (source->featureMethod == file.first) {
+                printf("Error, more than one feature file for %s\n", file.first.c_str());
+                return -1;
+            }
+        }
+
+        auto source = std::make_unique<QuerySource>();
+        if (openSource(file.first, file.second, false, FEATURE_STREAM_CHUNK_MB, decodeScale, *source) != 0) {
+            return -1;
+        }
+
+        // Norms of CSV rows are computed on first use, do it now rather than in concurrent queries
+        if (source->database.dtype() == FEATURE_STORE_FLOAT32 && !source->database.sparse()) {
+            source->database.norms();
+        }
+        sources.push_back(std::move(source));
+    }
+
+    QueryHandler handler = [&sources, threads](const std::string &request, std::string &reply) {
+        return answerRequest(sources, threads, request, reply);
+    };
+
+    if (socketPath.empty()) {
+        FILE *replies = takeStdout();
+        if (!replies) {
+            return -1;
+        }
+        int result = serveLines(stdin, replies, handler);
+        fclose(replies);
+        return result;
+    }
+    return serveSocket(socketPath, threads, handler);
+}
+
+// Computes top N matches from image DB to target image using euclidean distance
+int main(int argc, char* argv[]) {
+
+    if (argc >= 2 && std::string(argv[1]) == "--serve") {
+        return serve(argc, argv);
+    }
+
+    if (argc < 4 || (std::string(argv[2]) != "custom" && argc < 5)) {
+        printf("Usage: %s <target_image> <feature_method> <feature_file> <N> [--decode-scale N]\n", argv[0]);
+        printf("       [--stream] [--chunk-mb N] [--metric euclidean|cosine] [--early-abandon] [--variance-order]\n");
+        printf("       [--threads N] [--batch]\n");
+        printf("<feature_file> is a feature CSV or a binary feature store (.fst)\n");
+        printf("<target_image> may also be #<id>, a row of the feature file\n");
+        printf("--stream scans a binary store in chunks of N MB (default %d) instead of loading it\n",
+               FEATURE_STREAM_CHUNK_MB);
+        printf("--metric picks the distance of resnet embeddings (default euclidean)\n");
+        printf("--early-abandon stops comparing a row of a float store once it cannot make the top N,\n");
+        printf("   --variance-order also compares the features that tell rows apart most first\n");
+        printf("--threads scans the rows on N threads (default 1)\n");
+        printf("--batch reads the targets from <target_image>, one per line (- for stdin), and scans\n");
+        printf("   the rows once for many targets\n");
+        printf("   or: %s <target_image> custom <N>\n", argv[0]);
+        printf("   or: %s --serve <feature_method>=<feature_file>... [custom] [--socket path] [--threads N]\n",
+               argv[0]);
+        printf("       [--decode-scale N]\n");
+        printf("--serve loads the feature files once and answers \"<target_image> <feature_method> <N> [options]\"\n");
+        printf("   lines on stdin, or on a Unix domain socket serving N clients at once;\n");
+        printf("   a query may ask for up to N threads\n");
+        return -1;
+    }
+
+    // Parse arguments
+    std::vector<std::string> args(argv, argv + argc);
+    std::string targetImagePath = argv[1];
+    std::string featureMethod = argv[2];
+    std::string featureCSV = argv[3];
+    size_t firstOption = featureMethod == "custom" ? 4 : 5;
+    int N = std::atoi(argv[firstOption - 1]);
+
+    // Parse options
+    int decodeScale = 0;
+    bool streaming = false;
+    bool batch = false;
+    int chunkMB = FEATURE_STREAM_CHUNK_MB;
+    ScanOptions options;
+    for (size_t i = firstOption; i < args.size(); i++) {
+        if (args[i] == "--decode-scale" && i + 1 < args.size()) {
+            decodeScale = std::atoi(argv[++i]);
+        }
+        else if (args[i] == "--stream") {
+            streaming = true;
+        }
+        else if (args[i] == "--chunk-mb" && i + 1 < args.size()) {
+            chunkMB = std::atoi(argv[++i]);
+        }
+        else if (args[i] == "--batch") {
+            batch = true;
+        }
+        else if (!parseScanOption(args, i, options)) {
+            printf("Error, unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (chunkMB < 1) {
+        printf("Error, chunk size must be at least 1 MB!\n");
+        return -1;
+    }
+
+    std::string error = scanOptionsError(featureMethod, options);
+    if (!error.empty()) {
+        printf("%s\n", error.c_str());
+        return -1;
+    }
+
+    QuerySource source;
+    if (openSource(featureMethod, featureCSV, streaming, chunkMB, decodeScale, source) != 0) {
+        return -1;
+    }
+
+    // In batch mode the target argument lists the targets
+    if (batch) {
+        return matchBatch(source, targetImagePath, N, options);
+    }
+
+    std::string reply;
+    if (matchTarget(source, targetImagePath, N, options, reply) != 0) {
+        return -1;
+    }
+    printf("%s", reply.c_str());
+
+    return 0;
+}
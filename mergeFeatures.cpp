@@ -0,0 +1,407 @@
+/*
+	Name: Aafi Mansuri & Terry Zhen
+
+	Purpose: Merges the feature files written by sharded buildFeatures runs
+    (--shard i/N) into one feature file per method, checking that every shard
+    holds the same methods with the same feature dimensions. CSV shards and
+    binary (.fst) shards are both supported.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+#include "featureStore.h"
+#include "manifest.h"
+
+// Define filesystem
+namespace fs = std::filesystem;
+
+// Reads one shard's feature file a row at a time
+struct ShardReader {
+    std::string path;
+    std::ifstream file;
+    std::string line;   // current row
+    std::string image;  // image path of the current row
+    std::string previous;  // image path of the row before, rows must be in path order
+    int columns = 0;    // number of features in the current row
+    bool valid = false;
+};
+
+/*
+    Find the feature files of one shard. A shard given as an existing file is a
+    single-method store, otherwise the per-method files buildFeatures names from
+    the output path are looked up.
+
+    Parameters:
+        shard: output path given to buildFeatures for the shard
+        methods: output methods found ("" for a single-method store)
+        files: output feature file per method
+
+    Returns:
+        0 on success
+        -1 if no feature file was found
+*/
+int findShardStores(const std::string &shard, std::vector<std::string> &methods, std::vector<std::string> &files) {
+    methods.clear();
+    files.clear();
+
+    if (fs::is_regular_file(shard)) {
+        methods.push_back("");
+        files.push_back(shard);
+        return 0;
+    }
+
+    for (const std::string &method : buildMethods()) {
+        std::string path = storePath(shard, method, true);
+        if (fs::is_regular_file(path)) {
+            methods.push_back(method);
+            files.push_back(path);
+        }
+    }
+
+    if (files.empty()) {
+        printf("Error, no feature files found for shard %s\n", shard.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    Advance a shard reader to its next row
+
+    Parameters:
+        reader: shard reader
+
+    Returns:
+        true if a row was read
+*/
+bool nextRow(ShardReader &reader) {
+    reader.valid = false;
+
+    while (std::getline(reader.file, reader.line)) {
+        if (!reader.line.empty() && reader.line.back() == '\r') {
+            reader.line.pop_back();
+        }
+        if (reader.line.empty()) {
+            continue;
+        }
+
+        size_t comma = reader.line.find(',');
+        reader.image = reader.line.substr(0, comma);
+        reader.columns = static_cast<int>(std::count(reader.line.begin(), reader.line.end(), ','));
+        reader.valid = true;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+    Merge the manifests of the shard files of one method. Shards must agree on the
+    decode scale; if any shard has no manifest the merged store gets none either.
+
+    Parameters:
+        shardFiles: feature file of each shard
+        outputFile: merged feature file
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int mergeManifests(const std::vector<std::string> &shardFiles, const std::string &outputFile) {
+    std::vector<ManifestEntry> merged;
+    int mergedScale = 0;
+
+    for (const auto &shardFile : shardFiles) {
+        std::vector<ManifestEntry> entries;
+        int decodeScale = 1;
+        if (readManifestEntries(manifestPath(shardFile), entries, &decodeScale) != 0) {
+            printf("Warning: %s has no manifest, %s will not have one\n", shardFile.c_str(), outputFile.c_str());
+            return 0;
+        }
+
+        if (mergedScale != 0 && decodeScale != mergedScale) {
+            printf("Error, %s was extracted at decode scale %d, other shards at %d!\n", shardFile.c_str(),
+                   decodeScale, mergedScale);
+            return -1;
+        }
+        mergedScale = decodeScale;
+
+        merged.insert(merged.end(), entries.begin(), entries.end());
+    }
+
+    std::sort(merged.begin(), merged.end(),
+              [](const ManifestEntry &a, const ManifestEntry &b) { return fs::path(a.path) < fs::path(b.path); });
+
+    return writeManifest(manifestPath(outputFile), merged, mergedScale);
+}
+
+/*
+    Merge the shard files of one method in image path order. Rows are copied as
+    written, so no precision is lost. Every shard must be in path order, every
+    row must have the same number of features and no image may appear twice.
+
+    Parameters:
+        shardFiles: feature file of each shard
+        outputFile: merged feature file
+
+    Returns:
+        number of rows written
+        -1 on error
+*/
+int mergeStore(const std::vector<std::string> &shardFiles, const std::string &outputFile) {
+    std::vector<ShardReader> readers(shardFiles.size());
+    for (size_t s = 0; s < shardFiles.size(); s++) {
+        readers[s].path = shardFiles[s];
+        readers[s].file.open(shardFiles[s]);
+        if (!readers[s].file) {
+            printf("Unable to open %s\n", shardFiles[s].c_str());
+            return -1;
+        }
+        nextRow(readers[s]);
+    }
+
+    std::string tmpName = outputFile + ".tmp";
+    FILE *fp = fopen(tmpName.c_str(), "w");
+    if (!fp) {
+        printf("Unable to open output file %s\n", tmpName.c_str());
+        return -1;
+    }
+
+    int rows = 0;
+    int dimension = -1;
+    std::unordered_set<std::string> seen;
+    for (;;) {
+        // Pick the shard with the smallest image path
+        ShardReader *first = nullptr;
+        for (auto &reader : readers) {
+            if (reader.valid && (!first || fs::path(reader.image) < fs::path(first->image))) {
+                first = &reader;
+            }
+        }
+        if (!first) {
+            break;
+        }
+
+        if (dimension == -1) {
+            dimension = first->columns;
+        }
+        if (first->columns != dimension) {
+            printf("Error, %s in %s has %d features, expected %d!\n", first->image.c_str(), first->path.c_str(),
+                   first->columns, dimension);
+            fclose(fp);
+            return -1;
+        }
+        if (!first->previous.empty() && fs::path(first->image) < fs::path(first->previous)) {
+            printf("Error, %s is not in path order (%s comes after %s), sort the image list of the shard!\n",
+                   first->path.c_str(), first->image.c_str(), first->previous.c_str());
+            fclose(fp);
+            return -1;
+        }
+        if (!seen.insert(first->image).second) {
+            printf("Error, %s appears more than once in the shards!\n", first->image.c_str());
+            fclose(fp);
+            return -1;
+        }
+
+        fputs(first->line.c_str(), fp);
+        fputc('\n', fp);
+        first->previous = first->image;
+        rows++;
+
+        nextRow(*first);
+    }
+
+    if (fclose(fp) != 0) {
+        printf("Error writing %s\n", tmpName.c_str());
+        return -1;
+    }
+
+    std::error_code ec;
+    fs::rename(tmpName, outputFile, ec);
+    if (ec) {
+        printf("Unable to replace %s\n", outputFile.c_str());
+        return -1;
+    }
+
+    printf("Merged %d rows of %d features into %s\n", rows, std::max(dimension, 0), outputFile.c_str());
+    return rows;
+}
+
+/*
+    Merge the binary shard stores of one method in image path order. Every shard
+    must be in path order and have the same feature method, dimension, feature layout, decode
+    scale and element type, and no image may appear twice.
+
+    Parameters:
+        shardFiles: binary store of each shard
+        outputFile: merged binary store
+
+    Returns:
+        number of rows written
+        -1 on error
+*/
+long mergeBinaryStore(const std::vector<std::string> &shardFiles, const std::string &outputFile) {
+    std::vector<FeatureStore> stores(shardFiles.size());
+    for (size_t s = 0; s < shardFiles.size(); s++) {
+        if (stores[s].open(shardFiles[s]) != 0) {
+            return -1;
+        }
+
+        // An empty shard has no dimension of its own
+        const FeatureStore &first = stores[0];
+        if (stores[s].method() != first.method() || stores[s].decodeScale() != first.decodeScale() ||
+            stores[s].dtype() != first.dtype() || stores[s].sparse() != first.sparse() ||
+            (stores[s].rows() > 0 && first.rows() > 0 &&
+             (stores[s].dim() != first.dim() || !sameLayout(stores[s].featureLayout(), first.featureLayout())))) {
+            printf("Error, %s does not hold the same features as %s!\n", shardFiles[s].c_str(),
+                   shardFiles[0].c_str());
+            return -1;
+        }
+    }
+
+    std::string tmpName = outputFile + ".tmp";
+    FeatureStoreWriter writer;
+    if (writer.open(tmpName, stores[0].method(), stores[0].decodeScale(), stores[0].dtype(),
+                    stores[0].sparse()) != 0) {
+        return -1;
+    }
+
+    // The layout of the shards is carried over, empty shards do not record one
+    for (const FeatureStore &store : stores) {
+        if (store.rows() > 0) {
+            writer.setLayout(store.featureLayout());
+            break;
+        }
+    }
+
+    // Quantized rows come back unchanged from dequantizing and quantizing again
+    std::vector<float> row;
+
+    std::vector<size_t> position(stores.size(), 0);
+    long rows = 0;
+    int dimension = 0;
+    std::unordered_set<std::string_view> seen;
+    for (;;) {
+        // Pick the shard with the smallest image path
+        int first = -1;
+        for (size_t s = 0; s < stores.size(); s++) {
+            if (position[s] < stores[s].rows() &&
+                (first < 0 || fs::path(stores[s].name(position[s])) < fs::path(stores[first].name(position[first])))) {
+                first = static_cast<int>(s);
+            }
+        }
+        if (first < 0) {
+            break;
+        }
+
+        const FeatureStore &store = stores[first];
+        const char *image = store.name(position[first]);
+        if (position[first] > 0 && fs::path(image) < fs::path(store.name(position[first] - 1))) {
+            printf("Error, %s is not in path order (%s comes after %s), sort the image list of the shard!\n",
+                   shardFiles[first].c_str(), image, store.name(position[first] - 1));
+            writer.close();
+            return -1;
+        }
+        // Names point into the mapped stores, which outlive the set
+        if (!seen.insert(image).second) {
+            printf("Error, %s appears more than once in the shards!\n", image);
+            writer.close();
+            return -1;
+        }
+
+        row.resize(store.dim());
+        store.copyRow(position[first], row.data());
+        if (writer.addRow(image, row) != 0) {
+            writer.close();
+            return -1;
+        }
+        dimension = store.dim();
+        rows++;
+        position[first]++;
+    }
+
+    if (writer.close() != 0) {
+        return -1;
+    }
+
+    std::error_code ec;
+    fs::rename(tmpName, outputFile, ec);
+    if (ec) {
+        printf("Unable to replace %s\n", outputFile.c_str());
+        return -1;
+    }
+
+    printf("Merged %ld rows of %d features into %s\n", rows, dimension, outputFile.c_str());
+    return rows;
+}
+
+// Merge sharded feature files
+int main(int argc, char* argv[]) {
+    // Argument checks
+    if (argc < 3) {
+        printf("Usage: %s <output_csv> <shard_csv> [<shard_csv> ...]\n", argv[0]);
+        printf("Each shard is the output path given to a buildFeatures --shard run. For multi-method\n");
+        printf("builds the per-method files are found from that path and merged method by method.\n");
+        return -1;
+    }
+
+    std::string outputCSV = argv[1];
+
+    // Every shard has to hold the same set of methods
+    std::vector<std::string> methods;
+    std::vector<std::vector<std::string>> shardFiles;
+    for (int i = 2; i < argc; i++) {
+        std::vector<std::string> shardMethods;
+        std::vector<std::string> files;
+        if (findShardStores(argv[i], shardMethods, files) != 0) {
+            return -1;
+        }
+
+        if (i == 2) {
+            methods = shardMethods;
+            shardFiles.resize(methods.size());
+        }
+        else if (shardMethods != methods) {
+            printf("Error, shard %s holds different feature methods than %s!\n", argv[i], argv[2]);
+            return -1;
+        }
+
+        for (size_t m = 0; m < files.size(); m++) {
+            shardFiles[m].push_back(files[m]);
+        }
+    }
+
+    for (size_t m = 0; m < methods.size(); m++) {
+        std::string outputFile = methods[m].empty() ? outputCSV : storePath(outputCSV, methods[m], true);
+
+        // Shards are either all CSVs or all binary stores
+        bool binary = isFeatureStoreFile(shardFiles[m][0]);
+        for (const auto &shardFile : shardFiles[m]) {
+            if (isFeatureStoreFile(shardFile) != binary) {
+                printf("Error, %s and %s are not the same file format!\n", shardFile.c_str(),
+                       shardFiles[m][0].c_str());
+                return -1;
+            }
+        }
+
+        if (mergeManifests(shardFiles[m], outputFile) != 0) {
+            return -1;
+        }
+
+        long rows = binary ? mergeBinaryStore(shardFiles[m], outputFile) : mergeStore(shardFiles[m], outputFile);
+        if (rows < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
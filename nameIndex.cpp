@@ -0,0 +1,108 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Hash index from image names to rows.
+*/
+
+#include "nameIndex.h"
+#include <cstring>
+
+/*
+    Hash of a name (64-bit FNV-1a)
+
+    Parameters:
+        name: name bytes
+        length: number of bytes
+
+    Returns:
+        hash
+*/
+uint64_t nameHash(const char *name, size_t length) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= static_cast<unsigned char>(name[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+    Offset of the file name in a name, after the last '/' or '\'
+
+    Parameters:
+        name: name bytes
+        length: number of bytes
+
+    Returns:
+        offset of the file name, 0 if the name has no directories
+*/
+size_t baseNameOffset(const char *name, size_t length) {
+    for (size_t i = length; i > 0; i--) {
+        if (name[i - 1] == '/' || name[i - 1] == '\\') {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/*
+    Compares the name of a row with a key
+
+    Parameters:
+        name: '\0' terminated row name
+        key: key bytes
+        length: number of key bytes
+
+    Returns:
+        NAME_EXACT_MATCH if the name is the key, NAME_BASE_MATCH if its file
+        name is the key, NAME_NO_MATCH otherwise
+*/
+int matchName(const char *name, const char *key, size_t length) {
+    size_t nameLength = strlen(name);
+    if (nameLength == length && memcmp(name, key, length) == 0) {
+        return NAME_EXACT_MATCH;
+    }
+
+    size_t base = baseNameOffset(name, nameLength);
+    if (base > 0 && nameLength - base == length && memcmp(name + base, key, length) == 0) {
+        return NAME_BASE_MATCH;
+    }
+    return NAME_NO_MATCH;
+}
+
+/*
+    Enters one key in a table
+
+    Parameters:
+        slots: table, with at least one empty slot
+        bits: bits of the slot count
+        key: key bytes
+        length: number of key bytes
+        row: row of the key
+*/
+void insertName(NameIndexSlot *slots, uint32_t bits, const char *key, size_t length, uint32_t row) {
+    uint64_t hash = nameHash(key, length);
+    uint64_t mask = (static_cast<uint64_t>(1) << bits) - 1;
+    uint64_t i = hash & mask;
+    while (slots[i].row != 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = {static_cast<uint32_t>(hash >> 32), row + 1};
+}
+
+/*
+    Bits of the slot count of a table for a number of keys, keeping it at most 3/4 full
+
+    Parameters:
+        keys: number of keys
+
+    Returns:
+        bits of the slot count, at least 3
+*/
+uint32_t nameIndexBits(size_t keys) {
+    uint32_t bits = 3;
+    while ((static_cast<uint64_t>(3) << bits) / 4 < keys) {
+        bits++;
+    }
+    return bits;
+}
@@ -0,0 +1,201 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for the hash index from image names to rows, kept by
+    binary feature stores and built in memory for other feature files.
+
+    The index is an open addressing hash table of 2^bits slots with linear
+    probing, at most 3/4 full. Every row is entered under its name and, when
+    the name has directories, under its file name as well. A slot holds the
+    upper 32 bits of the hash of its key and row + 1 (0 for an empty slot);
+    a lookup compares the name of every row whose tag matches, so neither
+    collisions nor a corrupt table can return a row of another image. Rows
+    are entered in order, so among equal names the lowest row is found first.
+*/
+
+#ifndef NAMEINDEX_H
+#define NAMEINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Most rows an index can hold, row + 1 has to fit the 32 bits of a slot
+#define NAME_INDEX_MAX_ROWS 0xfffffffeULL
+
+// Largest table, in bits of the slot count: two keys per row, at most 3/4 full
+#define NAME_INDEX_MAX_BITS 34
+
+// Name match kinds, from matchName
+#define NAME_NO_MATCH 0
+#define NAME_BASE_MATCH 1
+#define NAME_EXACT_MATCH 2
+
+// One slot of the hash table, 8 bytes on disk
+struct NameIndexSlot {
+    uint32_t tag;   // upper 32 bits of the key hash
+    uint32_t row;   // row + 1, 0 if the slot is empty
+};
+
+static_assert(sizeof(NameIndexSlot) == 8, "name index slots must be 8 bytes");
+
+/*
+    Hash of a name (64-bit FNV-1a)
+
+    Parameters:
+        name: name bytes
+        length: number of bytes
+
+    Returns:
+        hash
+*/
+uint64_t nameHash(const char *name, size_t length);
+
+/*
+    Offset of the file name in a name, after the last '/' or '\'
+
+    Parameters:
+        name: name bytes
+        length: number of bytes
+
+    Returns:
+        offset of the file name, 0 if the name has no directories
+*/
+size_t baseNameOffset(const char *name, size_t length);
+
+/*
+    Compares the name of a row with a key
+
+    Parameters:
+        name: '\0' terminated row name
+        key: key bytes
+        length: number of key bytes
+
+    Returns:
+        NAME_EXACT_MATCH if the name is the key, NAME_BASE_MATCH if its file
+        name is the key, NAME_NO_MATCH otherwise
+*/
+int matchName(const char *name, const char *key, size_t length);
+
+/*
+    Builds the index of a list of names
+
+    Parameters:
+        rows: number of names, at most NAME_INDEX_MAX_ROWS
+        nameAt: nameAt(row) gives the '\0' terminated name of a row
+        slots: output table
+
+    Returns:
+        bits of the slot count
+*/
+template <typename NameAt>
+uint32_t buildNameIndex(size_t rows, NameAt nameAt, std::vector<NameIndexSlot> &slots);
+
+/*
+    Looks up a key: the first row whose name is the key or, if there is none,
+    the first row whose file name is the key. No memory is allocated.
+
+    Parameters:
+        slotAt: slotAt(i, slot) reads slot i, returns false on a read error
+        bits: bits of the slot count, not 0
+        matchAt: matchAt(row) compares the name of a row with the key as matchName
+                 does, NAME_NO_MATCH on a read error
+        rows: number of rows, slots naming rows past it are ignored
+        key: key bytes
+        length: number of key bytes
+        row: output row
+
+    Returns:
+        0 if the key was found
+        -1 otherwise
+*/
+template <typename SlotAt, typename MatchAt>
+int lookupNameIndex(SlotAt slotAt, uint32_t bits, MatchAt matchAt, size_t rows, const char *key, size_t length,
+                    size_t &row);
+
+/*
+    Enters one key in a table
+
+    Parameters:
+        slots: table, with at least one empty slot
+        bits: bits of the slot count
+        key: key bytes
+        length: number of key bytes
+        row: row of the key
+*/
+void insertName(NameIndexSlot *slots, uint32_t bits, const char *key, size_t length, uint32_t row);
+
+/*
+    Bits of the slot count of a table for a number of keys, keeping it at most 3/4 full
+
+    Parameters:
+        keys: number of keys
+
+    Returns:
+        bits of the slot count, at least 3
+*/
+uint32_t nameIndexBits(size_t keys);
+
+template <typename NameAt>
+uint32_t buildNameIndex(size_t rows, NameAt nameAt, std::vector<NameIndexSlot> &slots) {
+    size_t keys = rows;
+    for (size_t i = 0; i < rows; i++) {
+        const char *name = nameAt(i);
+        size_t length = 0;
+        while (name[length] != '\0') {
+            length++;
+        }
+        keys += baseNameOffset(name, length) > 0 ? 1 : 0;
+    }
+
+    uint32_t bits = nameIndexBits(keys);
+    slots.assign(static_cast<size_t>(1) << bits, NameIndexSlot{0, 0});
+    for (size_t i = 0; i < rows; i++) {
+        const char *name = nameAt(i);
+        size_t length = 0;
+        while (name[length] != '\0') {
+            length++;
+        }
+        size_t base = baseNameOffset(name, length);
+        insertName(slots.data(), bits, name, length, static_cast<uint32_t>(i));
+        if (base > 0) {
+            insertName(slots.data(), bits, name + base, length - base, static_cast<uint32_t>(i));
+        }
+    }
+
+    return bits;
+}
+
+template <typename SlotAt, typename MatchAt>
+int lookupNameIndex(SlotAt slotAt, uint32_t bits, MatchAt matchAt, size_t rows, const char *key, size_t length,
+                    size_t &row) {
+    uint64_t hash = nameHash(key, length);
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    uint64_t mask = (static_cast<uint64_t>(1) << bits) - 1;
+
+    // A full table of a corrupt store ends the probe after one round
+    bool baseFound = false;
+    NameIndexSlot slot;
+    for (uint64_t probe = 0, i = hash & mask; probe <= mask; probe++, i = (i + 1) & mask) {
+        if (!slotAt(i, slot) || slot.row == 0) {
+            break;
+        }
+        if (slot.tag != tag || slot.row - 1 >= rows) {
+            continue;
+        }
+
+        int match = matchAt(slot.row - 1);
+        if (match == NAME_EXACT_MATCH) {
+            row = slot.row - 1;
+            return 0;
+        }
+        if (match == NAME_BASE_MATCH && !baseFound) {
+            row = slot.row - 1;
+            baseFound = true;
+        }
+    }
+
+    return baseFound ? 0 : -1;
+}
+
+#endif
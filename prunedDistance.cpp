@@ -0,0 +1,263 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Early-abandoning distances against the current top N.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "prunedDistance.h"
+
+// Margin taken off the bounds for rounding, as the checks add up the lanes in a quicker order
+// than the final distance. Relative for euclidean distances, absolute for histogram distances,
+// which lie in [0, 1]; either way far above the rounding error of a few hundred features.
+#define PRUNE_SLACK 1e-4f
+
+/*
+    Prepare a euclidean distance
+
+    Parameters:
+        query: query features, copied
+        dim: number of features
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int PrunedDistance::initEuclidean(const float *query, int dim) {
+    if (dim <= 0) {
+        printf("Error, no features to compare!\n");
+        return -1;
+    }
+
+    euclidean = true;
+    weights = {1.0f};
+    this->query.assign(query, query + dim);
+    split({dim});
+    return 0;
+}
+
+/*
+    Prepare a weighted sum of histogram intersection distances over
+    consecutive histograms, as in the batch histogram distances
+
+    Parameters:
+        query: query features, copied
+        segments: number of bins of each histogram, in order
+        weights: weight of each histogram
+
+    Returns:
+        0 on success
+        -1 on error
+*/
+int PrunedDistance::initIntersection(const float *query, const std::vector<int> &segments,
+                                     const std::vector<float> &weights) {
+    if (segments.empty() || segments.size() != weights.size()) {
+        printf("Error, every histogram needs one weight!\n");
+        return -1;
+    }
+
+    int dim = 0;
+    for (int size : segments) {
+        if (size <= 0) {
+            printf("Error, empty histogram in the features!\n");
+            return -1;
+        }
+        dim += size;
+    }
+
+    euclidean = false;
+    this->weights = weights;
+    this->query.assign(query, query + dim);
+    split(segments);
+    return 0;
+}
+
+/*
+    Cut every histogram into blocks of PRUNE_BLOCK features. Blocks start at
+    multiples of PRUNE_BLOCK from the start of their histogram, so each block
+    adds to the same lanes as a kernel call over the whole histogram would.
+
+    Parameters:
+        segments: number of features of each histogram
+*/
+void PrunedDistance::split(const std::vector<int> &segments) {
+    starts.assign(1, 0);
+    masses.assign(segments.size(), 0.0f);
+    blocks.clear();
+    for (size_t h = 0; h < segments.size(); h++) {
+        int end = starts.back() + segments[h];
+        for (int offset = starts.back(); offset < end; offset += PRUNE_BLOCK) {
+            Block block = {offset, std::min(PRUNE_BLOCK, end - offset), static_cast<int>(h), 0.0f};
+            for (int i = 0; i < block.length; i++) {
+                block.queryMass += query[offset + i];
+            }
+            masses[h] += block.queryMass;
+            blocks.push_back(block);
+        }
+        starts.push_back(end);
+    }
+
+    reordered = false;
+    lanes.assign(segments.size() * KERNEL_LANES, 0.0f);
+    partial.assign(segments.size(), 0.0f);
+    remaining.assign(segments.size(), 0.0f);
+}
+
+/*
+    Visit the blocks in descending order of what they added to the bound
+    over a sample of rows
+
+    Parameters:
+        rows: first sample row
+        count: number of rows, only the first PRUNE_SAMPLE_ROWS are used
+        stride: distance between rows in floats
+*/
+void PrunedDistance::orderBlocks(const float *rows, size_t count, size_t stride) {
+    const DistanceKernels &kernels = distanceKernels();
+    count = std::min<size_t>(count, PRUNE_SAMPLE_ROWS);
+
+    // What each block added to the bound, summed over the sample
+    std::vector<std::pair<double, int>> scores(blocks.size());
+    for (size_t b = 0; b < blocks.size(); b++) {
+        const Block &block = blocks[b];
+        double score = 0;
+        for (size_t r = 0; r < count; r++) {
+            const float *a = query.data() + block.offset;
+            const float *row = rows + r * stride + block.offset;
+            score += euclidean ? kernels.squaredDistance(a, row, block.length)
+                               : weights[block.segment] * (block.queryMass - kernels.minSum(a, row, block.length));
+        }
+        scores[b] = {-score, static_cast<int>(b)};
+    }
+
+    std::stable_sort(scores.begin(), scores.end());
+    std::vector<Block> ordered;
+    for (const std::pair<double, int> &score : scores) {
+        ordered.push_back(blocks[score.second]);
+        reordered = reordered || score.second != static_cast<int>(ordered.size()) - 1;
+    }
+    blocks = ordered;
+}
+
+/*
+    Distance from the query to a row, unless it is larger than bound
+
+    Parameters:
+        row: row features
+        bound: largest distance of interest
+
+    Returns:
+        the distance if it is at most bound, otherwise a value larger than bound
+*/
+float PrunedDistance::distance(const float *row, float bound) {
+    const DistanceKernels &kernels = distanceKernels();
+    void (*accumulate)(const float *, const float *, size_t, float *) =
+        euclidean ? kernels.addSquared : kernels.addMin;
+
+    std::fill(lanes.begin(), lanes.end(), 0.0f);
+    std::fill(partial.begin(), partial.end(), 0.0f);
+    remaining = masses;
+
+    for (size_t b = 0; b < blocks.size(); b++) {
+        const Block &block = blocks[b];
+        accumulate(query.data() + block.offset, row + block.offset, block.length,
+                   lanes.data() + block.segment * KERNEL_LANES);
+
+        if (b + 1 < blocks.size()) {
+            float lower = lowerBound(block);
+            if (lower > bound) {
+                return lower;
+            }
+        }
+    }
+
+    // Sum a surviving row again in feature order, so it matches the batch distances
+    if (reordered) {
+        std::fill(lanes.begin(), lanes.end(), 0.0f);
+        for (size_t h = 0; h + 1 < starts.size(); h++) {
+            accumulate(query.data() + starts[h], row + starts[h], starts[h + 1] - starts[h],
+                       lanes.data() + h * KERNEL_LANES);
+        }
+    }
+    return finish();
+}
+
+/*
+    Offer the distance from the query to consecutive rows, each abandoned
+    once it cannot beat the Nth best match so far
+
+    Parameters:
+        rows: first row
+        count: number of rows
+        stride: distance between rows in floats
+        firstId: image ID of the first row
+        top: best matches so far
+*/
+void PrunedDistance::scan(const float *rows, size_t count, size_t stride, ImageId firstId, TopN &top) {
+    const Block &first = blocks.front();
+    for (size_t r = 0; r < count; r++) {
+        // Fetch the first block of the rows ahead, the rest may never be read
+        const float *ahead = rows + (r + KERNEL_PREFETCH_ROWS) * stride + first.offset;
+        for (int i = 0; i < first.length; i += 16) {
+            KERNEL_PREFETCH(ahead + i);
+        }
+        top.push(distance(rows + r * stride, top.bound()), firstId + static_cast<ImageId>(r));
+    }
+}
+
+/*
+    Lower bound of the distance after a block was added. The lanes of the
+    block's histogram are summed in a fixed order that vectorizes, not with
+    reduceLanes, which would cost more than adding the block.
+
+    Parameters:
+        block: the block just added
+
+    Returns:
+        a value the final distance cannot be below
+*/
+float PrunedDistance::lowerBound(const Block &block) {
+    const float *segmentLanes = lanes.data() + block.segment * KERNEL_LANES;
+    float sums[8] = {0};
+    for (int j = 0; j < KERNEL_LANES; j += 8) {
+        for (int k = 0; k < 8; k++) {
+            sums[k] += segmentLanes[j + k];
+        }
+    }
+    float sum = ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+
+    if (euclidean) {
+        return std::sqrt(sum) * (1.0f - PRUNE_SLACK);
+    }
+
+    // The remaining bins can add at most the query's mass to the intersection
+    partial[block.segment] = sum;
+    remaining[block.segment] -= block.queryMass;
+    float lower = 0;
+    for (size_t h = 0; h < weights.size(); h++) {
+        lower += weights[h] * (1.0f - (partial[h] + remaining[h]));
+    }
+    return lower - PRUNE_SLACK;
+}
+
+/*
+    Distance from the lanes of a row that was added completely, in the same
+    steps as euclideanDistances and the weighted histogram intersections
+
+    Returns:
+        distance
+*/
+float PrunedDistance::finish() {
+    if (euclidean) {
+        return std::sqrt(reduceLanes(lanes.data()));
+    }
+
+    float total = 0;
+    for (size_t h = 0; h < weights.size(); h++) {
+        float dist = weights[h] * (1.0f - reduceLanes(lanes.data() + h * KERNEL_LANES));
+        total = h == 0 ? dist : total + dist;
+    }
+    return total;
+}
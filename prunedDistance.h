@@ -0,0 +1,132 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for early-abandoning distances against the current top N.
+
+    A PrunedDistance compares one query with rows block by block, PRUNE_BLOCK
+    features at a time, and after every block works out a lower bound of the
+    final distance. Once that bound is worse than the Nth best match so far
+    the row cannot make it into the top N and the rest of it is skipped.
+
+    Euclidean distances only grow as blocks are added, so the partial
+    distance is the bound. For weighted histogram intersections each bin
+    adds at most the query's value to the intersection, so the bound assumes
+    the remaining bins match the query completely.
+
+    Blocks are visited in feature order by default, and then a distance that
+    is not abandoned is summed exactly like the batch distances. orderBlocks()
+    instead visits first the blocks that usually add most to the bound, the
+    blocks with the largest spread of the database around the query, so
+    pruning starts sooner; rows that survive are then summed again in
+    feature order to keep distances and rankings identical.
+*/
+
+#ifndef PRUNEDDISTANCE_H
+#define PRUNEDDISTANCE_H
+
+#include <cstddef>
+#include <vector>
+#include "distanceKernels.h"
+#include "topN.h"
+
+// Features compared between two checks of the bound, a multiple of KERNEL_LANES
+#define PRUNE_BLOCK 64
+
+// Largest number of rows orderBlocks() looks at
+#define PRUNE_SAMPLE_ROWS 1024
+
+/*
+    Distance from one query to rows, abandoned once it exceeds a bound
+*/
+class PrunedDistance {
+public:
+    /*
+        Prepare a euclidean distance
+
+        Parameters:
+            query: query features, copied
+            dim: number of features
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int initEuclidean(const float *query, int dim);
+
+    /*
+        Prepare a weighted sum of histogram intersection distances over
+        consecutive histograms, as in the batch histogram distances
+
+        Parameters:
+            query: query features, copied
+            segments: number of bins of each histogram, in order
+            weights: weight of each histogram
+
+        Returns:
+            0 on success
+            -1 on error
+    */
+    int initIntersection(const float *query, const std::vector<int> &segments, const std::vector<float> &weights);
+
+    /*
+        Visit the blocks in descending order of what they added to the bound
+        over a sample of rows
+
+        Parameters:
+            rows: first sample row
+            count: number of rows, only the first PRUNE_SAMPLE_ROWS are used
+            stride: distance between rows in floats
+    */
+    void orderBlocks(const float *rows, size_t count, size_t stride);
+
+    /*
+        Distance from the query to a row, unless it is larger than bound
+
+        Parameters:
+            row: row features
+            bound: largest distance of interest
+
+        Returns:
+            the distance if it is at most bound, otherwise a value larger than bound
+    */
+    float distance(const float *row, float bound);
+
+    /*
+        Offer the distance from the query to consecutive rows, each abandoned
+        once it cannot beat the Nth best match so far
+
+        Parameters:
+            rows: first row
+            count: number of rows
+            stride: distance between rows in floats
+            firstId: image ID of the first row
+            top: best matches so far
+    */
+    void scan(const float *rows, size_t count, size_t stride, ImageId firstId, TopN &top);
+
+private:
+    // Features [offset, offset + length) of one histogram
+    struct Block {
+        int offset;
+        int length;
+        int segment;
+        float queryMass;    // sum of the query's features in the block
+    };
+
+    bool euclidean = true;
+    bool reordered = false;
+    std::vector<float> query;
+    std::vector<int> starts;        // first feature of each histogram, and the end of the last
+    std::vector<float> weights;
+    std::vector<float> masses;      // sum of the query's features in each histogram
+    std::vector<Block> blocks;
+    std::vector<float> lanes;       // KERNEL_LANES running sums per histogram
+    std::vector<float> partial;     // reduced lanes of each histogram
+    std::vector<float> remaining;   // query mass of the blocks not yet visited
+
+    void split(const std::vector<int> &segments);
+    float lowerBound(const Block &block);
+    float finish();
+};
+
+#endif
@@ -0,0 +1,154 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Quantizing histogram features to fixed-point bins.
+*/
+
+#include "quantize.h"
+#include <algorithm>
+#include <cmath>
+
+/*
+    Check if a feature method produces histograms that can be quantized
+
+    Parameters:
+        featureMethod: feature method name
+
+    Returns:
+        true for chistogram, mhistogram, texture and face
+*/
+bool isHistogramMethod(const std::string &featureMethod) {
+    return featureMethod == "chistogram" || featureMethod == "mhistogram" || featureMethod == "texture" ||
+           featureMethod == "face";
+}
+
+/*
+    Split a feature vector of a histogram method into its histograms
+
+    Parameters:
+        featureMethod: chistogram, mhistogram, texture or face
+        dim: feature vector size
+        segments: output size of each histogram, in feature vector order
+
+    Returns:
+        0 on success
+        -1 if the method is not a histogram method or dim does not fit it
+*/
+int histogramSegments(const std::string &featureMethod, int dim, std::vector<int> &segments) {
+    segments.clear();
+
+    if (featureMethod == "chistogram") {
+        segments = {dim};
+    }
+    else if (featureMethod == "mhistogram" && dim % 2 == 0) {
+        // Whole image and center histograms
+        segments = {dim / 2, dim / 2};
+    }
+    else if (featureMethod == "face" && dim % 3 == 0) {
+        // Whole image, face and background histograms
+        segments = {dim / 3, dim / 3, dim / 3};
+    }
+    else if (featureMethod == "texture") {
+        // histSize * histSize color bins followed by histSize texture bins
+        int histSize = static_cast<int>(std::sqrt(static_cast<double>(dim)));
+        while (histSize > 0 && histSize * histSize + histSize > dim) {
+            histSize--;
+        }
+        if (histSize > 0 && histSize * histSize + histSize == dim) {
+            segments = {histSize * histSize, histSize};
+        }
+    }
+
+    return segments.empty() || dim <= 0 ? -1 : 0;
+}
+
+/*
+    Quantize one histogram to a fixed total with the largest remainder method
+
+    Parameters:
+        values: histogram bins, summing to 1 (or 0 for an empty histogram)
+        count: number of bins
+        total: sum of the quantized histogram
+        out: output bins
+*/
+template <typename T>
+static void quantizeHistogram(const float *values, int count, uint32_t total, T *out) {
+    double sum = 0.0;
+    for (int i = 0; i < count; i++) {
+        sum += std::max(values[i], 0.0f);
+    }
+
+    // An empty histogram stays empty
+    if (sum <= 0.0) {
+        std::fill(out, out + count, T(0));
+        return;
+    }
+
+    // Round down, then hand the remaining units to the bins that lost the most
+    std::vector<std::pair<double, int>> remainders(count);
+    uint32_t assigned = 0;
+    for (int i = 0; i < count; i++) {
+        double scaled = std::max(values[i], 0.0f) / sum * total;
+        uint32_t bin = std::min(static_cast<uint32_t>(scaled), total);
+        out[i] = static_cast<T>(bin);
+        assigned += bin;
+        remainders[i] = {scaled - bin, i};
+    }
+
+    uint32_t missing = total > assigned ? total - assigned : 0;
+    std::partial_sort(remainders.begin(), remainders.begin() + std::min<size_t>(missing, count), remainders.end(),
+                      [](const auto &a, const auto &b) { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+    for (uint32_t k = 0; k < missing && k < static_cast<uint32_t>(count); k++) {
+        out[remainders[k].second]++;
+    }
+}
+
+/*
+    Quantize every histogram of a feature vector
+
+    Parameters:
+        values: feature vector
+        segments: histogram sizes
+        total: sum of every quantized histogram
+        out: output bins
+*/
+template <typename T>
+static void quantizeSegments(const float *values, const std::vector<int> &segments, uint32_t total, T *out) {
+    for (int size : segments) {
+        quantizeHistogram(values, size, total, out);
+        values += size;
+        out += size;
+    }
+}
+
+void quantizeHistograms(const float *values, const std::vector<int> &segments, uint32_t total, uint8_t *out) {
+    quantizeSegments(values, segments, total, out);
+}
+
+void quantizeHistograms(const float *values, const std::vector<int> &segments, uint32_t total, uint16_t *out) {
+    quantizeSegments(values, segments, total, out);
+}
+
+/*
+    Convert quantized bins back to fractions of the total
+
+    Parameters:
+        bins: quantized bins
+        count: number of bins
+        total: total the bins were quantized to
+        out: output values
+*/
+template <typename T>
+static void dequantize(const T *bins, int count, uint32_t total, float *out) {
+    for (int i = 0; i < count; i++) {
+        out[i] = static_cast<float>(static_cast<double>(bins[i]) / total);
+    }
+}
+
+void dequantizeHistograms(const uint8_t *bins, int count, uint32_t total, float *out) {
+    dequantize(bins, count, total, out);
+}
+
+void dequantizeHistograms(const uint16_t *bins, int count, uint32_t total, float *out) {
+    dequantize(bins, count, total, out);
+}
@@ -0,0 +1,74 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for quantized histogram features.
+
+    The histogram methods produce one or more histograms that each sum to 1
+    (counts divided by the pixel count). A quantized row stores every bin as
+    an unsigned integer with each histogram scaled to a fixed total, 255 for
+    uint8 bins and 65535 for uint16 bins. Rounding uses the largest remainder
+    so every histogram sums to exactly the total, and an intersection is the
+    integer sum of the bin minimums divided by the total.
+*/
+
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Sum of every quantized histogram
+#define QUANT_TOTAL_U8 255
+#define QUANT_TOTAL_U16 65535
+
+/*
+    Check if a feature method produces histograms that can be quantized
+
+    Parameters:
+        featureMethod: feature method name
+
+    Returns:
+        true for chistogram, mhistogram, texture and face
+*/
+bool isHistogramMethod(const std::string &featureMethod);
+
+/*
+    Split a feature vector of a histogram method into its histograms
+
+    Parameters:
+        featureMethod: chistogram, mhistogram, texture or face
+        dim: feature vector size
+        segments: output size of each histogram, in feature vector order
+
+    Returns:
+        0 on success
+        -1 if the method is not a histogram method or dim does not fit it
+*/
+int histogramSegments(const std::string &featureMethod, int dim, std::vector<int> &segments);
+
+/*
+    Quantize the histograms of a feature vector to a fixed total each
+
+    Parameters:
+        values: feature vector, sum of segments values
+        segments: histogram sizes from histogramSegments
+        total: sum of every quantized histogram (at most the maximum of the output type)
+        out: output bins
+*/
+void quantizeHistograms(const float *values, const std::vector<int> &segments, uint32_t total, uint8_t *out);
+void quantizeHistograms(const float *values, const std::vector<int> &segments, uint32_t total, uint16_t *out);
+
+/*
+    Convert quantized bins back to fractions of the total
+
+    Parameters:
+        bins: quantized bins
+        count: number of bins
+        total: total the bins were quantized to
+        out: output values
+*/
+void dequantizeHistograms(const uint8_t *bins, int count, uint32_t total, float *out);
+void dequantizeHistograms(const uint16_t *bins, int count, uint32_t total, float *out);
+
+#endif
@@ -0,0 +1,266 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Line protocol of the matchImage query server, over stdin/stdout
+    or a Unix domain socket.
+*/
+
+#include "queryServer.h"
+#include <cstring>
+#include "threadPool.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Longest request line a connection may send
+#define QUERY_MAX_LINE 65536
+
+/*
+    Answers the request lines of a stream in order until end of input
+
+    Parameters:
+        in: request lines
+        out: replies, flushed after each one
+        handler: answers a request
+
+    Returns:
+        0 at end of input
+        -1 on a write error
+*/
+int serveLines(FILE *in, FILE *out, const QueryHandler &handler) {
+    std::string request;
+    std::string reply;
+    int c;
+
+    while ((c = fgetc(in)) != EOF || !request.empty()) {
+        if (c != '\n' && c != EOF) {
+            request.push_back(static_cast<char>(c));
+            continue;
+        }
+
+        if (!request.empty() && request.back() == '\r') {
+            request.pop_back();
+        }
+
+        reply.clear();
+        handler(request, reply);
+        reply.push_back('\n');
+        request.clear();
+
+        if (fwrite(reply.data(), 1, reply.size(), out) != reply.size() || fflush(out) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Moves stdout out of the way of the replies of the stdin protocol: returns a
+    stream on the original stdout and points stdout at stderr, so whatever a
+    failing query prints cannot get in between the replies
+
+    Returns:
+        the reply stream
+        nullptr on error, stdout is then unchanged
+*/
+FILE *takeStdout() {
+    fflush(stdout);
+#ifdef _WIN32
+    int fd = _dup(_fileno(stdout));
+    FILE *out = fd >= 0 ? _fdopen(fd, "w") : nullptr;
+    if (!out || _dup2(_fileno(stderr), _fileno(stdout)) != 0) {
+#else
+    int fd = dup(STDOUT_FILENO);
+    FILE *out = fd >= 0 ? fdopen(fd, "w") : nullptr;
+    if (!out || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+#endif
+        printf("Error redirecting stdout\n");
+        if (out) {
+            fclose(out);
+        }
+        else if (fd >= 0) {
+#ifdef _WIN32
+            _close(fd);
+#else
+            close(fd);
+#endif
+        }
+        return nullptr;
+    }
+
+    return out;
+}
+
+#ifdef _WIN32
+
+/*
+    Unix domain sockets are not available, only the stdin protocol is served
+*/
+int serveSocket(const std::string &path, int threads, const QueryHandler &handler) {
+    printf("Error, serving a socket is not supported on this platform, use stdin\n");
+    return -1;
+}
+
+#else
+
+/*
+    Sends a whole buffer
+
+    Parameters:
+        fd: connected socket
+        data: bytes to send
+        size: number of bytes
+
+    Returns:
+        0 on success
+        -1 if the connection is gone
+*/
+static int sendAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, 0);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+
+    return 0;
+}
+
+/*
+    Answers the request lines of one connection until the client closes it
+
+    Parameters:
+        fd: connected socket, closed on return
+        handler: answers a request
+*/
+static void serveConnection(int fd, const QueryHandler &handler) {
+    std::string pending;
+    std::string reply;
+    char buffer[4096];
+
+    for (;;) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            break;
+        }
+        pending.append(buffer, static_cast<size_t>(received));
+
+        // Answer every complete line received so far
+        size_t start = 0;
+        size_t end;
+        bool failed = false;
+        while (!failed && (end = pending.find('\n', start)) != std::string::npos) {
+            size_t length = end - start;
+            if (length > 0 && pending[end - 1] == '\r') {
+                length--;
+            }
+
+            reply.clear();
+            handler(pending.substr(start, length), reply);
+            reply.push_back('\n');
+            failed = sendAll(fd, reply.data(), reply.size()) != 0;
+            start = end + 1;
+        }
+        pending.erase(0, start);
+
+        if (failed) {
+            break;
+        }
+        if (pending.size() > QUERY_MAX_LINE) {
+            const char error[] = "Error, request line too long\n\n";
+            sendAll(fd, error, sizeof(error) - 1);
+            break;
+        }
+    }
+
+    close(fd);
+}
+
+/*
+    Listens on a Unix domain socket and answers the request lines of every
+    connection until it is closed. Connections are served concurrently by a
+    pool of threads, further clients wait for a free thread. Runs until the
+    process is stopped.
+
+    Parameters:
+        path: socket path, an existing socket there is replaced
+        threads: number of connections served at once
+        handler: answers a request
+
+    Returns:
+        -1 if the socket cannot be set up
+*/
+int serveSocket(const std::string &path, int threads, const QueryHandler &handler) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        printf("Error, socket path %s is empty or too long\n", path.c_str());
+        return -1;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    // A client that disconnects early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Replace the socket a previous server left behind, but never a regular file
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            printf("Error, %s exists and is not a socket\n", path.c_str());
+            return -1;
+        }
+        unlink(path.c_str());
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        printf("Error creating socket: %s\n", strerror(errno));
+        return -1;
+    }
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        printf("Error listening on %s: %s\n", path.c_str(), strerror(errno));
+        close(listener);
+        return -1;
+    }
+
+    printf("Listening on %s\n", path.c_str());
+    fflush(stdout);
+
+    ThreadPool pool(threads);
+    for (;;) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            printf("Error accepting a connection: %s\n", strerror(errno));
+            break;
+        }
+
+        pool.submit([fd, &handler] { serveConnection(fd, handler); });
+    }
+
+    close(listener);
+    return -1;
+}
+
+#endif
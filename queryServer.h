@@ -0,0 +1,67 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for the line protocol of the matchImage query server,
+    over stdin/stdout or a Unix domain socket.
+*/
+
+#ifndef QUERYSERVER_H
+#define QUERYSERVER_H
+
+#include <cstdio>
+#include <functional>
+#include <string>
+
+/*
+    Answers one request line (without its newline). The reply may span several
+    lines, the server ends it with an empty line. Called from several threads
+    at once when serving a socket.
+
+    Returns:
+        0 on success
+        -1 if the reply is an error message
+*/
+typedef std::function<int(const std::string &request, std::string &reply)> QueryHandler;
+
+/*
+    Answers the request lines of a stream in order until end of input
+
+    Parameters:
+        in: request lines
+        out: replies, flushed after each one
+        handler: answers a request
+
+    Returns:
+        0 at end of input
+        -1 on a write error
+*/
+int serveLines(FILE *in, FILE *out, const QueryHandler &handler);
+
+/*
+    Moves stdout out of the way of the replies of the stdin protocol: returns a
+    stream on the original stdout and points stdout at stderr, so whatever a
+    failing query prints cannot get in between the replies
+
+    Returns:
+        the reply stream
+        nullptr on error, stdout is then unchanged
+*/
+FILE *takeStdout();
+
+/*
+    Listens on a Unix domain socket and answers the request lines of every
+    connection until it is closed. Connections are served concurrently by a
+    pool of threads, further clients wait for a free thread. Runs until the
+    process is stopped.
+
+    Parameters:
+        path: socket path, an existing socket there is replaced
+        threads: number of connections served at once
+        handler: answers a request
+
+    Returns:
+        -1 if the socket cannot be set up
+*/
+int serveSocket(const std::string &path, int threads, const QueryHandler &handler);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Building sparse histogram rows from dense ones.
+*/
+
+#include "sparseHistogram.h"
+
+/*
+    Collect the nonzero bins of a dense row
+
+    Parameters:
+        dense: dense row
+        dim: number of bins, at most SPARSE_MAX_DIM
+        indices: output bin indices
+        values: output bin values
+
+    Returns:
+        sparse row pointing into indices and values
+*/
+template <typename T>
+SparseHistogram<T> sparsify(const T *dense, int dim, std::vector<uint16_t> &indices, std::vector<T> &values) {
+    indices.clear();
+    values.clear();
+    for (int i = 0; i < dim; i++) {
+        if (dense[i] != 0) {
+            indices.push_back(static_cast<uint16_t>(i));
+            values.push_back(dense[i]);
+        }
+    }
+
+    SparseHistogram<T> row;
+    row.indices = indices.data();
+    row.values = values.data();
+    row.count = static_cast<uint32_t>(indices.size());
+    return row;
+}
+
+template SparseHistogram<float> sparsify(const float *, int, std::vector<uint16_t> &, std::vector<float> &);
+template SparseHistogram<uint8_t> sparsify(const uint8_t *, int, std::vector<uint16_t> &, std::vector<uint8_t> &);
+template SparseHistogram<uint16_t> sparsify(const uint16_t *, int, std::vector<uint16_t> &, std::vector<uint16_t> &);
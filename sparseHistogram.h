@@ -0,0 +1,45 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for sparse histogram rows.
+
+    The rg chromaticity histograms only fill a small band of the histSize x
+    histSize plane (r + g > 1 can never be reached), so most bins are zero.
+    A sparse row keeps only the nonzero bins as (index, value) pairs in
+    ascending index order. Bin indices are uint16_t, so a sparse row can
+    index up to SPARSE_MAX_DIM features (3 histograms of 128 x 128 bins).
+*/
+
+#ifndef SPARSEHISTOGRAM_H
+#define SPARSEHISTOGRAM_H
+
+#include <cstdint>
+#include <vector>
+
+// Largest feature vector a sparse row can index
+#define SPARSE_MAX_DIM 65536
+
+// Nonzero bins of a histogram row, values are float or quantized bins
+template <typename T>
+struct SparseHistogram {
+    const uint16_t *indices = nullptr;
+    const T *values = nullptr;
+    uint32_t count = 0;
+};
+
+/*
+    Collect the nonzero bins of a dense row
+
+    Parameters:
+        dense: dense row
+        dim: number of bins, at most SPARSE_MAX_DIM
+        indices: output bin indices
+        values: output bin values
+
+    Returns:
+        sparse row pointing into indices and values
+*/
+template <typename T>
+SparseHistogram<T> sparsify(const T *dense, int dim, std::vector<uint16_t> &indices, std::vector<T> &values);
+
+#endif
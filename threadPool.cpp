@@ -0,0 +1,152 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Work-stealing thread pool implementation.
+*/
+
+#include "threadPool.h"
+
+/*
+    Starts the worker threads.
+
+    Parameters:
+        numThreads: number of workers (at least one worker is always started)
+*/
+ThreadPool::ThreadPool(int numThreads) {
+    if (numThreads < 1) {
+        numThreads = 1;
+    }
+
+    for (int i = 0; i < numThreads; i++) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    for (int i = 0; i < numThreads; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+/*
+    Finishes all queued tasks, then joins the workers.
+*/
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+/*
+    Queues a task on the next worker queue (round-robin) and wakes a worker.
+
+    Parameters:
+        task: work to run on a pool thread
+*/
+void ThreadPool::submit(std::function<void()> task) {
+    size_t index = nextQueue.fetch_add(1) % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+
+    {
+        // Increment under the sleep lock so a worker cannot miss the wake up
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queuedTasks++;
+    }
+    wakeUp.notify_one();
+}
+
+/*
+    Runs task(0) .. task(count - 1) on the workers and waits for all of them.
+
+    Parameters:
+        count: number of tasks
+        task: work to run, given the task index
+*/
+void ThreadPool::runAll(int count, const std::function<void(int)> &task) {
+    std::mutex doneMutex;
+    std::condition_variable allDone;
+    int remaining = count;
+
+    for (int i = 0; i < count; i++) {
+        submit([&, i] {
+            task(i);
+
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (--remaining == 0) {
+                allDone.notify_all();
+            }
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    allDone.wait(lock, [&] { return remaining == 0; });
+}
+
+/*
+    Takes the next task for a worker: front of its own queue first, then
+    steals from the back of the other queues.
+
+    Parameters:
+        worker: index of the calling worker
+        task: output task
+
+    Returns:
+        true if a task was taken
+*/
+bool ThreadPool::takeTask(int worker, std::function<void()> &task) {
+    size_t numQueues = queues.size();
+
+    for (size_t k = 0; k < numQueues; k++) {
+        size_t index = (worker + k) % numQueues;
+        WorkQueue &queue = *queues[index];
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+
+        if (k == 0) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        else {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        queuedTasks--;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+    Worker thread body, runs tasks until the pool is stopping and no work is left.
+
+    Parameters:
+        worker: index of this worker
+*/
+void ThreadPool::workerLoop(int worker) {
+    std::function<void()> task;
+
+    for (;;) {
+        if (takeTask(worker, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this] { return stopping || queuedTasks > 0; });
+        if (stopping && queuedTasks == 0) {
+            return;
+        }
+    }
+}
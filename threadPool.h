@@ -0,0 +1,74 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for a small work-stealing thread pool used to
+    spread per-image work across cores.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    Work-stealing thread pool.
+
+    Every worker owns a task queue. Submitted tasks are dealt round-robin
+    onto the worker queues; a worker takes tasks from the front of its own
+    queue and, once that is empty, steals from the back of the other queues.
+    This keeps all cores busy when task costs vary a lot (large JPEGs, face
+    detection) without any static chunking of the work.
+
+    Tasks must not throw.
+*/
+class ThreadPool {
+public:
+    explicit ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Queue a task for execution on one of the workers
+    void submit(std::function<void()> task);
+
+    /*
+        Runs task(0) .. task(count - 1) on the workers and waits for all of
+        them. Must not be called from a task of the same pool.
+
+        Parameters:
+            count: number of tasks
+            task: work to run, given the task index
+    */
+    void runAll(int count, const std::function<void(int)> &task);
+
+    // Number of worker threads
+    int size() const { return static_cast<int>(workers.size()); }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<long> queuedTasks{0};
+    std::atomic<size_t> nextQueue{0};
+    bool stopping = false;
+
+    bool takeTask(int worker, std::function<void()> &task);
+    void workerLoop(int worker);
+};
+
+#endif
@@ -0,0 +1,31 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Keeping the N best matches of a scan.
+*/
+
+#include "topN.h"
+
+/*
+    Offer every match kept by another TopN
+
+    Parameters:
+        other: matches to offer
+*/
+void TopN::merge(const TopN &other) {
+    for (const Match &match : other.heap) {
+        push(match.first, match.second);
+    }
+}
+
+/*
+    The kept matches, best first
+
+    Returns:
+        at most N matches in ascending distance
+*/
+std::vector<Match> TopN::sorted() const {
+    std::vector<Match> matches = heap;
+    std::sort_heap(matches.begin(), matches.end());
+    return matches;
+}
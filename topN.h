@@ -0,0 +1,84 @@
+/*
+    Name: Aafi Mansuri & Terry Zhen
+
+    Purpose: Header file for keeping the N best matches of a scan.
+
+    Scans push the distance of every row and only the N smallest are kept,
+    in a max-heap whose top is the worst kept match, so a scan needs O(N)
+    memory whatever the number of rows. Equal distances are ordered by image
+    ID, which makes the result independent of the order rows are pushed in.
+*/
+
+#ifndef TOPN_H
+#define TOPN_H
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "featureDatabase.h"
+
+// Distance and image ID of a match
+typedef std::pair<float, ImageId> Match;
+
+/*
+    The N matches with the smallest distances
+*/
+class TopN {
+public:
+    explicit TopN(int n) : limit(n > 0 ? static_cast<size_t>(n) : 0) { heap.reserve(limit); }
+
+    // Offer a match, it is kept if it is among the N best so far
+    void push(float distance, ImageId id) {
+        Match match(distance, id);
+        if (heap.size() < limit) {
+            heap.push_back(match);
+            std::push_heap(heap.begin(), heap.end());
+        }
+        else if (limit > 0 && match < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = match;
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    /*
+        Distance a match must beat to be kept: the worst kept distance once N
+        matches are held, infinity before. A match at exactly this distance is
+        only kept if its ID is smaller, so rows with a larger distance can be
+        skipped without computing it completely.
+
+        Returns:
+            distance of the worst kept match
+    */
+    float bound() const {
+        if (limit == 0) {
+            return -std::numeric_limits<float>::infinity();
+        }
+        return heap.size() < limit ? std::numeric_limits<float>::infinity() : heap.front().first;
+    }
+
+    /*
+        Offer every match kept by another TopN, such as the heap of one
+        thread of a parallel scan. Ties are broken by image ID, so merging
+        the heaps of any split of the rows keeps the same matches as one scan.
+
+        Parameters:
+            other: matches to offer
+    */
+    void merge(const TopN &other);
+
+    /*
+        The kept matches, best first
+
+        Returns:
+            at most N matches in ascending distance
+    */
+    std::vector<Match> sorted() const;
+
+private:
+    size_t limit;
+    std::vector<Match> heap;
+};
+
+#endif